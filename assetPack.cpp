@@ -0,0 +1,514 @@
+///		***
+///
+///		assetPack.cpp - reading and building asset packs
+///		Blocks are compressed with a small LZ77 coder (LZ4 style sequences: a token, literals, a 16 bit offset
+///		and a match length). A block that doesn't get any smaller is stored as is.
+///
+///		***
+
+#include "assetPack.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+
+static unsigned int read32(const unsigned char* p)
+{
+	unsigned int v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+//writes the 15+ tail of a literal or match length
+static void lzPutLength(unsigned char* dst, size_t& op, size_t len)
+{
+	while(len >= 255)
+	{
+		dst[op++] = 255;
+		len -= 255;
+	}
+	dst[op++] = (unsigned char)len;
+}
+
+//appends one sequence, returns false if it doesn't fit in dstCap
+static bool lzPutSequence(unsigned char* dst, size_t& op, size_t dstCap, const unsigned char* lit, size_t litLen,
+						  size_t offset, size_t matchLen)
+{
+	size_t ml = matchLen ? matchLen - LZ_MIN_MATCH : 0;
+	size_t need = 1 + litLen + litLen / 255 + 1 + (matchLen ? 2 + ml / 255 + 1 : 0);
+	if(op + need > dstCap)
+		return false;
+	dst[op++] = (unsigned char)(((litLen < 15 ? litLen : 15) << 4) | (ml < 15 ? ml : 15));
+	if(litLen >= 15)
+		lzPutLength(dst, op, litLen - 15);
+	memcpy(dst + op, lit, litLen);
+	op += litLen;
+	if(matchLen)
+	{
+		dst[op++] = (unsigned char)(offset & 0xFF);
+		dst[op++] = (unsigned char)(offset >> 8);
+		if(ml >= 15)
+			lzPutLength(dst, op, ml - 15);
+	}
+	return true;
+}
+
+//returns the compressed size, or 0 if it wouldn't fit in dstCap
+static size_t lzCompress(const unsigned char* src, size_t srcLen, unsigned char* dst, size_t dstCap)
+{
+	int table[1 << LZ_HASH_BITS];
+	for(size_t i = 0; i < (1 << LZ_HASH_BITS); i++)
+	{
+		table[i] = -1;
+	}
+	size_t ip = 0, anchor = 0, op = 0;
+	while(ip + LZ_MIN_MATCH < srcLen)
+	{
+		unsigned int seq = read32(src + ip);
+		unsigned int h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+		int ref = table[h];
+		table[h] = (int)ip;
+		if(ref >= 0 && ip - ref <= LZ_MAX_OFFSET && read32(src + ref) == seq)
+		{
+			size_t len = LZ_MIN_MATCH;
+			while(ip + len < srcLen && src[ref + len] == src[ip + len])
+				len++;
+			if(!lzPutSequence(dst, op, dstCap, src + anchor, ip - anchor, ip - ref, len))
+				return 0;
+			ip += len;
+			anchor = ip;
+		}
+		else
+			ip++;
+	}
+	//whatever is left over goes out as literals with no match
+	if(!lzPutSequence(dst, op, dstCap, src + anchor, srcLen - anchor, 0, 0))
+		return 0;
+	return op;
+}
+
+//every length and offset is checked, a corrupt block fails rather than writing out of bounds
+static bool lzDecompress(const unsigned char* src, size_t srcLen, unsigned char* dst, size_t dstLen)
+{
+	size_t ip = 0, op = 0;
+	while(ip < srcLen)
+	{
+		unsigned char token = src[ip++];
+		size_t litLen = token >> 4;
+		if(litLen == 15)
+		{
+			unsigned char b;
+			do{
+				if(ip >= srcLen) return false;
+				b = src[ip++];
+				litLen += b;
+			}while(b == 255);
+		}
+		if(litLen > srcLen - ip || litLen > dstLen - op)
+			return false;
+		memcpy(dst + op, src + ip, litLen);
+		ip += litLen;
+		op += litLen;
+		//the last sequence is literals only
+		if(ip == srcLen)
+			break;
+		if(srcLen - ip < 2)
+			return false;
+		size_t offset = src[ip] | (src[ip + 1] << 8);
+		ip += 2;
+		if(offset == 0 || offset > op)
+			return false;
+		size_t matchLen = token & 15;
+		if(matchLen == 15)
+		{
+			unsigned char b;
+			do{
+				if(ip >= srcLen) return false;
+				b = src[ip++];
+				matchLen += b;
+			}while(b == 255);
+		}
+		matchLen += LZ_MIN_MATCH;
+		if(matchLen > dstLen - op)
+			return false;
+		//byte by byte as the match may overlap what it is writing
+		for(size_t i = 0; i < matchLen; i++, op++)
+		{
+			dst[op] = dst[op - offset];
+		}
+	}
+	return op == dstLen;
+}
+
+//pack names are lower case with forward slashes and no leading ./ so lookups don't depend on how a path was typed
+string packName(const char* path)
+{
+	string name(path);
+	for(size_t i = 0; i < name.size(); i++)
+	{
+		if(name[i] == '\\') name[i] = '/';
+		else if(name[i] >= 'A' && name[i] <= 'Z') name[i] = name[i] - 'A' + 'a';
+	}
+	string::size_type dot;
+	while((dot = name.find("/./")) != string::npos)
+		name.erase(dot, 2);
+	while(name.compare(0, 2, "./") == 0)
+		name.erase(0, 2);
+	return name;
+}
+
+assetPack::assetPack()
+{
+	m_Map.file = m_Map.map = NULL; m_Map.view = NULL; m_Map.size = 0;
+	m_Header = NULL; m_Entries = NULL; m_Blocks = NULL; m_Names = NULL;
+}
+
+assetPack::~assetPack()
+{
+	close();
+}
+
+bool assetPack::open(const char* path)
+{
+	close();
+	if(!mapFile(path, m_Map, false))
+		return false;
+	const packHeader* hdr = (const packHeader*)m_Map.view;
+	size_t indexSize = 0;
+	bool valid = m_Map.size >= sizeof(packHeader) && hdr->magic == PACK_MAGIC && hdr->version == PACK_VERSION
+		&& hdr->blockSize > 0 && hdr->indexOffset <= m_Map.size;
+	if(valid)
+	{
+		indexSize = sizeof(packEntry) * (size_t)hdr->numEntries + sizeof(unsigned int) * (size_t)hdr->numBlocks + hdr->namesSize;
+		valid = indexSize <= m_Map.size - hdr->indexOffset;
+	}
+	if(!valid)
+	{
+		printf("ERROR, %s is not a valid asset pack\n", path);
+		unmapFile(m_Map);
+		return false;
+	}
+	m_Header = hdr;
+	m_Entries = (const packEntry*)(m_Map.view + hdr->indexOffset);
+	m_Blocks = (const unsigned int*)(m_Entries + hdr->numEntries);
+	m_Names = (const char*)(m_Blocks + hdr->numBlocks);
+	//check the index once here so find and read can trust it, the size has to need exactly numBlocks blocks
+	//or read would size its output from a number the blocks can't fill (an empty entry has no blocks)
+	for(size_t i = 0; i < hdr->numEntries; i++)
+	{
+		const packEntry& e = m_Entries[i];
+		bool sizeFits = e.numBlocks == 0 ? e.size == 0 : (e.size <= (unsigned long long)e.numBlocks * hdr->blockSize
+			&& e.size > (unsigned long long)(e.numBlocks - 1) * hdr->blockSize);
+		if((size_t)e.nameOffset + e.nameLen > hdr->namesSize || (size_t)e.firstBlock + e.numBlocks > hdr->numBlocks
+			|| e.offset > m_Map.size || !sizeFits)
+		{
+			printf("ERROR, %s has a corrupt index\n", path);
+			close();
+			return false;
+		}
+	}
+	return true;
+}
+
+void assetPack::close()
+{
+	unmapFile(m_Map);
+	m_Header = NULL; m_Entries = NULL; m_Blocks = NULL; m_Names = NULL;
+}
+
+//returns the index of the entry called name, or -1
+int assetPack::find(const char* name) const
+{
+	if(!m_Header)
+		return -1;
+	string key = packName(name);
+	size_t lo = 0, hi = m_Header->numEntries;
+	while(lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+		const packEntry& e = m_Entries[mid];
+		int c = key.compare(0, string::npos, m_Names + e.nameOffset, e.nameLen);
+		if(c == 0)
+			return (int)mid;
+		if(c < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return -1;
+}
+
+size_t assetPack::entrySize(int entry) const
+{
+	return (size_t)m_Entries[entry].size;
+}
+
+//an entry that was stored uncompressed can be used straight out of the mapping, otherwise this is NULL
+const char* assetPack::view(int entry) const
+{
+	const packEntry& e = m_Entries[entry];
+	if(!(e.flags & PACK_ENTRY_RAW) || e.size > m_Map.size - e.offset)
+		return NULL;
+	return m_Map.view + e.offset;
+}
+
+bool assetPack::read(int entry, vector<char>& out) const
+{
+	const packEntry& e = m_Entries[entry];
+	out.resize((size_t)e.size);
+	size_t pos = (size_t)e.offset, done = 0;
+	for(size_t b = 0; b < e.numBlocks; b++)
+	{
+		unsigned int word = m_Blocks[e.firstBlock + b];
+		size_t stored = word & ~PACK_BLOCK_RAW;
+		size_t len = (size_t)e.size - done;
+		if(len > m_Header->blockSize)
+			len = m_Header->blockSize;
+		if(stored > m_Map.size - pos)
+			return false;
+		const unsigned char* src = (const unsigned char*)m_Map.view + pos;
+		if(word & PACK_BLOCK_RAW)
+		{
+			if(stored != len)
+				return false;
+			memcpy(&out[done], src, len);
+		}
+		else if(!lzDecompress(src, stored, (unsigned char*)&out[done], len))
+			return false;
+		pos += stored;
+		done += len;
+	}
+	return done == e.size;
+}
+
+//name order for the index, the entry data itself stays in the order the files were given
+struct packNameLess{
+	const vector<string>* names;
+	bool operator()(size_t a, size_t b) const { return (*names)[a] < (*names)[b]; }
+};
+
+//writes every file in files into a new pack, in the order given so related files end up next to each other
+bool assetPack::build(const char* packPath, const vector<string>& files, unsigned int blockSize)
+{
+	string tmpPath = string(packPath) + ".tmp";
+	FILE* f = fopen(tmpPath.c_str(), "wb");
+	if(!f)
+	{
+		printf("ERROR, could not create %s\n", packPath);
+		return false;
+	}
+	packHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	unsigned long long pos = sizeof(hdr);
+
+	vector<packEntry> entries;
+	vector<string> names;
+	vector<unsigned int> blocks;
+	vector<unsigned char> scratch(blockSize);
+	static const char zero[PACK_ALIGN] = {0};
+	bool ok = true;
+	for(size_t i = 0; i < files.size() && ok; i++)
+	{
+		string name = packName(files[i].c_str());
+		if(std::find(names.begin(), names.end(), name) != names.end())
+			continue;
+		unsigned long long size, time;
+		fileMapping fm;
+		if(!getFileStamp(files[i].c_str(), size, time) || (size > 0 && !mapFile(files[i].c_str(), fm, false)))
+		{
+			printf("WARNING, could not read %s, it won't be packed\n", files[i].c_str());
+			continue;
+		}
+		size_t pad = (size_t)((PACK_ALIGN - pos % PACK_ALIGN) % PACK_ALIGN);
+		fwrite(zero, 1, pad, f);
+		pos += pad;
+
+		packEntry e;
+		memset(&e, 0, sizeof(e));
+		e.offset = pos;
+		e.size = size;
+		e.firstBlock = (unsigned int)blocks.size();
+		e.flags = PACK_ENTRY_RAW;
+		for(size_t done = 0; done < size; done += blockSize)
+		{
+			size_t len = (size_t)(size - done);
+			if(len > blockSize)
+				len = blockSize;
+			const unsigned char* src = (const unsigned char*)fm.view + done;
+			//the compressed block has to come out at least a byte smaller to be worth it
+			size_t packed = lzCompress(src, len, &scratch[0], len - 1);
+			if(packed > 0)
+			{
+				fwrite(&scratch[0], 1, packed, f);
+				blocks.push_back((unsigned int)packed);
+				pos += packed;
+				e.flags &= ~PACK_ENTRY_RAW;
+			}
+			else
+			{
+				fwrite(src, 1, len, f);
+				blocks.push_back((unsigned int)len | PACK_BLOCK_RAW);
+				pos += len;
+			}
+			e.numBlocks++;
+		}
+		unmapFile(fm);
+		entries.push_back(e);
+		names.push_back(name);
+		ok = ferror(f) == 0;
+	}
+
+	//the index is sorted by name, so find can binary search it
+	vector<size_t> order(entries.size());
+	for(size_t i = 0; i < order.size(); i++)
+	{
+		order[i] = i;
+	}
+	packNameLess less;
+	less.names = &names;
+	sort(order.begin(), order.end(), less);
+	string blob;
+	for(size_t i = 0; i < order.size(); i++)
+	{
+		packEntry& e = entries[order[i]];
+		e.nameOffset = (unsigned int)blob.size();
+		e.nameLen = (unsigned int)names[order[i]].size();
+		blob += names[order[i]];
+	}
+	hdr.magic = PACK_MAGIC;
+	hdr.version = PACK_VERSION;
+	hdr.numEntries = (unsigned int)entries.size();
+	hdr.numBlocks = (unsigned int)blocks.size();
+	hdr.blockSize = blockSize;
+	hdr.namesSize = (unsigned int)blob.size();
+	hdr.indexOffset = pos;
+	for(size_t i = 0; i < order.size(); i++)
+	{
+		fwrite(&entries[order[i]], sizeof(packEntry), 1, f);
+	}
+	if(!blocks.empty())
+		fwrite(&blocks[0], sizeof(unsigned int), blocks.size(), f);
+	fwrite(blob.data(), 1, blob.size(), f);
+	fseek(f, 0, SEEK_SET);
+	fwrite(&hdr, sizeof(hdr), 1, f);
+
+	ok = ok && ferror(f) == 0;
+	fclose(f);
+	if(!ok || !MoveFileExA(tmpPath.c_str(), packPath, MOVEFILE_REPLACE_EXISTING))
+	{
+		printf("ERROR, could not write %s\n", packPath);
+		DeleteFileA(tmpPath.c_str());
+		return false;
+	}
+	printf("Packed %u files into %s (%llu bytes)\n", hdr.numEntries, packPath, pos);
+	return true;
+}
+
+//the first mounted pack holding path wins, returns NULL if none of them have it
+const assetPack* findInPacks(const packList& packs, const char* path, int& entry)
+{
+	for(size_t i = 0; i < packs.size(); i++)
+	{
+		entry = packs[i]->find(path);
+		if(entry >= 0)
+			return packs[i].get();
+	}
+	entry = -1;
+	return NULL;
+}
+
+packIOStream::packIOStream(const char* data, size_t size)
+{
+	m_Data = data;
+	m_Size = size;
+	m_Pos = 0;
+}
+
+packIOStream::packIOStream(vector<char>& data)
+{
+	m_Owned.swap(data);
+	m_Data = m_Owned.empty() ? NULL : &m_Owned[0];
+	m_Size = m_Owned.size();
+	m_Pos = 0;
+}
+
+size_t packIOStream::Read(void* pvBuffer, size_t pSize, size_t pCount)
+{
+	if(pSize == 0 || m_Pos >= m_Size)
+		return 0;
+	size_t count = (m_Size - m_Pos) / pSize;
+	if(count > pCount)
+		count = pCount;
+	memcpy(pvBuffer, m_Data + m_Pos, count * pSize);
+	m_Pos += count * pSize;
+	return count;
+}
+
+size_t packIOStream::Write(const void* pvBuffer, size_t pSize, size_t pCount)
+{
+	return 0;
+}
+
+aiReturn packIOStream::Seek(size_t pOffset, aiOrigin pOrigin)
+{
+	size_t newPos;
+	if(pOrigin == aiOrigin_SET)
+		newPos = pOffset;
+	else if(pOrigin == aiOrigin_CUR)
+		newPos = m_Pos + pOffset;
+	else
+		newPos = m_Size + pOffset; //the offset is negative (wrapped around) for aiOrigin_END
+	if(newPos > m_Size)
+		return aiReturn_FAILURE;
+	m_Pos = newPos;
+	return aiReturn_SUCCESS;
+}
+
+size_t packIOStream::Tell() const
+{
+	return m_Pos;
+}
+
+size_t packIOStream::FileSize() const
+{
+	return m_Size;
+}
+
+void packIOStream::Flush()
+{
+}
+
+packIOSystem::packIOSystem(const packList& packs)
+{
+	m_Packs = packs;
+}
+
+bool packIOSystem::Exists(const char* pFile) const
+{
+	int entry;
+	return findInPacks(m_Packs, pFile, entry) != NULL || mappedIOSystem::Exists(pFile);
+}
+
+Assimp::IOStream* packIOSystem::Open(const char* pFile, const char* pMode)
+{
+	int entry;
+	const assetPack* pack = findInPacks(m_Packs, pFile, entry);
+	if(!pack)
+		return mappedIOSystem::Open(pFile, pMode);
+	if(strchr(pMode, 'w') || strchr(pMode, 'a'))
+		return NULL;
+	const char* data = pack->view(entry);
+	if(data)
+		return new packIOStream(data, pack->entrySize(entry));
+	vector<char> buf;
+	if(!pack->read(entry, buf))
+	{
+		printf("ERROR, %s is corrupt in its asset pack\n", pFile);
+		return NULL;
+	}
+	return new packIOStream(buf);
+}
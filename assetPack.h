@@ -0,0 +1,99 @@
+///		***
+///
+///		assetPack.h - single file asset pack, holds models and textures so they don't have to be opened one by one
+///		A pack is a header, the entry data (each entry split into independently compressed blocks and starting
+///		on a PACK_ALIGN boundary), then an index sorted by name so lookups are a binary search.
+///
+///		***
+
+#ifndef ASSETPACK_H
+#define ASSETPACK_H
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include "mappedIO.h"
+
+using namespace std;
+
+#define PACK_MAGIC 0x31504C4D //"MLP1"
+#define PACK_VERSION 1
+#define PACK_ALIGN 4096 //every entry starts on a page so it can be mapped or read on its own
+#define PACK_BLOCK_SIZE 65536 //entries are compressed in blocks of this many bytes
+#define PACK_BLOCK_RAW 0x80000000 //set in a block table word if the block didn't compress and is stored as is
+#define PACK_ENTRY_RAW 1 //every block of the entry is stored as is, so it can be used straight from the mapping
+
+struct packHeader{
+	unsigned int magic, version;
+	unsigned int numEntries, numBlocks, blockSize;
+	unsigned int namesSize;
+	unsigned long long indexOffset; //the packEntry array, followed by the block table and the names
+};
+
+struct packEntry{
+	unsigned long long offset, size; //where the entry's first block is and its uncompressed size
+	unsigned int nameOffset, nameLen; //into the names blob, names are normalised (see packName)
+	unsigned int firstBlock, numBlocks; //into the block table, each word is the stored size of one block
+	unsigned int flags;
+	unsigned int pad;
+};
+
+class assetPack{
+public:
+	assetPack();
+	~assetPack();
+	bool open(const char* path);
+	void close();
+	int find(const char* name) const;
+	size_t entrySize(int entry) const;
+	const char* view(int entry) const;
+	bool read(int entry, vector<char>& out) const;
+	static bool build(const char* packPath, const vector<string>& files, unsigned int blockSize = PACK_BLOCK_SIZE);
+
+private:
+	assetPack(const assetPack&);
+	assetPack& operator=(const assetPack&);
+
+	fileMapping m_Map;
+	const packHeader* m_Header;
+	const packEntry* m_Entries;
+	const unsigned int* m_Blocks;
+	const char* m_Names;
+};
+
+typedef vector<shared_ptr<assetPack> > packList;
+
+string packName(const char* path);
+const assetPack* findInPacks(const packList& packs, const char* path, int& entry);
+
+//a read only stream over one pack entry
+class packIOStream : public Assimp::IOStream{
+public:
+	packIOStream(const char* data, size_t size);
+	packIOStream(vector<char>& data);
+	size_t Read(void* pvBuffer, size_t pSize, size_t pCount);
+	size_t Write(const void* pvBuffer, size_t pSize, size_t pCount);
+	aiReturn Seek(size_t pOffset, aiOrigin pOrigin);
+	size_t Tell() const;
+	size_t FileSize() const;
+	void Flush();
+
+private:
+	vector<char> m_Owned; //the decompressed entry, empty if m_Data points into the pack's mapping
+	const char* m_Data;
+	size_t m_Size, m_Pos;
+};
+
+//opens files out of the mounted packs, anything that isn't packed is mapped from disk as usual
+class packIOSystem : public mappedIOSystem{
+public:
+	packIOSystem(const packList& packs);
+	bool Exists(const char* pFile) const;
+	Assimp::IOStream* Open(const char* pFile, const char* pMode = "rb");
+
+private:
+	packList m_Packs;
+};
+
+#endif
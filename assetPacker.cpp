@@ -0,0 +1,82 @@
+///		***
+///
+///		assetPacker.cpp - command line tool that builds an asset pack out of a set of models
+///		usage: assetPacker out.pak model1 [model2 ...]
+///		Each model is imported once to find everything it pulls in (.mtl files, textures), and those files are
+///		packed straight after it so a model and the files it needs come back in one sequential read.
+///
+///		***
+
+#include "assetPack.h"
+#include "assimp\Importer.hpp"
+#include "assimp\scene.h"
+
+//remembers every file ASSIMP opens while importing a model
+class recordingIOSystem : public mappedIOSystem{
+public:
+	vector<string> opened;
+	Assimp::IOStream* Open(const char* pFile, const char* pMode = "rb")
+	{
+		Assimp::IOStream* stream = mappedIOSystem::Open(pFile, pMode);
+		if(stream)
+			opened.push_back(pFile);
+		return stream;
+	}
+};
+
+//adds file and everything it depends on to files, in the order they should be packed
+static void gatherRelated(const char* file, vector<string>& files)
+{
+	files.push_back(file);
+	Assimp::Importer importer;
+	recordingIOSystem* io = new recordingIOSystem;
+	importer.SetIOHandler(io);
+	//no post processing, this import is only to find out which files the model uses
+	const aiScene* s = importer.ReadFile(file, 0);
+	files.insert(files.end(), io->opened.begin(), io->opened.end());
+	if(!s)
+	{
+		printf("WARNING, could not import %s (%s), only the file itself is packed\n", file, importer.GetErrorString());
+		return;
+	}
+	//textures are found the same way modelLoader::loadMat finds them
+	string name = file;
+	string dir;
+	string::size_type slashInd = name.find_last_of("/");
+	if(slashInd == string::npos){
+		dir = ".";
+	} else if(slashInd == 0){
+		dir = "/";
+	}else{
+		dir = name.substr(0, slashInd);
+	}
+	aiTextureType types[2] = {aiTextureType_DIFFUSE, aiTextureType_HEIGHT};
+	for(size_t i = 0; i < s->mNumMaterials; i++)
+	{
+		for(size_t t = 0; t < 2; t++)
+		{
+			aiString path;
+			if(s->mMaterials[i]->GetTextureCount(types[t]) > 0 &&
+				s->mMaterials[i]->GetTexture(types[t], 0, &path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS)
+			{
+				files.push_back(dir + "/" + path.data);
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 3)
+	{
+		printf("usage: assetPacker out.pak model1 [model2 ...]\n");
+		return 1;
+	}
+	vector<string> files;
+	for(int i = 2; i < argc; i++)
+	{
+		gatherRelated(argv[i], files);
+	}
+	//repeated files (shared textures and so on) are only packed the first time they come up
+	return assetPack::build(argv[1], files) ? 0 : 1;
+}
@@ -0,0 +1,244 @@
+///		***
+///
+///		geometryPool.cpp - the CPU suballocator and the GL buffers behind the geometry pool
+///
+///		***
+
+#include "geometryPool.h"
+
+rangeAllocator::rangeAllocator(size_t size)
+{
+	m_Size = size;
+	m_Used = 0;
+	addFree(0, size);
+}
+
+//rounds bytes up to its class: multiples of POOL_MIN_CLASS, then eight steps per power of two. Ranges of the
+//same class fit each other's holes exactly, which is most of what keeps the pool from splintering.
+size_t rangeAllocator::sizeClass(size_t bytes)
+{
+	if(bytes <= POOL_MIN_CLASS)
+		return POOL_MIN_CLASS;
+	size_t top = POOL_MIN_CLASS;
+	while(top < bytes)
+	{
+		top <<= 1;
+	}
+	size_t step = top / 8;
+	if(step < POOL_MIN_CLASS)
+		step = POOL_MIN_CLASS;
+	return (bytes + step - 1) / step * step;
+}
+
+void rangeAllocator::addFree(size_t offset, size_t bytes)
+{
+	m_ByOffset[offset] = bytes;
+	m_BySize.insert(make_pair(bytes, offset));
+}
+
+void rangeAllocator::removeFree(map<size_t, size_t>::iterator it)
+{
+	pair<multimap<size_t, size_t>::iterator, multimap<size_t, size_t>::iterator> r = m_BySize.equal_range(it->second);
+	for(multimap<size_t, size_t>::iterator s = r.first; s != r.second; s++)
+	{
+		if(s->second == it->first)
+		{
+			m_BySize.erase(s);
+			break;
+		}
+	}
+	m_ByOffset.erase(it);
+}
+
+//bytes should already be a size class. Takes the smallest free block it fits in.
+bool rangeAllocator::alloc(size_t bytes, size_t& offset)
+{
+	multimap<size_t, size_t>::iterator s = m_BySize.lower_bound(bytes);
+	if(s == m_BySize.end())
+		return false;
+	size_t blockOffset = s->second, blockSize = s->first;
+	removeFree(m_ByOffset.find(blockOffset));
+	if(blockSize > bytes)
+		addFree(blockOffset + bytes, blockSize - bytes);
+	m_Used += bytes;
+	offset = blockOffset;
+	return true;
+}
+
+//gives a range back, joining it to the free blocks on either side
+void rangeAllocator::free(size_t offset, size_t bytes)
+{
+	m_Used -= bytes;
+	map<size_t, size_t>::iterator next = m_ByOffset.lower_bound(offset);
+	if(next != m_ByOffset.end() && next->first == offset + bytes)
+	{
+		bytes += next->second;
+		removeFree(next);
+	}
+	map<size_t, size_t>::iterator prev = m_ByOffset.lower_bound(offset);
+	if(prev != m_ByOffset.begin())
+	{
+		prev--;
+		if(prev->first + prev->second == offset)
+		{
+			offset = prev->first;
+			bytes += prev->second;
+			removeFree(prev);
+		}
+	}
+	addFree(offset, bytes);
+}
+
+size_t rangeAllocator::largestFree() const
+{
+	return m_BySize.empty() ? 0 : m_BySize.rbegin()->first;
+}
+
+bool rangeAllocator::check() const
+{
+	if(m_ByOffset.size() != m_BySize.size())
+		return false;
+	size_t free = 0, end = 0;
+	for(map<size_t, size_t>::const_iterator it = m_ByOffset.begin(); it != m_ByOffset.end(); it++)
+	{
+		//blocks never overlap, and two that touch should have been merged
+		if(it != m_ByOffset.begin() && it->first <= end)
+			return false;
+		end = it->first + it->second;
+		free += it->second;
+	}
+	return end <= m_Size && free + m_Used == m_Size;
+}
+
+geometryPool::geometryPool(size_t pageSize)
+{
+	m_PageSize = pageSize;
+	m_NumRanges = 0;
+}
+
+int geometryPool::newPage(size_t size, bool dedicated)
+{
+	page p;
+	p.ranges = new rangeAllocator(size);
+	p.dedicated = dedicated;
+	//the copy target keeps this away from whatever VAO happens to be bound
+	glGenBuffers(1, &p.buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, p.buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	for(size_t i = 0; i < m_Pages.size(); i++)
+	{
+		if(m_Pages[i].ranges == NULL)
+		{
+			m_Pages[i] = p;
+			return (int)i;
+		}
+	}
+	m_Pages.push_back(p);
+	return (int)m_Pages.size() - 1;
+}
+
+bool geometryPool::alloc(size_t bytes, poolRange& out)
+{
+	out.page = -1;
+	out.offset = out.size = 0;
+	if(bytes == 0)
+		return false;
+	size_t cls = rangeAllocator::sizeClass(bytes);
+	if(cls > m_PageSize)
+	{
+		int p = newPage(cls, true);
+		m_Pages[p].ranges->alloc(cls, out.offset);
+		out.page = p;
+		out.size = cls;
+		m_NumRanges++;
+		return true;
+	}
+	for(size_t i = 0; i < m_Pages.size(); i++)
+	{
+		if(m_Pages[i].ranges && !m_Pages[i].dedicated && m_Pages[i].ranges->alloc(cls, out.offset))
+		{
+			out.page = (int)i;
+			out.size = cls;
+			m_NumRanges++;
+			return true;
+		}
+	}
+	int p = newPage(m_PageSize, false);
+	if(!m_Pages[p].ranges->alloc(cls, out.offset))
+		return false;
+	out.page = p;
+	out.size = cls;
+	m_NumRanges++;
+	return true;
+}
+
+void geometryPool::free(poolRange& r)
+{
+	if(r.page < 0 || r.page >= (int)m_Pages.size() || !m_Pages[r.page].ranges)
+		return;
+	page& p = m_Pages[r.page];
+	p.ranges->free(r.offset, r.size);
+	m_NumRanges--;
+	//ordinary pages are kept for the next load, an oversized one is no use to anything else
+	if(p.dedicated)
+	{
+		glDeleteBuffers(1, &p.buffer);
+		delete p.ranges;
+		p.ranges = NULL;
+		p.buffer = 0;
+	}
+	r.page = -1;
+	r.offset = r.size = 0;
+}
+
+GLuint geometryPool::buffer(const poolRange& r) const
+{
+	if(r.page < 0 || r.page >= (int)m_Pages.size())
+		return 0;
+	return m_Pages[r.page].buffer;
+}
+
+void geometryPool::upload(const poolRange& r, const void* data, size_t len)
+{
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer(r));
+	glBufferSubData(GL_COPY_WRITE_BUFFER, r.offset, len, data);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+poolStats geometryPool::stats() const
+{
+	poolStats ps;
+	ps.numPages = 0;
+	ps.numRanges = m_NumRanges;
+	ps.capacity = ps.used = ps.freeBytes = ps.largestFree = 0;
+	ps.numFreeBlocks = 0;
+	for(size_t i = 0; i < m_Pages.size(); i++)
+	{
+		const rangeAllocator* ra = m_Pages[i].ranges;
+		if(!ra)
+			continue;
+		ps.numPages++;
+		ps.capacity += ra->size();
+		ps.used += ra->used();
+		ps.freeBytes += ra->size() - ra->used();
+		ps.numFreeBlocks += ra->numFreeBlocks();
+		if(ra->largestFree() > ps.largestFree)
+			ps.largestFree = ra->largestFree();
+	}
+	ps.fragmentation = ps.freeBytes > 0 ? 1.0f - (float)ps.largestFree / ps.freeBytes : 0.0f;
+	return ps;
+}
+
+//one pool for vertex data and one for indices, shared by every modelLoader
+geometryPool& vertexPool()
+{
+	static geometryPool pool(POOL_PAGE_BYTES);
+	return pool;
+}
+
+geometryPool& indexPool()
+{
+	static geometryPool pool(POOL_PAGE_BYTES);
+	return pool;
+}
@@ -0,0 +1,84 @@
+///		***
+///
+///		geometryPool.h - a few large GL buffers shared out between models
+///		Rather than every model making (and freeModel deleting) buffers of its own, setGeometryPool hands each
+///		model a range of a pool page. The ranges are managed on the CPU by rangeAllocator: sizes are rounded up
+///		to a size class, a free block is found best fit, and a freed range is merged with the free blocks either
+///		side of it. rangeAllocator makes no GL calls, so it can be exercised without a context. poolStress.cpp runs
+///		both, geometryPool against a recording stub of the few GL calls it makes.
+///
+///		***
+
+#ifndef GEOMETRYPOOL_H
+#define GEOMETRYPOOL_H
+
+#include "GL\glew.h"
+#include <map>
+#include <vector>
+
+using namespace std;
+
+#define POOL_PAGE_BYTES (32 * 1024 * 1024) //the size of each pool buffer, anything bigger gets a page to itself
+#define POOL_MIN_CLASS 256 //the smallest range handed out, and the alignment of every range
+
+//hands out ranges of one contiguous span of size bytes, best fit
+class rangeAllocator{
+public:
+	rangeAllocator(size_t size);
+	bool alloc(size_t bytes, size_t& offset);
+	void free(size_t offset, size_t bytes);
+	size_t size() const { return m_Size; }
+	size_t used() const { return m_Used; }
+	size_t numFreeBlocks() const { return m_ByOffset.size(); }
+	size_t largestFree() const;
+	bool check() const; //the free lists agree with each other and with used, for debugging
+	static size_t sizeClass(size_t bytes);
+
+private:
+	size_t m_Size, m_Used;
+	map<size_t, size_t> m_ByOffset; //free blocks, offset to size
+	multimap<size_t, size_t> m_BySize; //the same blocks, size to offset
+	void addFree(size_t offset, size_t bytes);
+	void removeFree(map<size_t, size_t>::iterator it);
+};
+
+//where a model's data lives in a pool, page is -1 if it isn't in one
+struct poolRange{
+	int page;
+	size_t offset, size;
+};
+
+//what getPoolStats hands back for one pool
+struct poolStats{
+	size_t numPages, numRanges;
+	unsigned long long capacity, used; //bytes of GL buffer made and bytes of it handed out
+	unsigned long long freeBytes, largestFree;
+	size_t numFreeBlocks;
+	float fragmentation; //0 when all the free space is one block, towards 1 the more it is split up
+};
+
+//the GL side, one buffer per page. GL thread only.
+class geometryPool{
+public:
+	geometryPool(size_t pageSize);
+	bool alloc(size_t bytes, poolRange& out);
+	void free(poolRange& r);
+	GLuint buffer(const poolRange& r) const;
+	void upload(const poolRange& r, const void* data, size_t len);
+	poolStats stats() const;
+
+private:
+	struct page{
+		GLuint buffer;
+		rangeAllocator* ranges;
+		bool dedicated; //made for one oversized range, deleted when that goes
+	};
+	vector<page> m_Pages; //a deleted page leaves its slot empty so the page numbers in ranges stay put
+	size_t m_PageSize, m_NumRanges;
+	int newPage(size_t size, bool dedicated);
+};
+
+geometryPool& vertexPool();
+geometryPool& indexPool();
+
+#endif
@@ -0,0 +1,519 @@
+///		***
+///
+///		hotReload.cpp - watching model and texture files and patching models that are already loaded
+///		A watcher thread waits on a change notification for every directory holding a watched file and compares
+///		file stamps to find out which file changed. A changed model is reimported on the worker threads and
+///		processUploads diffs it against what is already on the GPU, so only the buffers and textures whose
+///		contents actually changed get uploaded again. A changed texture is decoded on a worker and uploaded
+///		into the texture objects that already use it.
+///
+///		***
+
+#include "modelLoader.h"
+#include <algorithm>
+
+#define WATCH_POLL_MS 1000 //how often the watcher looks round even if nothing has signalled
+#define WATCH_SETTLE_MS 200 //editors write in several goes, a file has to stop changing for this long
+
+static double msSince(const LARGE_INTEGER& start)
+{
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (double)(now.QuadPart - start.QuadPart) * 1000.0 / (double)freq.QuadPart;
+}
+
+static string dirOf(const string& path)
+{
+	string::size_type slash = path.find_last_of("/\\");
+	if(slash == string::npos)
+		return ".";
+	if(slash == 0)
+		return path.substr(0, 1);
+	return path.substr(0, slash);
+}
+
+//reloads m whenever its source file or any of its textures change on disk. Reloads are parsed on the
+//worker threads and applied by processUploads, so that has to keep being called as it is for loadModelAsync.
+void modelLoader::watchModel(model* m)
+{
+	lock_guard<mutex> lock(m_WatchLock);
+	addWatch(m->sName, m, false);
+	for(size_t i = 0; i < m->vMat.size(); i++)
+	{
+		addWatch(m->vMat[i].texPath, m, true);
+		addWatch(m->vMat[i].normPath, m, true);
+	}
+	m_WatchedModels.insert(m);
+	if(!m_Watcher.joinable())
+	{
+		m_WatchQuit = CreateEventA(NULL, TRUE, FALSE, NULL);
+		m_Watcher = thread(&modelLoader::watchLoop, this);
+	}
+}
+
+//stops watching m, freeModel and releaseModel do this themselves
+void modelLoader::unwatchModel(model* m)
+{
+	lock_guard<mutex> lock(m_WatchLock);
+	removeWatches(m);
+	m_WatchedModels.erase(m);
+}
+
+//m_WatchLock must be held
+void modelLoader::addWatch(const string& path, model* m, bool texture)
+{
+	if(path.empty())
+		return;
+	map<string, watchedFile>::iterator it = m_Watched.find(path);
+	if(it == m_Watched.end())
+	{
+		watchedFile w;
+		w.size = w.time = 0;
+		getFileStamp(path.c_str(), w.size, w.time);
+		w.texture = texture;
+		w.pending = false;
+		it = m_Watched.insert(make_pair(path, w)).first;
+	}
+	vector<model*>& models = it->second.models;
+	if(find(models.begin(), models.end(), m) == models.end())
+		models.push_back(m);
+
+	string dir = dirOf(path);
+	if(m_WatchDirs.find(dir) == m_WatchDirs.end())
+	{
+		//if this fails the directory is still looked at every WATCH_POLL_MS
+		m_WatchDirs[dir] = FindFirstChangeNotificationA(dir.c_str(), FALSE,
+			FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_FILE_NAME);
+	}
+}
+
+//m_WatchLock must be held
+void modelLoader::removeWatches(model* m)
+{
+	map<string, watchedFile>::iterator it = m_Watched.begin();
+	while(it != m_Watched.end())
+	{
+		vector<model*>& models = it->second.models;
+		models.erase(remove(models.begin(), models.end(), m), models.end());
+		if(models.empty())
+			m_Watched.erase(it++);
+		else
+			it++;
+	}
+}
+
+void modelLoader::stopWatching()
+{
+	if(!m_Watcher.joinable())
+		return;
+	SetEvent(m_WatchQuit);
+	m_Watcher.join();
+	CloseHandle(m_WatchQuit);
+	m_WatchQuit = NULL;
+	for(map<string, HANDLE>::iterator it = m_WatchDirs.begin(); it != m_WatchDirs.end(); it++)
+	{
+		if(it->second != INVALID_HANDLE_VALUE)
+			FindCloseChangeNotification(it->second);
+	}
+	m_WatchDirs.clear();
+}
+
+void modelLoader::watchLoop()
+{
+	for(;;)
+	{
+		vector<HANDLE> handles;
+		bool pending = false;
+		{
+			lock_guard<mutex> lock(m_WatchLock);
+			handles.push_back(m_WatchQuit);
+			for(map<string, HANDLE>::iterator it = m_WatchDirs.begin(); it != m_WatchDirs.end(); it++)
+			{
+				if(it->second != INVALID_HANDLE_VALUE && handles.size() < MAXIMUM_WAIT_OBJECTS)
+					handles.push_back(it->second);
+			}
+			for(map<string, watchedFile>::iterator it = m_Watched.begin(); it != m_Watched.end(); it++)
+			{
+				pending |= it->second.pending;
+			}
+		}
+		DWORD r = WaitForMultipleObjects((DWORD)handles.size(), &handles[0], FALSE, pending ? WATCH_SETTLE_MS : WATCH_POLL_MS);
+		if(r == WAIT_OBJECT_0)
+			return;
+		//rearm the notification that fired, the stamps below say which file it was
+		if(r > WAIT_OBJECT_0 && r < WAIT_OBJECT_0 + handles.size())
+			FindNextChangeNotification(handles[r - WAIT_OBJECT_0]);
+
+		lock_guard<mutex> lock(m_WatchLock);
+		for(map<string, watchedFile>::iterator it = m_Watched.begin(); it != m_Watched.end(); it++)
+		{
+			watchedFile& w = it->second;
+			unsigned long long size, time;
+			if(!getFileStamp(it->first.c_str(), size, time))
+				continue; //mid save, or gone, either way there is nothing to load yet
+			if(size != w.size || time != w.time)
+			{
+				w.size = size;
+				w.time = time;
+				w.pending = true;
+				QueryPerformanceCounter(&w.changedAt);
+				continue;
+			}
+			if(!w.pending || msSince(w.changedAt) < WATCH_SETTLE_MS)
+				continue;
+			w.pending = false;
+			printf("%s has changed, reloading\n", it->first.c_str());
+			if(w.texture)
+				queueTextureReload(it->first);
+			else
+			{
+				for(size_t i = 0; i < w.models.size(); i++)
+				{
+					queueReload(w.models[i]);
+				}
+			}
+		}
+	}
+}
+
+//m_WatchLock must be held, it guards m's materials against a reload being applied at the same time
+void modelLoader::queueReload(model* m)
+{
+	modelHandle h = newRequest(m->sName.c_str(), m->profile);
+	h->target = m;
+	//textures that are already on the GPU have their own watches, don't decode them all again
+	for(size_t i = 0; i < m->vMat.size(); i++)
+	{
+		h->parser->m_KeepTextures.insert(m->vMat[i].texPath);
+		h->parser->m_KeepTextures.insert(m->vMat[i].normPath);
+	}
+	pushJob(h);
+}
+
+void modelLoader::queueTextureReload(const string& path)
+{
+	modelHandle h = newRequest(path.c_str(), profileRuntime);
+	h->texture = path;
+	pushJob(h);
+}
+
+//hands back the GL texture of an old material that was loaded from path, so it can be kept rather than
+//uploaded again. Each texture can only be taken once, whatever isn't taken gets deleted.
+static GLuint takeTexture(vector<mat>& old, const string& path, bool norm)
+{
+	if(path.empty())
+		return 0;
+	for(size_t i = 0; i < old.size(); i++)
+	{
+		GLuint& tex = norm ? old[i].matNorm : old[i].matTex;
+		if(tex != 0 && (norm ? old[i].normPath : old[i].texPath) == path)
+		{
+			GLuint t = tex;
+			tex = 0;
+			return t;
+		}
+	}
+	return 0;
+}
+
+static bool sameBytes(const void* a, const void* b, size_t len)
+{
+	return len == 0 || (a && b && memcmp(a, b, len) == 0);
+}
+
+//replaces the contents of a buffer that is already the right size
+static void updateBuffer(GLenum target, GLuint buffer, const void* data, size_t len)
+{
+	glBindBuffer(target, buffer);
+	glBufferSubData(target, 0, len, data);
+	glBindBuffer(target, 0);
+}
+
+//GL thread only, finishes off a reload the worker has parsed or decoded
+void modelLoader::applyReload(const modelHandle& h)
+{
+	if(!h->texture.empty())
+	{
+		//upload straight into every texture object made from this file, so nothing that uses it has to change
+		lock_guard<mutex> lock(m_WatchLock);
+		map<string, watchedFile>::iterator it = m_Watched.find(h->texture);
+		if(it != m_Watched.end())
+		{
+			for(size_t i = 0; i < it->second.models.size(); i++)
+			{
+				model* m = it->second.models[i];
+				for(size_t j = 0; j < m->vMat.size(); j++)
+				{
+					mat& theMat = m->vMat[j];
+					if(theMat.texPath == h->texture)
+						theMat.matTex = SOIL_create_OGL_texture(h->texImg.pixels, h->texImg.width, h->texImg.height,
+							h->texImg.channels, theMat.matTex ? theMat.matTex : SOIL_CREATE_NEW_ID, SOIL_FLAG_INVERT_Y);
+					if(theMat.normPath == h->texture)
+						theMat.matNorm = SOIL_create_OGL_texture(h->texImg.pixels, h->texImg.width, h->texImg.height,
+							h->texImg.channels, theMat.matNorm ? theMat.matNorm : SOIL_CREATE_NEW_ID, SOIL_FLAG_INVERT_Y);
+				}
+			}
+		}
+		SOIL_free_image_data(h->texImg.pixels);
+		h->texImg.pixels = NULL;
+		printf("Reloaded texture %s\n", h->texture.c_str());
+	}
+	else
+	{
+		bool live;
+		{
+			lock_guard<mutex> lock(m_WatchLock);
+			live = m_WatchedModels.count(h->target) > 0;
+		}
+		//the model was freed while its reload was on the worker
+		if(!live || h->cancelled)
+			discardModel(h->result);
+		else
+		{
+			mergeModel(h->target, h->result);
+			//a reload is a load like any other, its skeleton becomes the animated one
+			adoptBones(*h->parser);
+		}
+		h->result = NULL;
+	}
+	delete h->parser;
+	h->parser = NULL;
+	h->progress = 1.0f;
+	h->state = loadReady;
+}
+
+//moves the freshly parsed data into m, keeping every buffer and texture whose contents are unchanged.
+//fresh is freed along with whatever m no longer needs.
+void modelLoader::mergeModel(model* m, model* fresh)
+{
+	glBindVertexArray(0);
+	size_t changed = 0;
+	unsigned long long bytes = 0;
+	if(m->vao != 0)
+	{
+		//a single buffer model holds every mesh in the same buffers, so they all go again together
+		bool same = fresh->vMesh.size() == m->vMesh.size() && fresh->vBones.size() == m->vBones.size() &&
+			sameBytes(m->vBones.empty() ? NULL : &m->vBones[0], fresh->vBones.empty() ? NULL : &fresh->vBones[0],
+				sizeof(vBoneData) * m->vBones.size());
+		for(size_t i = 0; i < m->vMesh.size() && same; i++)
+		{
+			const sMesh& o = m->vMesh[i];
+			const sMesh& n = fresh->vMesh[i];
+			same = o.numVert == n.numVert && o.numInd == n.numInd && o.hasNorm == n.hasNorm &&
+				o.hasTexCoords == n.hasTexCoords && o.hasTangents == n.hasTangents &&
+				sameBytes(o.indexes, n.indexes, sizeof(GLuint) * n.numInd) &&
+				sameBytes(o.verts, n.verts, sizeof(GLfloat) * 3 * n.numVert) &&
+				(!n.hasNorm || sameBytes(o.normals, n.normals, sizeof(GLfloat) * 3 * n.numVert)) &&
+				(!n.hasTexCoords || sameBytes(o.texCoords, n.texCoords, sizeof(GLfloat) * 2 * n.numVert)) &&
+				(!n.hasTangents || sameBytes(o.tangents, n.tangents, sizeof(GLshort) * 4 * n.numVert)) &&
+				o.numLodInd == n.numLodInd && sameBytes(o.lodIndexes, n.lodIndexes, sizeof(GLuint) * n.numLodInd);
+		}
+		if(!same)
+		{
+			releaseModelGL(m);
+			m->vMesh.swap(fresh->vMesh);
+			m->vBones.swap(fresh->vBones);
+			swap(m->cache, fresh->cache);
+			swap(m->arena, fresh->arena);
+			m->numMesh = fresh->numMesh;
+			bytes += makeModelVAO(m);
+			changed = m->vMesh.size();
+		}
+	}
+	else if(fresh->vMesh.size() != m->vMesh.size())
+	{
+		//the meshes don't line up any more, start the geometry from scratch
+		for(size_t i = 0; i < m->vMesh.size(); i++)
+		{
+			releaseMeshGL(m->vMesh[i]);
+		}
+		m->vMesh.swap(fresh->vMesh);
+		m->vBones.swap(fresh->vBones);
+		swap(m->cache, fresh->cache);
+		swap(m->arena, fresh->arena);
+		m->numMesh = fresh->numMesh;
+		makeVAO(m);
+		changed = m->vMesh.size();
+	}
+	else
+	{
+		//work out what changed while both copies are still about
+		enum{ reIbo = 1, reVbo = 2, reNbo = 4, reTbo = 8, reBbo = 16, rebuild = 32 };
+		vector<int> redo(m->vMesh.size(), 0);
+		for(size_t i = 0; i < m->vMesh.size(); i++)
+		{
+			const sMesh& o = m->vMesh[i];
+			const sMesh& n = fresh->vMesh[i];
+			if(o.numVert != n.numVert || o.numInd != n.numInd || o.hasNorm != n.hasNorm ||
+				o.hasTexCoords != n.hasTexCoords || o.hasBones != n.hasBones || o.hasTangents != n.hasTangents ||
+				o.numLodInd != n.numLodInd || (o.shadowVerts != 0) != (n.shadowVerts != 0))
+			{
+				redo[i] = rebuild;
+				continue;
+			}
+			if(!sameBytes(o.indexes, n.indexes, sizeof(GLuint) * n.numInd)) redo[i] |= reIbo;
+			//the LOD levels follow the full indices in the same buffer
+			if(!sameBytes(o.lodIndexes, n.lodIndexes, sizeof(GLuint) * n.numLodInd)) redo[i] |= reIbo;
+			if(!sameBytes(o.verts, n.verts, sizeof(GLfloat) * 3 * n.numVert)) redo[i] |= reVbo;
+			if(n.hasNorm && !sameBytes(o.normals, n.normals, sizeof(GLfloat) * 3 * n.numVert)) redo[i] |= reNbo;
+			//the tangents live in the normal buffer
+			if(n.hasTangents && !sameBytes(o.tangents, n.tangents, sizeof(GLshort) * 4 * n.numVert)) redo[i] |= reNbo;
+			if(n.hasTexCoords && !sameBytes(o.texCoords, n.texCoords, sizeof(GLfloat) * 2 * n.numVert)) redo[i] |= reTbo;
+			if(n.hasBones && (o.baseVert != n.baseVert || m->vBones.size() < o.baseVert + n.numVert ||
+				!sameBytes(&m->vBones[o.baseVert], &fresh->vBones[n.baseVert], sizeof(vBoneData) * n.numVert)))
+				redo[i] |= reBbo;
+			//an interleaved buffer holds every attribute, so any of them changing means packing it again
+			if((o.stride != 0 || n.packed) && (redo[i] & (reVbo | reNbo | reTbo | reBbo)))
+				redo[i] = rebuild;
+			//the shadow indices follow those and come from the positions and bones
+			if(n.shadowVerts != 0 && (redo[i] & (reVbo | reBbo))) redo[i] |= reIbo;
+			//a shared mesh can't be patched in place without changing every other model using it
+			if(o.shared && redo[i] != 0)
+				redo[i] = rebuild;
+		}
+
+		//the new CPU data goes into m, the GL objects stay where they are
+		for(size_t i = 0; i < m->vMesh.size(); i++)
+		{
+			sMesh& o = m->vMesh[i];
+			sMesh& n = fresh->vMesh[i];
+			//an unchanged shared mesh stays as it is, the new copy goes with fresh
+			if(o.shared && redo[i] == 0)
+				continue;
+			swap(o, n);
+			if(n.shared)
+			{
+				//let go of the shared copy, the mesh gets rebuilt below
+				releaseSharedMesh(n);
+				continue;
+			}
+			o.vao = n.vao; o.ibo = n.ibo; o.vbo = n.vbo; o.nbo = n.nbo; o.tbo = n.tbo; o.bbo = n.bbo;
+			o.depthVao = n.depthVao;
+			n.vao = n.ibo = n.vbo = n.nbo = n.tbo = n.bbo = n.depthVao = 0;
+		}
+		m->vBones.swap(fresh->vBones);
+		swap(m->cache, fresh->cache);
+		swap(m->arena, fresh->arena);
+
+		for(size_t i = 0; i < m->vMesh.size(); i++)
+		{
+			sMesh& theMesh = m->vMesh[i];
+			if(redo[i] == 0)
+				continue;
+			changed++;
+			if(redo[i] & rebuild)
+			{
+				releaseMeshGL(theMesh);
+				uploadMesh(m, i);
+				bytes += sizeof(GLuint) * (theMesh.numInd + theMesh.numLodInd) + sizeof(GLfloat) * 3 * theMesh.numVert;
+				if(theMesh.hasNorm) bytes += sizeof(GLfloat) * 3 * theMesh.numVert;
+				if(theMesh.hasTangents) bytes += sizeof(GLshort) * 4 * theMesh.numVert;
+				if(theMesh.hasTexCoords) bytes += sizeof(GLfloat) * 2 * theMesh.numVert;
+				if(theMesh.hasBones) bytes += sizeof(vBoneData) * theMesh.numVert;
+				continue;
+			}
+			if(redo[i] & reIbo)
+			{
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, theMesh.ibo);
+				bytes += uploadIndices(theMesh, true);
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			}
+			if(redo[i] & reVbo)
+			{
+				updateBuffer(GL_ARRAY_BUFFER, theMesh.vbo, theMesh.verts, sizeof(GLfloat) * 3 * theMesh.numVert);
+				bytes += sizeof(GLfloat) * 3 * theMesh.numVert;
+			}
+			if(redo[i] & reNbo)
+			{
+				glBindBuffer(GL_ARRAY_BUFFER, theMesh.nbo);
+				bytes += uploadNormals(theMesh, true);
+				glBindBuffer(GL_ARRAY_BUFFER, 0);
+			}
+			if(redo[i] & reTbo)
+			{
+				updateBuffer(GL_ARRAY_BUFFER, theMesh.tbo, theMesh.texCoords, sizeof(GLfloat) * 2 * theMesh.numVert);
+				bytes += sizeof(GLfloat) * 2 * theMesh.numVert;
+			}
+			if(redo[i] & reBbo)
+			{
+				updateBuffer(GL_ARRAY_BUFFER, theMesh.bbo, &m->vBones[theMesh.baseVert], sizeof(vBoneData) * theMesh.numVert);
+				bytes += sizeof(vBoneData) * theMesh.numVert;
+			}
+		}
+	}
+
+	//packed vertices and shadow indices only matter to meshes that were uploaded again, and those have been freed by now
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		free(m->vMesh[i].packed);
+		m->vMesh[i].packed = NULL;
+		free(m->vMesh[i].shadowIndexes);
+		m->vMesh[i].shadowIndexes = NULL;
+	}
+
+	//materials: keep the texture of any file that was already loaded, upload the rest
+	size_t newTextures = 0;
+	{
+		lock_guard<mutex> lock(m_WatchLock);
+		vector<mat>& old = m->vMat;
+		vector<mat>& mats = fresh->vMat;
+		for(size_t i = 0; i < mats.size(); i++)
+		{
+			mat& theMat = mats[i];
+			theMat.matTex = takeTexture(old, theMat.texPath, false);
+			theMat.matNorm = takeTexture(old, theMat.normPath, true);
+			//the reload skipped decoding anything that was already loaded, which is fine unless that file had
+			//failed to load before. Anything kept doesn't need what was decoded.
+			if(theMat.matTex != 0)
+			{
+				SOIL_free_image_data(theMat.texImg.pixels);
+				theMat.texImg.pixels = NULL;
+			}
+			else if(!theMat.texPath.empty())
+			{
+				if(!theMat.texImg.pixels)
+					decodeTexture(theMat.texPath, theMat.texImg, "diffuse");
+				newTextures++;
+			}
+			if(theMat.matNorm != 0)
+			{
+				SOIL_free_image_data(theMat.normImg.pixels);
+				theMat.normImg.pixels = NULL;
+			}
+			else if(!theMat.normPath.empty())
+			{
+				if(!theMat.normImg.pixels)
+					decodeTexture(theMat.normPath, theMat.normImg, "normal");
+				newTextures++;
+			}
+			createMatTextures(theMat);
+		}
+		//whatever is left over belongs to materials that have gone
+		for(size_t i = 0; i < old.size(); i++)
+		{
+			GLuint textures[2] = {old[i].matTex, old[i].matNorm};
+			glDeleteTextures(2, textures);
+			old[i].matTex = old[i].matNorm = 0;
+		}
+		m->vMat.swap(fresh->vMat);
+		m->numMat = fresh->numMat;
+		//the texture list may have changed
+		removeWatches(m);
+		addWatch(m->sName, m, false);
+		for(size_t i = 0; i < m->vMat.size(); i++)
+		{
+			addWatch(m->vMat[i].texPath, m, true);
+			addWatch(m->vMat[i].normPath, m, true);
+		}
+	}
+	//the new data brings new bounds, and the model's retain policy applies to it as it did the first time
+	m->min_x = fresh->min_x; m->min_y = fresh->min_y; m->min_z = fresh->min_z;
+	m->max_x = fresh->max_x; m->max_y = fresh->max_y; m->max_z = fresh->max_z;
+	m->centre = fresh->centre;
+	m->radius = fresh->radius;
+	releaseCPU(m);
+	printf("Reloaded %s, %u of %u meshes changed (%lluKB uploaded), %u new textures\n", m->sName.c_str(),
+		(unsigned int)changed, (unsigned int)m->vMesh.size(), bytes / 1024, (unsigned int)newTextures);
+	discardModel(fresh);
+}
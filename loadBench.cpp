@@ -0,0 +1,96 @@
+///		***
+///
+///		loadBench.cpp - command line benchmark for loading a list of models cold and warm from the model cache,
+///		and through mapped files against ASSIMP's own stdio
+///		usage: loadBench cacheDir model1 [model2 ...]
+///		Deletes every cache entry in cacheDir, loads the models through loadModels (which writes the cache as it
+///		goes), frees them and loads them again now that the cache is warm. Then, with the cache off, loads them
+///		with setMappedIO(false) and again with it on. Prints every time at the end. Runs in a hidden GLFW window
+///		since the loads upload to GL. The first pass also pays for the OS reading the model files off disk, run
+///		it twice to see the cache's own share. The two IO passes both find the files already in memory.
+///
+///		***
+
+#include "modelLoader.h"
+
+//removes every cache entry in dir, the files modelCache.cpp writes all end in .mlc
+static void clearCache(const string& dir)
+{
+	WIN32_FIND_DATAA fd;
+	HANDLE find = FindFirstFileA((dir + "/*.mlc").c_str(), &fd);
+	if(find == INVALID_HANDLE_VALUE)
+		return;
+	size_t removed = 0;
+	do{
+		if(DeleteFileA((dir + "/" + fd.cFileName).c_str()))
+			removed++;
+	}while(FindNextFileA(find, &fd));
+	FindClose(find);
+	printf("Removed %u cache entries from %s\n", (unsigned int)removed, dir.c_str());
+}
+
+//loads files once, frees them again and returns how long the load took
+static double timeLoads(modelLoader& loader, const vector<string>& files, const char* label)
+{
+	printf("--- %s ---\n", label);
+	batchStats bs;
+	vector<model*> models = loader.loadModels(files, &bs);
+	//the same file twice in the list comes back as the same model, only free it once
+	set<model*> unique(models.begin(), models.end());
+	for(set<model*>::iterator it = unique.begin(); it != unique.end(); it++)
+	{
+		if(*it)
+			loader.freeModel(*it);
+	}
+	return bs.seconds;
+}
+
+//the loader's uploads need a current context, a window that is never shown is enough
+static GLFWwindow* makeContext()
+{
+	if(!glfwInit())
+		return NULL;
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	GLFWwindow* window = glfwCreateWindow(64, 64, "loadBench", NULL, NULL);
+	if(!window)
+		return NULL;
+	glfwMakeContextCurrent(window);
+	glewExperimental = GL_TRUE;
+	if(glewInit() != GLEW_OK)
+		return NULL;
+	return window;
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 3)
+	{
+		printf("usage: loadBench cacheDir model1 [model2 ...]\n");
+		return 1;
+	}
+	string cacheDir = argv[1];
+	vector<string> files(argv + 2, argv + argc);
+	GLFWwindow* window = makeContext();
+	if(!window)
+	{
+		printf("ERROR, could not make a GL context\n");
+		return 1;
+	}
+	modelLoader loader;
+	loader.setCacheDir(cacheDir.c_str());
+	clearCache(cacheDir);
+	double cold = timeLoads(loader, files, "cold, no cache entries");
+	double warm = timeLoads(loader, files, "warm, every model cached");
+	loader.setCacheDir(NULL);
+	loader.setMappedIO(false);
+	double stdio = timeLoads(loader, files, "no cache, stdio");
+	loader.setMappedIO(true);
+	double mapped = timeLoads(loader, files, "no cache, mapped");
+	printf("\n%u models: cold %.3fs, warm %.3fs (%.1fx)\n", (unsigned int)files.size(), cold, warm,
+		warm > 0.0 ? cold / warm : 0.0);
+	printf("%u models without the cache: stdio %.3fs, mapped %.3fs (%.1fx)\n", (unsigned int)files.size(), stdio,
+		mapped, mapped > 0.0 ? stdio / mapped : 0.0);
+	glfwDestroyWindow(window);
+	glfwTerminate();
+	return 0;
+}
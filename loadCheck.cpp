@@ -0,0 +1,146 @@
+///		***
+///
+///		loadCheck.cpp - command line checks that run a small known model through the whole loader
+///		usage: loadCheck
+///		Writes out a COLLADA file holding a static quad, a skinned triangle and another static quad, loads it with
+///		the runtime profile in a hidden GLFW window and checks what each mesh came out with. Static meshes have to
+///		get meshlets whatever came before them, skinned ones never. Prints every check and returns 1 if any fails.
+///
+///		***
+
+#include "modelLoader.h"
+
+#define CHECK_FILE "loadCheck.dae"
+
+static int s_Failed = 0;
+
+static void check(bool ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	if(!ok)
+		s_Failed++;
+}
+
+//a quad's geometry, offset along x so no two meshes are the same and dedup can't fold them together
+static void writeQuad(FILE* f, const char* id, float x)
+{
+	fprintf(f, "<geometry id=\"%s\" name=\"%s\"><mesh>\n", id, id);
+	fprintf(f, "<source id=\"%s-pos\"><float_array id=\"%s-pos-array\" count=\"12\">%g 0 0 %g 0 0 %g 1 0 %g 1 0</float_array>\n",
+		id, id, x, x + 1.0f, x + 1.0f, x);
+	fprintf(f, "<technique_common><accessor source=\"#%s-pos-array\" count=\"4\" stride=\"3\">", id);
+	fprintf(f, "<param name=\"X\" type=\"float\"/><param name=\"Y\" type=\"float\"/><param name=\"Z\" type=\"float\"/>");
+	fprintf(f, "</accessor></technique_common></source>\n");
+	fprintf(f, "<vertices id=\"%s-vtx\"><input semantic=\"POSITION\" source=\"#%s-pos\"/></vertices>\n", id, id);
+	fprintf(f, "<triangles count=\"2\"><input semantic=\"VERTEX\" source=\"#%s-vtx\" offset=\"0\"/><p>0 1 2 0 2 3</p></triangles>\n", id);
+	fprintf(f, "</mesh></geometry>\n");
+}
+
+//static, skinned, static. The second static mesh is the one that used to pick up hasBones from the skinned one
+static bool writeModel(const char* path)
+{
+	FILE* f = fopen(path, "w");
+	if(!f)
+		return false;
+	fprintf(f, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+	fprintf(f, "<COLLADA xmlns=\"http://www.collada.org/2005/11/COLLADASchema\" version=\"1.4.1\">\n");
+	fprintf(f, "<asset><unit name=\"meter\" meter=\"1\"/><up_axis>Y_UP</up_axis></asset>\n");
+	fprintf(f, "<library_geometries>\n");
+	writeQuad(f, "staticA", 0.0f);
+	fprintf(f, "<geometry id=\"skinned\" name=\"skinned\"><mesh>\n");
+	fprintf(f, "<source id=\"skinned-pos\"><float_array id=\"skinned-pos-array\" count=\"9\">5 0 0 6 0 0 5 1 0</float_array>\n");
+	fprintf(f, "<technique_common><accessor source=\"#skinned-pos-array\" count=\"3\" stride=\"3\">");
+	fprintf(f, "<param name=\"X\" type=\"float\"/><param name=\"Y\" type=\"float\"/><param name=\"Z\" type=\"float\"/>");
+	fprintf(f, "</accessor></technique_common></source>\n");
+	fprintf(f, "<vertices id=\"skinned-vtx\"><input semantic=\"POSITION\" source=\"#skinned-pos\"/></vertices>\n");
+	fprintf(f, "<triangles count=\"1\"><input semantic=\"VERTEX\" source=\"#skinned-vtx\" offset=\"0\"/><p>0 1 2</p></triangles>\n");
+	fprintf(f, "</mesh></geometry>\n");
+	writeQuad(f, "staticB", 10.0f);
+	fprintf(f, "</library_geometries>\n");
+	//every vertex of the triangle hangs off the one bone
+	fprintf(f, "<library_controllers><controller id=\"skin\"><skin source=\"#skinned\">\n");
+	fprintf(f, "<bind_shape_matrix>1 0 0 0 0 1 0 0 0 0 1 0 0 0 0 1</bind_shape_matrix>\n");
+	fprintf(f, "<source id=\"skin-joints\"><Name_array id=\"skin-joints-array\" count=\"1\">bone</Name_array>");
+	fprintf(f, "<technique_common><accessor source=\"#skin-joints-array\" count=\"1\" stride=\"1\"><param name=\"JOINT\" type=\"name\"/>");
+	fprintf(f, "</accessor></technique_common></source>\n");
+	fprintf(f, "<source id=\"skin-binds\"><float_array id=\"skin-binds-array\" count=\"16\">1 0 0 0 0 1 0 0 0 0 1 0 0 0 0 1</float_array>");
+	fprintf(f, "<technique_common><accessor source=\"#skin-binds-array\" count=\"1\" stride=\"16\"><param name=\"TRANSFORM\" type=\"float4x4\"/>");
+	fprintf(f, "</accessor></technique_common></source>\n");
+	fprintf(f, "<source id=\"skin-weights\"><float_array id=\"skin-weights-array\" count=\"1\">1</float_array>");
+	fprintf(f, "<technique_common><accessor source=\"#skin-weights-array\" count=\"1\" stride=\"1\"><param name=\"WEIGHT\" type=\"float\"/>");
+	fprintf(f, "</accessor></technique_common></source>\n");
+	fprintf(f, "<joints><input semantic=\"JOINT\" source=\"#skin-joints\"/><input semantic=\"INV_BIND_MATRIX\" source=\"#skin-binds\"/></joints>\n");
+	fprintf(f, "<vertex_weights count=\"3\"><input semantic=\"JOINT\" source=\"#skin-joints\" offset=\"0\"/>");
+	fprintf(f, "<input semantic=\"WEIGHT\" source=\"#skin-weights\" offset=\"1\"/><vcount>1 1 1</vcount><v>0 0 0 0 0 0</v></vertex_weights>\n");
+	fprintf(f, "</skin></controller></library_controllers>\n");
+	fprintf(f, "<library_visual_scenes><visual_scene id=\"scene\">\n");
+	fprintf(f, "<node id=\"staticA-node\" name=\"staticA\"><instance_geometry url=\"#staticA\"/></node>\n");
+	fprintf(f, "<node id=\"bone\" name=\"bone\" sid=\"bone\" type=\"JOINT\"/>\n");
+	fprintf(f, "<node id=\"skinned-node\" name=\"skinned\"><instance_controller url=\"#skin\"><skeleton>#bone</skeleton></instance_controller></node>\n");
+	fprintf(f, "<node id=\"staticB-node\" name=\"staticB\"><instance_geometry url=\"#staticB\"/></node>\n");
+	fprintf(f, "</visual_scene></library_visual_scenes>\n");
+	fprintf(f, "<scene><instance_visual_scene url=\"#scene\"/></scene>\n");
+	fprintf(f, "</COLLADA>\n");
+	return fclose(f) == 0;
+}
+
+//the loader's uploads need a current context, a window that is never shown is enough
+static GLFWwindow* makeContext()
+{
+	if(!glfwInit())
+		return NULL;
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	GLFWwindow* window = glfwCreateWindow(64, 64, "loadCheck", NULL, NULL);
+	if(!window)
+		return NULL;
+	glfwMakeContextCurrent(window);
+	glewExperimental = GL_TRUE;
+	if(glewInit() != GLEW_OK)
+		return NULL;
+	return window;
+}
+
+int main()
+{
+	if(!writeModel(CHECK_FILE))
+	{
+		printf("ERROR, could not write %s\n", CHECK_FILE);
+		return 1;
+	}
+	GLFWwindow* window = makeContext();
+	if(!window)
+	{
+		printf("ERROR, could not make a GL context\n");
+		remove(CHECK_FILE);
+		return 1;
+	}
+	modelLoader loader;
+	loader.setRetainPolicy(retainAll);
+	model* m = loader.loadModel((char*)CHECK_FILE, profileRuntime);
+	check(m->vMesh.size() == 3, "three meshes came out of the file");
+	//the triangle is the skinned one, the quads are static
+	bool seenSkinned = false, staticAfter = false;
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		const sMesh& theMesh = m->vMesh[i];
+		char what[128];
+		if(theMesh.numVert == 3)
+		{
+			seenSkinned = true;
+			sprintf(what, "mesh %u is skinned and has no meshlets", (unsigned int)i);
+			check(theMesh.hasBones && theMesh.numMeshlets == 0 && !theMesh.meshlets, what);
+		}
+		else
+		{
+			staticAfter |= seenSkinned;
+			sprintf(what, "mesh %u is static and has meshlets%s", (unsigned int)i, seenSkinned ? ", after a skinned mesh" : "");
+			check(!theMesh.hasBones && theMesh.numMeshlets > 0 && theMesh.meshlets, what);
+		}
+	}
+	check(seenSkinned && staticAfter, "the file had a static mesh after a skinned one");
+	loader.freeModel(m);
+	glfwDestroyWindow(window);
+	glfwTerminate();
+	remove(CHECK_FILE);
+	printf("%s, %i failed\n", s_Failed ? "FAILED" : "all passed", s_Failed);
+	return s_Failed ? 1 : 0;
+}
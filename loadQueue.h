@@ -0,0 +1,94 @@
+///		***
+///
+///		loadQueue.h - lock free queue used to hand finished loads from the worker threads to the GL thread
+///		Any number of threads can push, only the thread that owns the GL context pops.
+///
+///		***
+
+#ifndef LOADQUEUE_H
+#define LOADQUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+
+using namespace std;
+
+//an unbounded multi producer, single consumer queue (Vyukov's intrusive MPSC queue)
+template<class T>
+class mpscQueue{
+public:
+	mpscQueue() : m_Head(&m_Stub), m_Tail(&m_Stub) {}
+	~mpscQueue()
+	{
+		T value;
+		while(pop(value)) {}
+	}
+
+	//safe to call from any thread at any time, never blocks
+	void push(const T& value)
+	{
+		node* n = new node(value);
+		pushNode(n);
+	}
+
+	//only the consumer thread may call this, returns false if there is nothing ready to take
+	bool pop(T& out)
+	{
+		node* tail = m_Tail;
+		node* next = tail->next.load(memory_order_acquire);
+		//the stub never carries a value, step over it
+		if(tail == &m_Stub)
+		{
+			if(next == NULL)
+				return false;
+			m_Tail = next;
+			tail = next;
+			next = next->next.load(memory_order_acquire);
+		}
+		if(next != NULL)
+		{
+			m_Tail = next;
+			out = tail->value;
+			delete tail;
+			return true;
+		}
+		//a producer has swapped the head but not linked its node yet, it will be there next time
+		if(tail != m_Head.load(memory_order_acquire))
+			return false;
+		//tail is the last node, put the stub back behind it so tail can be taken
+		m_Stub.next.store(NULL, memory_order_relaxed);
+		pushNode(&m_Stub);
+		next = tail->next.load(memory_order_acquire);
+		if(next != NULL)
+		{
+			m_Tail = next;
+			out = tail->value;
+			delete tail;
+			return true;
+		}
+		return false;
+	}
+
+private:
+	struct node{
+		T value;
+		atomic<node*> next;
+		node() : next(NULL) {}
+		node(const T& v) : value(v), next(NULL) {}
+	};
+
+	void pushNode(node* n)
+	{
+		node* prev = m_Head.exchange(n, memory_order_acq_rel);
+		prev->next.store(n, memory_order_release);
+	}
+
+	mpscQueue(const mpscQueue&);
+	mpscQueue& operator=(const mpscQueue&);
+
+	node m_Stub;
+	atomic<node*> m_Head; //producers push here
+	node* m_Tail; //only touched by the consumer
+};
+
+#endif
@@ -0,0 +1,169 @@
+///		***
+///
+///		mappedIO.cpp - memory mapped file helpers and the mapped ASSIMP IOSystem/IOStream
+///		Model files are almost always read front to back, but page faults on a view get none of the read ahead
+///		FILE_FLAG_SEQUENTIAL_SCAN gives ReadFile. So each view is handed to PrefetchVirtualMemory as soon as it
+///		is mapped, which queues large reads of the whole file rather than faulting it in a page at a time.
+///
+///		***
+
+#include "mappedIO.h"
+#include <string.h>
+
+//WIN32_MEMORY_RANGE_ENTRY, which the headers only declare when building for Windows 8 and up
+struct prefetchRange{
+	PVOID address;
+	SIZE_T bytes;
+};
+typedef BOOL (WINAPI *prefetchFunc)(HANDLE process, ULONG_PTR numRanges, prefetchRange* ranges, DWORD flags);
+
+//asks the memory manager to start reading the whole view in, looked up at run time so Windows 7 still runs
+//(without the hint)
+static void prefetchView(const fileMapping& fm)
+{
+	static prefetchFunc prefetch = (prefetchFunc)GetProcAddress(GetModuleHandleA("kernel32.dll"), "PrefetchVirtualMemory");
+	if(!prefetch)
+		return;
+	prefetchRange range;
+	range.address = (PVOID)fm.view;
+	range.bytes = fm.size;
+	prefetch(GetCurrentProcess(), 1, &range, 0);
+}
+
+bool mapFile(const char* path, fileMapping& fm, bool copyOnWrite)
+{
+	fm.file = fm.map = NULL; fm.view = NULL; fm.size = 0;
+	fm.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(fm.file == INVALID_HANDLE_VALUE)
+	{
+		fm.file = NULL;
+		return false;
+	}
+	LARGE_INTEGER sz;
+	//an empty file can't be mapped, callers treat that the same as a missing one
+	if(!GetFileSizeEx(fm.file, &sz) || sz.QuadPart == 0)
+	{
+		unmapFile(fm);
+		return false;
+	}
+	fm.size = (size_t)sz.QuadPart;
+	//copy on write lets the mesh arrays be handed out as non const without ever touching the file
+	fm.map = CreateFileMappingA(fm.file, NULL, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+	if(fm.map != NULL)
+		fm.view = (const char*)MapViewOfFile(fm.map, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+	if(fm.view == NULL)
+	{
+		unmapFile(fm);
+		return false;
+	}
+	prefetchView(fm);
+	return true;
+}
+
+void unmapFile(fileMapping& fm)
+{
+	if(fm.view) UnmapViewOfFile(fm.view);
+	if(fm.map) CloseHandle(fm.map);
+	if(fm.file) CloseHandle(fm.file);
+	fm.file = fm.map = NULL; fm.view = NULL; fm.size = 0;
+}
+
+bool getFileStamp(const char* path, unsigned long long& size, unsigned long long& time)
+{
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if(!GetFileAttributesExA(path, GetFileExInfoStandard, &data))
+		return false;
+	size = ((unsigned long long)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	time = ((unsigned long long)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+	return true;
+}
+
+mappedIOStream::mappedIOStream(const fileMapping& fm)
+{
+	m_Map = fm;
+	m_Pos = 0;
+}
+
+mappedIOStream::~mappedIOStream()
+{
+	unmapFile(m_Map);
+}
+
+size_t mappedIOStream::Read(void* pvBuffer, size_t pSize, size_t pCount)
+{
+	if(pSize == 0 || m_Pos >= m_Map.size)
+		return 0;
+	//like fread, only whole elements are read
+	size_t count = (m_Map.size - m_Pos) / pSize;
+	if(count > pCount)
+		count = pCount;
+	memcpy(pvBuffer, m_Map.view + m_Pos, count * pSize);
+	m_Pos += count * pSize;
+	return count;
+}
+
+size_t mappedIOStream::Write(const void* pvBuffer, size_t pSize, size_t pCount)
+{
+	//the mapping is read only
+	return 0;
+}
+
+aiReturn mappedIOStream::Seek(size_t pOffset, aiOrigin pOrigin)
+{
+	size_t newPos;
+	if(pOrigin == aiOrigin_SET)
+		newPos = pOffset;
+	else if(pOrigin == aiOrigin_CUR)
+		newPos = m_Pos + pOffset;
+	else
+		newPos = m_Map.size + pOffset; //the offset is negative (wrapped around) for aiOrigin_END
+	if(newPos > m_Map.size)
+		return aiReturn_FAILURE;
+	m_Pos = newPos;
+	return aiReturn_SUCCESS;
+}
+
+size_t mappedIOStream::Tell() const
+{
+	return m_Pos;
+}
+
+size_t mappedIOStream::FileSize() const
+{
+	return m_Map.size;
+}
+
+void mappedIOStream::Flush()
+{
+}
+
+bool mappedIOSystem::Exists(const char* pFile) const
+{
+	return GetFileAttributesA(pFile) != INVALID_FILE_ATTRIBUTES;
+}
+
+char mappedIOSystem::getOsSeparator() const
+{
+	return '\\';
+}
+
+Assimp::IOStream* mappedIOSystem::Open(const char* pFile, const char* pMode)
+{
+	//ASSIMP only ever writes when exporting, which doesn't go through here
+	if(strchr(pMode, 'w') || strchr(pMode, 'a'))
+		return NULL;
+	fileMapping fm;
+	if(!mapFile(pFile, fm, false))
+	{
+		//an empty file can't be mapped but is still a valid (empty) stream
+		unsigned long long size, time;
+		if(!getFileStamp(pFile, size, time) || size != 0)
+			return NULL;
+	}
+	return new mappedIOStream(fm);
+}
+
+void mappedIOSystem::Close(Assimp::IOStream* pFile)
+{
+	delete pFile;
+}
@@ -0,0 +1,53 @@
+///		***
+///
+///		mappedIO.h - memory mapped files and an ASSIMP IOSystem built on them
+///		ASSIMP's default IO goes through fread, this serves every Read and Seek straight from the mapped
+///		pages instead. Anything ASSIMP opens while importing (.mtl files and the like) goes through it too.
+///
+///		***
+
+#ifndef MAPPEDIO_H
+#define MAPPEDIO_H
+
+#include <Windows.h>
+#include "assimp\IOSystem.hpp"
+#include "assimp\IOStream.hpp"
+
+//a view of an entire file, anything pointing into view stays valid until unmapFile
+struct fileMapping{
+	HANDLE file, map;
+	const char* view;
+	size_t size;
+};
+
+bool mapFile(const char* path, fileMapping& fm, bool copyOnWrite);
+void unmapFile(fileMapping& fm);
+bool getFileStamp(const char* path, unsigned long long& size, unsigned long long& time);
+
+//a read only stream over a mapped file
+class mappedIOStream : public Assimp::IOStream{
+public:
+	mappedIOStream(const fileMapping& fm);
+	~mappedIOStream();
+	size_t Read(void* pvBuffer, size_t pSize, size_t pCount);
+	size_t Write(const void* pvBuffer, size_t pSize, size_t pCount);
+	aiReturn Seek(size_t pOffset, aiOrigin pOrigin);
+	size_t Tell() const;
+	size_t FileSize() const;
+	void Flush();
+
+private:
+	fileMapping m_Map;
+	size_t m_Pos;
+};
+
+//hand one of these to Assimp::Importer::SetIOHandler, the importer deletes it
+class mappedIOSystem : public Assimp::IOSystem{
+public:
+	bool Exists(const char* pFile) const;
+	char getOsSeparator() const;
+	Assimp::IOStream* Open(const char* pFile, const char* pMode = "rb");
+	void Close(Assimp::IOStream* pFile);
+};
+
+#endif
@@ -0,0 +1,49 @@
+///		***
+///
+///		meshArena.cpp - meshArena implementation
+///
+///		***
+
+#include "meshArena.h"
+
+meshArena::meshArena(size_t reserve)
+{
+	m_NumAllocs = 0;
+	m_BytesUsed = 0;
+	if(reserve > 0)
+		addBlock(reserve);
+}
+
+meshArena::~meshArena()
+{
+	for(size_t i = 0; i < m_Blocks.size(); i++)
+	{
+		free(m_Blocks[i].base);
+	}
+}
+
+void meshArena::addBlock(size_t size)
+{
+	block b;
+	b.base = (char*)malloc(size + ARENA_ALIGN - 1);
+	b.start = (char*)aligned((size_t)b.base);
+	b.size = size;
+	b.used = 0;
+	m_Blocks.push_back(b);
+}
+
+//never returns NULL for a size over 0, a request that doesn't fit in the current block starts a new one
+void* meshArena::alloc(size_t bytes)
+{
+	if(bytes == 0)
+		return NULL;
+	bytes = aligned(bytes);
+	if(m_Blocks.empty() || m_Blocks.back().used + bytes > m_Blocks.back().size)
+		addBlock(bytes > ARENA_MIN_BLOCK ? bytes : ARENA_MIN_BLOCK);
+	block& b = m_Blocks.back();
+	void* p = b.start + b.used;
+	b.used += bytes;
+	m_NumAllocs++;
+	m_BytesUsed += bytes;
+	return p;
+}
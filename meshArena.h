@@ -0,0 +1,44 @@
+///		***
+///
+///		meshArena.h - a bump allocator for a model's CPU side geometry
+///		loadVert sizes one block for every array of every mesh up front, so a model's geometry is a single heap
+///		allocation however many meshes it has, and freeing it is freeing that block. Nothing in an arena is freed
+///		on its own, the arrays go when the arena does.
+///
+///		***
+
+#ifndef MESHARENA_H
+#define MESHARENA_H
+
+#include <vector>
+#include <stdlib.h>
+
+using namespace std;
+
+#define ARENA_ALIGN 16 //every allocation starts on this boundary
+#define ARENA_MIN_BLOCK (64 * 1024) //the smallest block made when the arena has to grow
+
+class meshArena{
+public:
+	meshArena(size_t reserve);
+	~meshArena();
+	void* alloc(size_t bytes);
+	size_t numBlocks() const { return m_Blocks.size(); }
+	size_t numAllocs() const { return m_NumAllocs; }
+	size_t bytesUsed() const { return m_BytesUsed; }
+	static size_t aligned(size_t bytes) { return (bytes + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN; }
+
+private:
+	struct block{
+		char* base; //as malloc returned it
+		char* start; //base rounded up to ARENA_ALIGN
+		size_t size, used;
+	};
+	vector<block> m_Blocks; //allocations come from the last one
+	size_t m_NumAllocs, m_BytesUsed;
+	void addBlock(size_t size);
+	meshArena(const meshArena&);
+	meshArena& operator=(const meshArena&);
+};
+
+#endif
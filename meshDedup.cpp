@@ -0,0 +1,240 @@
+///		***
+///
+///		meshDedup.cpp - sharing identical meshes between models
+///		Every mesh is hashed when it is parsed (indices, positions, normals, tex coords, tangents and bone data). At upload
+///		time a mesh whose contents match one already in the table is pointed at that mesh's arrays and GL objects
+///		instead of getting its own. The first of a kind is copied into the table, and either way releaseCPU then drops
+///		the model's own copy from its arena or cache mapping, so there is one copy of each distinct mesh whatever
+///		loaded it. The table is process wide and reference counted, freeModel only deletes a shared mesh once the
+///		last model using it has gone.
+///		Like everything else that touches GL, the table must only be used from the thread that owns the context.
+///
+///		***
+
+#include "modelLoader.h"
+
+//one distinct mesh, the arrays are the table's own so they outlive the model that first brought them in
+struct sharedMesh{
+	sMesh mesh;
+	vector<vBoneData> bones; //the mesh's slice of its model's bone data, to compare against
+	size_t refs;
+};
+
+static map<unsigned long long, vector<sharedMesh*> > s_Meshes; //by content hash, more than one only on a collision
+static mutex s_MeshLock;
+static size_t s_DedupHits = 0;
+
+//the bytes a mesh keeps in memory, and on the GPU
+static unsigned long long cpuBytes(const sMesh& theMesh)
+{
+	unsigned long long bytes = sizeof(GLuint) * theMesh.numInd + sizeof(GLfloat) * 3 * theMesh.numVert;
+	if(theMesh.hasNorm) bytes += sizeof(GLfloat) * 3 * theMesh.numVert;
+	if(theMesh.hasTexCoords) bytes += sizeof(GLfloat) * 2 * theMesh.numVert;
+	if(theMesh.hasTangents) bytes += sizeof(GLshort) * 4 * theMesh.numVert;
+	bytes += sizeof(GLuint) * theMesh.numLodInd;
+	bytes += sizeof(meshlet) * theMesh.numMeshlets;
+	return bytes;
+}
+
+static unsigned long long gpuBytes(const sMesh& theMesh)
+{
+	unsigned long long bytes = cpuBytes(theMesh) - sizeof(meshlet) * theMesh.numMeshlets;
+	return bytes + (theMesh.hasBones ? sizeof(vBoneData) * theMesh.numVert : 0);
+}
+
+static void* copyArray(const void* src, size_t len)
+{
+	if(!src)
+		return NULL;
+	void* dst = malloc(len);
+	memcpy(dst, src, len);
+	return dst;
+}
+
+//turns mesh dedup on or off for models loaded from now on, it is on by default
+void modelLoader::setMeshDedup(bool dedup)
+{
+	lock_guard<mutex> lock(m_JobLock);
+	m_Dedup = dedup;
+}
+
+//hashes every mesh of a freshly parsed model, runs on the loading thread
+void modelLoader::hashMeshes(model* m)
+{
+	if(!m_Dedup)
+		return;
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		sMesh& theMesh = m->vMesh[i];
+		unsigned int layout[6] = {theMesh.numVert, theMesh.numInd, theMesh.hasNorm, theMesh.hasTexCoords, theMesh.hasBones,
+			theMesh.hasTangents};
+		unsigned long long h = hashBytes(layout, sizeof(layout));
+		if(theMesh.indexes) h = hashBytes(theMesh.indexes, sizeof(GLuint) * theMesh.numInd, h);
+		if(theMesh.verts) h = hashBytes(theMesh.verts, sizeof(GLfloat) * 3 * theMesh.numVert, h);
+		if(theMesh.hasNorm) h = hashBytes(theMesh.normals, sizeof(GLfloat) * 3 * theMesh.numVert, h);
+		if(theMesh.hasTexCoords) h = hashBytes(theMesh.texCoords, sizeof(GLfloat) * 2 * theMesh.numVert, h);
+		if(theMesh.hasTangents) h = hashBytes(theMesh.tangents, sizeof(GLshort) * 4 * theMesh.numVert, h);
+		if(theMesh.numLodInd) h = hashBytes(theMesh.lodIndexes, sizeof(GLuint) * theMesh.numLodInd, h);
+		if(theMesh.hasBones) h = hashBytes(&m->vBones[theMesh.baseVert], sizeof(vBoneData) * theMesh.numVert, h);
+		theMesh.hash = h;
+	}
+}
+
+//a matching hash is only a hint, this makes sure
+static bool sameMesh(const sharedMesh& e, const model* m, const sMesh& theMesh)
+{
+	const sMesh& o = e.mesh;
+	if(o.numVert != theMesh.numVert || o.numInd != theMesh.numInd || o.hasNorm != theMesh.hasNorm ||
+		o.hasTexCoords != theMesh.hasTexCoords || o.hasBones != theMesh.hasBones || o.hasTangents != theMesh.hasTangents)
+		return false;
+	if(memcmp(o.indexes, theMesh.indexes, sizeof(GLuint) * theMesh.numInd) != 0 ||
+		memcmp(o.verts, theMesh.verts, sizeof(GLfloat) * 3 * theMesh.numVert) != 0)
+		return false;
+	if(theMesh.hasNorm && memcmp(o.normals, theMesh.normals, sizeof(GLfloat) * 3 * theMesh.numVert) != 0)
+		return false;
+	if(theMesh.hasTexCoords && memcmp(o.texCoords, theMesh.texCoords, sizeof(GLfloat) * 2 * theMesh.numVert) != 0)
+		return false;
+	if(theMesh.hasTangents && memcmp(o.tangents, theMesh.tangents, sizeof(GLshort) * 4 * theMesh.numVert) != 0)
+		return false;
+	//the LOD levels share the index buffer, so they have to match too
+	if(o.numLodInd != theMesh.numLodInd || o.numLods != theMesh.numLods ||
+		(theMesh.numLodInd && memcmp(o.lodIndexes, theMesh.lodIndexes, sizeof(GLuint) * theMesh.numLodInd) != 0))
+		return false;
+	if(theMesh.hasBones && memcmp(&e.bones[0], &m->vBones[theMesh.baseVert], sizeof(vBoneData) * theMesh.numVert) != 0)
+		return false;
+	return true;
+}
+
+//makes mesh i's GL objects, unless an identical mesh already has them
+void modelLoader::shareMesh(model* m, size_t i)
+{
+	sMesh& theMesh = m->vMesh[i];
+	if(theMesh.numVert == 0 || theMesh.verts == NULL || theMesh.indexes == NULL)
+	{
+		makeMeshVAO(m, i);
+		return;
+	}
+	lock_guard<mutex> lock(s_MeshLock);
+	vector<sharedMesh*>& bucket = s_Meshes[theMesh.hash];
+	for(size_t b = 0; b < bucket.size(); b++)
+	{
+		sharedMesh& e = *bucket[b];
+		if(!sameMesh(e, m, theMesh))
+			continue;
+		//the mesh's own arrays are in the model's arena or cache mapping, they go when the model does
+		free(theMesh.packed);
+		theMesh.packed = NULL;
+		free(theMesh.shadowIndexes);
+		theMesh.shadowIndexes = NULL;
+		//the table's buffers may have been laid out by a loader with other settings, draw them its way
+		theMesh.stride = e.mesh.stride;
+		theMesh.quantized = e.mesh.quantized;
+		theMesh.octNorm8 = e.mesh.octNorm8;
+		memcpy(theMesh.posScale, e.mesh.posScale, sizeof(theMesh.posScale));
+		memcpy(theMesh.posOffset, e.mesh.posOffset, sizeof(theMesh.posOffset));
+		memcpy(theMesh.uvScale, e.mesh.uvScale, sizeof(theMesh.uvScale));
+		memcpy(theMesh.uvOffset, e.mesh.uvOffset, sizeof(theMesh.uvOffset));
+		theMesh.indexes = e.mesh.indexes;
+		theMesh.verts = e.mesh.verts;
+		theMesh.normals = e.mesh.normals;
+		theMesh.texCoords = e.mesh.texCoords;
+		theMesh.tangents = e.mesh.tangents;
+		theMesh.lodIndexes = e.mesh.lodIndexes;
+		theMesh.meshlets = e.mesh.meshlets;
+		theMesh.numMeshlets = e.mesh.numMeshlets;
+		theMesh.vao = e.mesh.vao;
+		theMesh.depthVao = e.mesh.depthVao;
+		theMesh.shadowVerts = e.mesh.shadowVerts;
+		theMesh.shadowBase = e.mesh.shadowBase;
+		theMesh.ibo = e.mesh.ibo; theMesh.vbo = e.mesh.vbo; theMesh.nbo = e.mesh.nbo;
+		theMesh.tbo = e.mesh.tbo; theMesh.bbo = e.mesh.bbo;
+		theMesh.shared = true;
+		e.refs++;
+		s_DedupHits++;
+		return;
+	}
+
+	//first of its kind, it goes in the table
+	makeMeshVAO(m, i);
+	//the table's copy has to outlive the arena or mapping it came from
+	theMesh.indexes = (GLuint*)copyArray(theMesh.indexes, sizeof(GLuint) * theMesh.numInd);
+	theMesh.verts = (GLfloat*)copyArray(theMesh.verts, sizeof(GLfloat) * 3 * theMesh.numVert);
+	theMesh.normals = theMesh.hasNorm ? (GLfloat*)copyArray(theMesh.normals, sizeof(GLfloat) * 3 * theMesh.numVert) : NULL;
+	theMesh.texCoords = theMesh.hasTexCoords ? (GLfloat*)copyArray(theMesh.texCoords, sizeof(GLfloat) * 2 * theMesh.numVert) : NULL;
+	theMesh.tangents = theMesh.hasTangents ? (GLshort*)copyArray(theMesh.tangents, sizeof(GLshort) * 4 * theMesh.numVert) : NULL;
+	theMesh.lodIndexes = theMesh.numLodInd ? (GLuint*)copyArray(theMesh.lodIndexes, sizeof(GLuint) * theMesh.numLodInd) : NULL;
+	theMesh.meshlets = theMesh.numMeshlets ? (meshlet*)copyArray(theMesh.meshlets, sizeof(meshlet) * theMesh.numMeshlets) : NULL;
+	sharedMesh* e = new sharedMesh;
+	e->mesh = theMesh;
+	if(theMesh.hasBones)
+		e->bones.assign(m->vBones.begin() + theMesh.baseVert, m->vBones.begin() + theMesh.baseVert + theMesh.numVert);
+	e->refs = 1;
+	bucket.push_back(e);
+	theMesh.shared = true;
+}
+
+//drops the mesh's reference to its shared copy, the last reference deletes it. The mesh is left
+//pointing at nothing so discardModel has nothing of the table's to free.
+void modelLoader::releaseSharedMesh(sMesh& theMesh)
+{
+	lock_guard<mutex> lock(s_MeshLock);
+	map<unsigned long long, vector<sharedMesh*> >::iterator it = s_Meshes.find(theMesh.hash);
+	if(it != s_Meshes.end())
+	{
+		vector<sharedMesh*>& bucket = it->second;
+		for(size_t b = 0; b < bucket.size(); b++)
+		{
+			sharedMesh* e = bucket[b];
+			if(e->mesh.vao != theMesh.vao)
+				continue;
+			if(--e->refs == 0)
+			{
+				GLuint buffers[5] = {e->mesh.ibo, e->mesh.vbo, e->mesh.nbo, e->mesh.tbo, e->mesh.bbo};
+				glDeleteBuffers(5, buffers);
+				glDeleteVertexArrays(1, &e->mesh.vao);
+				if(e->mesh.depthVao != 0)
+					glDeleteVertexArrays(1, &e->mesh.depthVao);
+				free(e->mesh.indexes);
+				free(e->mesh.verts);
+				free(e->mesh.normals);
+				free(e->mesh.texCoords);
+				free(e->mesh.tangents);
+				free(e->mesh.lodIndexes);
+				free(e->mesh.meshlets);
+				delete e;
+				bucket.erase(bucket.begin() + b);
+				if(bucket.empty())
+					s_Meshes.erase(it);
+			}
+			break;
+		}
+	}
+	theMesh.indexes = NULL; theMesh.verts = NULL; theMesh.normals = NULL; theMesh.texCoords = NULL; theMesh.tangents = NULL;
+	theMesh.lodIndexes = NULL;
+	theMesh.meshlets = NULL; theMesh.numMeshlets = 0;
+	theMesh.vao = theMesh.ibo = theMesh.vbo = theMesh.nbo = theMesh.tbo = theMesh.bbo = theMesh.depthVao = 0;
+	theMesh.shared = false;
+}
+
+dedupStats modelLoader::getDedupStats()
+{
+	lock_guard<mutex> lock(s_MeshLock);
+	dedupStats ds;
+	ds.numMeshes = ds.numRefs = 0;
+	ds.hits = s_DedupHits;
+	ds.cpuBytesSaved = ds.gpuBytesSaved = 0;
+	for(map<unsigned long long, vector<sharedMesh*> >::iterator it = s_Meshes.begin(); it != s_Meshes.end(); it++)
+	{
+		for(size_t b = 0; b < it->second.size(); b++)
+		{
+			const sharedMesh& e = *it->second[b];
+			ds.numMeshes++;
+			ds.numRefs += e.refs;
+			//every reference after the first would have had its own copy, and since releaseCPU drops the models'
+			//copies of shared meshes the table's is the only one left. Bone data stays with each model.
+			ds.cpuBytesSaved += cpuBytes(e.mesh) * (e.refs - 1);
+			ds.gpuBytesSaved += gpuBytes(e.mesh) * (e.refs - 1);
+		}
+	}
+	return ds;
+}
@@ -0,0 +1,377 @@
+///		***
+///
+///		meshOptimize.cpp - the vertex cache, overdraw and vertex fetch optimizers and the cache analysis
+///
+///		***
+
+#include "meshOptimize.h"
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+using namespace std;
+
+//runs one triangle through a FIFO cache, stamps holds when each vertex last went in. Returns the misses.
+static unsigned int fifoTriangle(const unsigned int* tri, vector<unsigned int>& stamps, unsigned int& time, unsigned int cacheSize)
+{
+	unsigned int misses = 0;
+	for(size_t k = 0; k < 3; k++)
+	{
+		unsigned int v = tri[k];
+		if(time - stamps[v] > cacheSize)
+		{
+			stamps[v] = time++;
+			misses++;
+		}
+	}
+	return misses;
+}
+
+vcacheStats analyzeVertexCache(const unsigned int* indices, size_t numInd, size_t numVert, unsigned int cacheSize)
+{
+	vcacheStats vs;
+	vs.misses = 0;
+	vector<unsigned int> stamps(numVert, 0);
+	unsigned int time = cacheSize + 1;
+	for(size_t i = 0; i + 2 < numInd; i += 3)
+	{
+		vs.misses += fifoTriangle(&indices[i], stamps, time, cacheSize);
+	}
+	vs.acmr = numInd >= 3 ? (float)vs.misses / (numInd / 3) : 0.0f;
+	vs.atvr = numVert > 0 ? (float)vs.misses / numVert : 0.0f;
+	return vs;
+}
+
+//Forsyth's vertex score: recently used vertices score higher, except the last triangle's three which all score
+//the same so the order within a triangle doesn't matter, and vertices with few triangles left score higher still
+//so they get finished off rather than left stranded
+static float vertexScore(int cachePos, unsigned int liveTris)
+{
+	if(liveTris == 0)
+		return -1.0f;
+	float score = 0.0f;
+	if(cachePos >= 0)
+	{
+		if(cachePos < 3)
+			score = 0.75f;
+		else
+			score = powf(1.0f - (float)(cachePos - 3) / (FORSYTH_CACHE_SIZE - 3), 1.5f);
+	}
+	return score + 2.0f / sqrtf((float)liveTris);
+}
+
+//writes indices to dst in the order Forsyth's "Linear-Speed Vertex Cache Optimisation" picks the triangles.
+//dst and indices must not overlap.
+void optimizeVertexCache(unsigned int* dst, const unsigned int* indices, size_t numInd, size_t numVert)
+{
+	size_t numTri = numInd / 3;
+	if(numTri == 0)
+		return;
+	//each vertex's triangles, the live ones are kept at the front of its list
+	vector<unsigned int> live(numVert, 0);
+	for(size_t i = 0; i < numTri * 3; i++)
+	{
+		live[indices[i]]++;
+	}
+	vector<size_t> first(numVert + 1, 0);
+	for(size_t v = 0; v < numVert; v++)
+	{
+		first[v + 1] = first[v] + live[v];
+	}
+	vector<unsigned int> adj(numTri * 3);
+	vector<size_t> fill(first.begin(), first.end() - 1);
+	for(size_t i = 0; i < numTri * 3; i++)
+	{
+		adj[fill[indices[i]]++] = (unsigned int)(i / 3);
+	}
+
+	vector<int> cachePos(numVert, -1);
+	vector<float> vScore(numVert);
+	for(size_t v = 0; v < numVert; v++)
+	{
+		vScore[v] = vertexScore(-1, live[v]);
+	}
+	vector<float> tScore(numTri);
+	vector<char> emitted(numTri, 0);
+	const size_t none = (size_t)-1;
+	size_t best = 0;
+	for(size_t t = 0; t < numTri; t++)
+	{
+		const unsigned int* tri = &indices[t * 3];
+		tScore[t] = vScore[tri[0]] + vScore[tri[1]] + vScore[tri[2]];
+		if(tScore[t] > tScore[best])
+			best = t;
+	}
+
+	unsigned int cache[FORSYTH_CACHE_SIZE + 3];
+	size_t cacheSize = 0, cursor = 0;
+	for(size_t out = 0; out < numTri; out++)
+	{
+		//nothing in the cache has a triangle left, carry on from the first one not yet drawn
+		if(best == none)
+		{
+			while(emitted[cursor])
+			{
+				cursor++;
+			}
+			best = cursor;
+		}
+		const unsigned int* tri = &indices[best * 3];
+		memcpy(&dst[out * 3], tri, sizeof(unsigned int) * 3);
+		emitted[best] = 1;
+
+		for(size_t k = 0; k < 3; k++)
+		{
+			unsigned int v = tri[k];
+			unsigned int* list = &adj[first[v]];
+			for(size_t j = 0; j < live[v]; j++)
+			{
+				if(list[j] == best)
+				{
+					list[j] = list[live[v] - 1];
+					list[live[v] - 1] = (unsigned int)best;
+					break;
+				}
+			}
+			live[v]--;
+		}
+
+		//the triangle's vertices go to the front, anything pushed past the end drops out
+		unsigned int next[FORSYTH_CACHE_SIZE + 3];
+		size_t numNext = 0;
+		for(size_t k = 0; k < 3; k++)
+		{
+			if((k == 1 && tri[1] == tri[0]) || (k == 2 && (tri[2] == tri[0] || tri[2] == tri[1])))
+				continue;
+			next[numNext++] = tri[k];
+		}
+		for(size_t c = 0; c < cacheSize; c++)
+		{
+			if(cache[c] != tri[0] && cache[c] != tri[1] && cache[c] != tri[2])
+				next[numNext++] = cache[c];
+		}
+		for(size_t c = 0; c < numNext; c++)
+		{
+			unsigned int v = next[c];
+			cachePos[v] = c < FORSYTH_CACHE_SIZE ? (int)c : -1;
+			vScore[v] = vertexScore(cachePos[v], live[v]);
+		}
+
+		//only triangles touching those vertices have changed score, the best of them goes next
+		best = none;
+		float bestScore = -1.0f;
+		for(size_t c = 0; c < numNext; c++)
+		{
+			unsigned int v = next[c];
+			for(size_t j = 0; j < live[v]; j++)
+			{
+				unsigned int t = adj[first[v] + j];
+				const unsigned int* o = &indices[t * 3];
+				tScore[t] = vScore[o[0]] + vScore[o[1]] + vScore[o[2]];
+				if(tScore[t] > bestScore)
+				{
+					bestScore = tScore[t];
+					best = t;
+				}
+			}
+		}
+		cacheSize = numNext < FORSYTH_CACHE_SIZE ? numNext : FORSYTH_CACHE_SIZE;
+		memcpy(cache, next, sizeof(unsigned int) * cacheSize);
+	}
+}
+
+//orders clusters by their sort key, biggest first
+struct clusterKeyGreater{
+	const vector<float>* keys;
+	bool operator()(size_t a, size_t b) const { return (*keys)[a] > (*keys)[b]; }
+};
+
+//reorders the triangles of an already cache optimized index buffer in place, a cluster at a time, so the ones
+//facing out from the middle of the mesh are drawn first and hide what is behind them. Clusters start where
+//the cache order starts over anyway (a triangle missing on all three vertices), and are cut smaller wherever
+//that keeps the ACMR within threshold of what it was. Returns the number of clusters.
+size_t optimizeOverdraw(unsigned int* indices, size_t numInd, const float* verts, size_t numVert, float threshold)
+{
+	size_t numTri = numInd / 3;
+	if(numTri < 2)
+		return numTri;
+	const unsigned int cs = VCACHE_ANALYZE_SIZE;
+	vector<unsigned int> stamps(numVert, 0);
+	unsigned int time = cs + 1;
+	vector<size_t> hard;
+	for(size_t t = 0; t < numTri; t++)
+	{
+		if(fifoTriangle(&indices[t * 3], stamps, time, cs) == 3 || t == 0)
+			hard.push_back(t);
+	}
+	hard.push_back(numTri);
+
+	//moving time on by more than the cache size empties it
+	vector<size_t> starts;
+	for(size_t h = 0; h + 1 < hard.size(); h++)
+	{
+		size_t a = hard[h], b = hard[h + 1];
+		time += cs + 1;
+		size_t misses = 0;
+		for(size_t t = a; t < b; t++)
+		{
+			misses += fifoTriangle(&indices[t * 3], stamps, time, cs);
+		}
+		float whole = (float)misses / (b - a);
+		time += cs + 1;
+		misses = 0;
+		size_t start = a;
+		starts.push_back(a);
+		for(size_t t = a; t + 1 < b; t++)
+		{
+			misses += fifoTriangle(&indices[t * 3], stamps, time, cs);
+			if((float)misses / (t + 1 - start) <= whole * threshold)
+			{
+				start = t + 1;
+				starts.push_back(start);
+				time += cs + 1;
+				misses = 0;
+			}
+		}
+	}
+	size_t numClusters = starts.size();
+	starts.push_back(numTri);
+
+	//area weighted centroids and normals, of each cluster and of the whole mesh
+	vector<float> cent(numClusters * 3, 0.0f), norm(numClusters * 3, 0.0f), area(numClusters, 0.0f);
+	float meshCent[3] = {0.0f, 0.0f, 0.0f}, meshArea = 0.0f;
+	for(size_t c = 0; c < numClusters; c++)
+	{
+		for(size_t t = starts[c]; t < starts[c + 1]; t++)
+		{
+			const float* p0 = &verts[indices[t * 3] * 3];
+			const float* p1 = &verts[indices[t * 3 + 1] * 3];
+			const float* p2 = &verts[indices[t * 3 + 2] * 3];
+			float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+			float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+			float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+			float a = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]) * 0.5f;
+			for(size_t k = 0; k < 3; k++)
+			{
+				float mid = (p0[k] + p1[k] + p2[k]) / 3.0f;
+				cent[c * 3 + k] += mid * a;
+				norm[c * 3 + k] += n[k];
+				meshCent[k] += mid * a;
+			}
+			area[c] += a;
+			meshArea += a;
+		}
+	}
+	if(meshArea > 0.0f)
+	{
+		meshCent[0] /= meshArea; meshCent[1] /= meshArea; meshCent[2] /= meshArea;
+	}
+	vector<float> keys(numClusters, 0.0f);
+	for(size_t c = 0; c < numClusters; c++)
+	{
+		const float* n = &norm[c * 3];
+		float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if(area[c] <= 0.0f || len <= 0.0f)
+			continue;
+		for(size_t k = 0; k < 3; k++)
+		{
+			keys[c] += (cent[c * 3 + k] / area[c] - meshCent[k]) * n[k] / len;
+		}
+	}
+
+	vector<size_t> order(numClusters);
+	for(size_t c = 0; c < numClusters; c++)
+	{
+		order[c] = c;
+	}
+	clusterKeyGreater greater;
+	greater.keys = &keys;
+	stable_sort(order.begin(), order.end(), greater);
+	vector<unsigned int> src(indices, indices + numTri * 3);
+	size_t out = 0;
+	for(size_t i = 0; i < numClusters; i++)
+	{
+		size_t c = order[i];
+		size_t len = (starts[c + 1] - starts[c]) * 3;
+		memcpy(&indices[out], &src[starts[c] * 3], sizeof(unsigned int) * len);
+		out += len;
+	}
+	return numClusters;
+}
+
+//fills remap with each vertex's new position, in the order the indices first use them. Vertices no triangle
+//uses go after the rest in the order they were in. Returns how many are used.
+size_t optimizeVertexFetch(unsigned int* remap, const unsigned int* indices, size_t numInd, size_t numVert)
+{
+	const unsigned int none = 0xFFFFFFFF;
+	for(size_t v = 0; v < numVert; v++)
+	{
+		remap[v] = none;
+	}
+	unsigned int next = 0;
+	for(size_t i = 0; i < numInd; i++)
+	{
+		if(remap[indices[i]] == none)
+			remap[indices[i]] = next++;
+	}
+	size_t used = next;
+	for(size_t v = 0; v < numVert; v++)
+	{
+		if(remap[v] == none)
+			remap[v] = next++;
+	}
+	return used;
+}
+
+//moves every vertex of an array of numVert vertices of vertBytes each to where remap says, in place
+void remapVertices(void* data, size_t numVert, size_t vertBytes, const unsigned int* remap)
+{
+	if(!data)
+		return;
+	vector<unsigned char> src((unsigned char*)data, (unsigned char*)data + numVert * vertBytes);
+	for(size_t v = 0; v < numVert; v++)
+	{
+		memcpy((unsigned char*)data + remap[v] * vertBytes, &src[v * vertBytes], vertBytes);
+	}
+}
+
+//orders vertex numbers by their bytes, so identical vertices end up next to each other
+struct vertexBytesLess{
+	const unsigned char* data;
+	size_t vertBytes;
+	bool operator()(unsigned int a, unsigned int b) const
+	{
+		int c = memcmp(data + a * vertBytes, data + b * vertBytes, vertBytes);
+		return c != 0 ? c < 0 : a < b;
+	}
+};
+
+//fills remap with, for each of numVert vertices of vertBytes each, the first vertex with exactly the same bytes
+//(itself if it is the first). Returns how many distinct vertices there are.
+size_t weldVertices(unsigned int* remap, const void* data, size_t numVert, size_t vertBytes)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	vector<unsigned int> order(numVert);
+	for(size_t v = 0; v < numVert; v++)
+	{
+		order[v] = (unsigned int)v;
+	}
+	vertexBytesLess less;
+	less.data = bytes;
+	less.vertBytes = vertBytes;
+	sort(order.begin(), order.end(), less);
+	size_t distinct = 0;
+	for(size_t i = 0; i < numVert; i++)
+	{
+		//ties sort by number, so the first of each run is the lowest
+		if(i > 0 && memcmp(bytes + order[i - 1] * vertBytes, bytes + order[i] * vertBytes, vertBytes) == 0)
+			remap[order[i]] = remap[order[i - 1]];
+		else
+		{
+			remap[order[i]] = order[i];
+			distinct++;
+		}
+	}
+	return distinct;
+}
@@ -0,0 +1,36 @@
+///		***
+///
+///		meshOptimize.h - index and vertex reordering for the post transform cache, overdraw and vertex fetch
+///		These work on plain index and float arrays and make no GL or ASSIMP calls, so an asset cooking tool can
+///		run them as well as the loader. The loader runs all three on every mesh, in this order:
+///		optimizeVertexCache - Forsyth's greedy triangle ordering for an LRU cache of FORSYTH_CACHE_SIZE
+///		optimizeOverdraw - cuts that order into clusters and draws the outward facing ones first
+///		optimizeVertexFetch - renumbers the vertices in the order the indices first use them
+///		weldVertices is separate, setDepthStream uses it to point the depth only index buffer at one vertex per position
+///
+///		***
+
+#ifndef MESHOPTIMIZE_H
+#define MESHOPTIMIZE_H
+
+#include <stddef.h>
+
+#define FORSYTH_CACHE_SIZE 32 //the LRU cache optimizeVertexCache models
+#define VCACHE_ANALYZE_SIZE 16 //the FIFO cache analyzeVertexCache simulates, about what real hardware has
+#define OVERDRAW_THRESHOLD 1.05f //how much worse than the cache order's ACMR optimizeOverdraw may make it
+
+//what a FIFO cache of VCACHE_ANALYZE_SIZE makes of an index buffer
+struct vcacheStats{
+	size_t misses; //vertices transformed
+	float acmr; //misses per triangle, 0.5 is the best a big regular grid can do and 3 is no reuse at all
+	float atvr; //misses per vertex, 1 is every vertex transformed exactly once
+};
+
+vcacheStats analyzeVertexCache(const unsigned int* indices, size_t numInd, size_t numVert, unsigned int cacheSize);
+void optimizeVertexCache(unsigned int* dst, const unsigned int* indices, size_t numInd, size_t numVert);
+size_t optimizeOverdraw(unsigned int* indices, size_t numInd, const float* verts, size_t numVert, float threshold);
+size_t optimizeVertexFetch(unsigned int* remap, const unsigned int* indices, size_t numInd, size_t numVert);
+void remapVertices(void* data, size_t numVert, size_t vertBytes, const unsigned int* remap);
+size_t weldVertices(unsigned int* remap, const void* data, size_t numVert, size_t vertBytes);
+
+#endif
@@ -0,0 +1,388 @@
+///		***
+///
+///		meshSimplify.cpp - the quadric error simplifier behind the LOD chains
+///
+///		***
+
+#include "meshSimplify.h"
+#include "meshOptimize.h"
+#include <algorithm>
+#include <math.h>
+#include <float.h>
+
+using namespace std;
+
+#define BORDER_WEIGHT 10.0 //how much more a border resists moving off its line than a surface off its plane
+
+enum vertKind{
+	kindManifold, //free to collapse into any neighbour
+	kindBorder, //on an open edge, only collapses along it
+	kindLocked //a seam, a border corner or something non manifold, never moves
+};
+
+//the sum of squared distances to a set of planes, divided by w gives the average
+struct quadric{
+	double a2, b2, c2, ab, ac, bc, ad, bd, cd, d2, w;
+};
+
+static void addPlane(quadric& q, double a, double b, double c, double d, double w)
+{
+	q.a2 += w * a * a; q.b2 += w * b * b; q.c2 += w * c * c;
+	q.ab += w * a * b; q.ac += w * a * c; q.bc += w * b * c;
+	q.ad += w * a * d; q.bd += w * b * d; q.cd += w * c * d;
+	q.d2 += w * d * d;
+	q.w += w;
+}
+
+static void addQuadric(quadric& q, const quadric& o)
+{
+	q.a2 += o.a2; q.b2 += o.b2; q.c2 += o.c2;
+	q.ab += o.ab; q.ac += o.ac; q.bc += o.bc;
+	q.ad += o.ad; q.bd += o.bd; q.cd += o.cd;
+	q.d2 += o.d2;
+	q.w += o.w;
+}
+
+//squared distance from p, averaged over the planes
+static double evalQuadric(const quadric& q, const float* p)
+{
+	double x = p[0], y = p[1], z = p[2];
+	double r = q.a2 * x * x + q.b2 * y * y + q.c2 * z * z + 2.0 * (q.ab * x * y + q.ac * x * z + q.bc * y * z) +
+		2.0 * (q.ad * x + q.bd * y + q.cd * z) + q.d2;
+	return q.w > 0.0 && r > 0.0 ? r / q.w : 0.0;
+}
+
+static void triNormal(const float* p0, const float* p1, const float* p2, double* n)
+{
+	double e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+	double e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+	n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static unsigned long long edgeKey(unsigned int a, unsigned int b)
+{
+	return a < b ? ((unsigned long long)a << 32) | b : ((unsigned long long)b << 32) | a;
+}
+
+//sorts vertex numbers by position so the ones sharing a position end up next to each other
+struct positionLess{
+	const float* verts;
+	bool operator()(unsigned int a, unsigned int b) const
+	{
+		const float* p = &verts[a * 3];
+		const float* q = &verts[b * 3];
+		if(p[0] != q[0]) return p[0] < q[0];
+		if(p[1] != q[1]) return p[1] < q[1];
+		return p[2] < q[2];
+	}
+};
+
+struct collapse{
+	unsigned int v, u; //v moves onto u
+	float cost;
+};
+
+struct collapseLess{
+	bool operator()(const collapse& a, const collapse& b) const { return a.cost < b.cost; }
+};
+
+//the state one chain is simplified with, kept from level to level so the error carries on adding up
+struct simplifier{
+	const float* verts;
+	size_t numVert;
+	const unsigned int* groups;
+	vector<quadric> quadrics;
+	vector<char> seam;
+	double maxErr;
+};
+
+//every undirected edge of the current triangles, sorted, with how many triangles use it
+static void countEdges(const vector<unsigned int>& inds, vector<unsigned long long>& edges, vector<unsigned int>& uses)
+{
+	vector<unsigned long long> all(inds.size());
+	for(size_t t = 0; t + 2 < inds.size(); t += 3)
+	{
+		for(size_t k = 0; k < 3; k++)
+		{
+			all[t + k] = edgeKey(inds[t + k], inds[t + (k + 1) % 3]);
+		}
+	}
+	sort(all.begin(), all.end());
+	edges.clear();
+	uses.clear();
+	for(size_t i = 0; i < all.size(); i++)
+	{
+		if(!edges.empty() && edges.back() == all[i])
+			uses.back()++;
+		else
+		{
+			edges.push_back(all[i]);
+			uses.push_back(1);
+		}
+	}
+}
+
+static unsigned int edgeUses(const vector<unsigned long long>& edges, const vector<unsigned int>& uses, unsigned int a, unsigned int b)
+{
+	vector<unsigned long long>::const_iterator it = lower_bound(edges.begin(), edges.end(), edgeKey(a, b));
+	return it != edges.end() && *it == edgeKey(a, b) ? uses[it - edges.begin()] : 0;
+}
+
+//sets up the quadrics and finds the seams, from the full mesh
+static void initSimplifier(simplifier& s, const unsigned int* indices, size_t numInd)
+{
+	s.quadrics.assign(s.numVert, quadric());
+	s.maxErr = 0.0;
+	for(size_t t = 0; t + 2 < numInd; t += 3)
+	{
+		const unsigned int* tri = &indices[t];
+		const float* p0 = &s.verts[tri[0] * 3];
+		double n[3];
+		triNormal(p0, &s.verts[tri[1] * 3], &s.verts[tri[2] * 3], n);
+		double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if(len <= 0.0)
+			continue;
+		n[0] /= len; n[1] /= len; n[2] /= len;
+		double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+		//weighted by area, so a sliver doesn't count for as much as a big face
+		for(size_t k = 0; k < 3; k++)
+		{
+			addPlane(s.quadrics[tri[k]], n[0], n[1], n[2], d, len * 0.5);
+		}
+	}
+
+	//open edges get a plane at right angles to their triangle, which keeps the outline where it is
+	vector<unsigned long long> edges;
+	vector<unsigned int> uses;
+	vector<unsigned int> inds(indices, indices + numInd);
+	countEdges(inds, edges, uses);
+	for(size_t t = 0; t + 2 < numInd; t += 3)
+	{
+		for(size_t k = 0; k < 3; k++)
+		{
+			unsigned int a = indices[t + k], b = indices[t + (k + 1) % 3];
+			if(edgeUses(edges, uses, a, b) != 1)
+				continue;
+			const float* pa = &s.verts[a * 3];
+			const float* pb = &s.verts[b * 3];
+			double n[3];
+			triNormal(pa, pb, &s.verts[indices[t + (k + 2) % 3] * 3], n);
+			double e[3] = {pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2]};
+			//the plane through the edge, along the triangle's normal
+			double p[3] = {e[1] * n[2] - e[2] * n[1], e[2] * n[0] - e[0] * n[2], e[0] * n[1] - e[1] * n[0]};
+			double len = sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+			if(len <= 0.0)
+				continue;
+			p[0] /= len; p[1] /= len; p[2] /= len;
+			double d = -(p[0] * pa[0] + p[1] * pa[1] + p[2] * pa[2]);
+			double w = BORDER_WEIGHT * (e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
+			addPlane(s.quadrics[a], p[0], p[1], p[2], d, w);
+			addPlane(s.quadrics[b], p[0], p[1], p[2], d, w);
+		}
+	}
+
+	//more than one vertex at a position is a UV or normal seam, moving one half would tear it open
+	s.seam.assign(s.numVert, 0);
+	vector<unsigned int> order(s.numVert);
+	for(size_t v = 0; v < s.numVert; v++)
+	{
+		order[v] = (unsigned int)v;
+	}
+	positionLess less;
+	less.verts = s.verts;
+	sort(order.begin(), order.end(), less);
+	for(size_t i = 1; i < order.size(); i++)
+	{
+		if(!less(order[i - 1], order[i]))
+			s.seam[order[i - 1]] = s.seam[order[i]] = 1;
+	}
+}
+
+//one round of collapses, none of which touch the same triangles so they can all be checked against the
+//mesh as it was. Stops once inds is down to targetTri. Returns how many collapses it made.
+static size_t collapsePass(simplifier& s, vector<unsigned int>& inds, size_t targetTri)
+{
+	size_t numTri = inds.size() / 3;
+	vector<unsigned long long> edges;
+	vector<unsigned int> uses;
+	countEdges(inds, edges, uses);
+
+	//which vertices may move, and how
+	vector<char> kind(s.numVert, kindManifold);
+	vector<unsigned char> borderEdges(s.numVert, 0);
+	for(size_t e = 0; e < edges.size(); e++)
+	{
+		unsigned int a = (unsigned int)(edges[e] >> 32), b = (unsigned int)(edges[e] & 0xFFFFFFFF);
+		if(uses[e] > 2)
+			kind[a] = kind[b] = kindLocked;
+		else if(uses[e] == 1)
+		{
+			if(borderEdges[a] < 255) borderEdges[a]++;
+			if(borderEdges[b] < 255) borderEdges[b]++;
+		}
+	}
+	for(size_t v = 0; v < s.numVert; v++)
+	{
+		if(s.seam[v] || (borderEdges[v] != 0 && borderEdges[v] != 2))
+			kind[v] = kindLocked;
+		else if(borderEdges[v] == 2 && kind[v] != kindLocked)
+			kind[v] = kindBorder;
+	}
+
+	//each vertex's triangles
+	vector<size_t> first(s.numVert + 1, 0);
+	for(size_t i = 0; i < inds.size(); i++)
+	{
+		first[inds[i] + 1]++;
+	}
+	for(size_t v = 0; v < s.numVert; v++)
+	{
+		first[v + 1] += first[v];
+	}
+	vector<unsigned int> adj(inds.size());
+	vector<size_t> fill(first.begin(), first.end() - 1);
+	for(size_t i = 0; i < inds.size(); i++)
+	{
+		adj[fill[inds[i]]++] = (unsigned int)(i / 3);
+	}
+
+	//the cheapest move for every vertex that can move at all
+	vector<collapse> best(s.numVert);
+	for(size_t v = 0; v < s.numVert; v++)
+	{
+		best[v].v = (unsigned int)v;
+		best[v].u = (unsigned int)v;
+		best[v].cost = FLT_MAX;
+	}
+	for(size_t t = 0; t < numTri; t++)
+	{
+		for(size_t k = 0; k < 6; k++)
+		{
+			unsigned int v = inds[t * 3 + k % 3], u = inds[t * 3 + (k % 3 + (k < 3 ? 1 : 2)) % 3];
+			if(v == u || kind[v] == kindLocked)
+				continue;
+			if(s.groups && s.groups[v] != s.groups[u])
+				continue;
+			if(kind[v] == kindBorder && (kind[u] == kindManifold || edgeUses(edges, uses, v, u) != 1))
+				continue;
+			float cost = (float)evalQuadric(s.quadrics[v], &s.verts[u * 3]);
+			if(cost < best[v].cost)
+			{
+				best[v].u = u;
+				best[v].cost = cost;
+			}
+		}
+	}
+	vector<collapse> order;
+	for(size_t v = 0; v < s.numVert; v++)
+	{
+		if(best[v].u != v)
+			order.push_back(best[v]);
+	}
+	collapseLess less;
+	sort(order.begin(), order.end(), less);
+
+	vector<char> touched(s.numVert, 0);
+	vector<unsigned int> moveTo(s.numVert);
+	for(size_t v = 0; v < s.numVert; v++)
+	{
+		moveTo[v] = (unsigned int)v;
+	}
+	size_t removed = 0, made = 0;
+	size_t need = numTri > targetTri ? numTri - targetTri : 0;
+	for(size_t c = 0; c < order.size() && removed < need; c++)
+	{
+		unsigned int v = order[c].v, u = order[c].u;
+		if(touched[v] || touched[u])
+			continue;
+		//a triangle that would turn over is a fold in the surface, skip the collapse
+		size_t kills = 0;
+		bool ok = true;
+		for(size_t j = first[v]; j < first[v + 1] && ok; j++)
+		{
+			const unsigned int* tri = &inds[adj[j] * 3];
+			if(tri[0] == u || tri[1] == u || tri[2] == u)
+			{
+				kills++;
+				continue;
+			}
+			const float* p[3];
+			const float* q[3];
+			for(size_t k = 0; k < 3; k++)
+			{
+				p[k] = &s.verts[tri[k] * 3];
+				q[k] = &s.verts[(tri[k] == v ? u : tri[k]) * 3];
+			}
+			double n0[3], n1[3];
+			triNormal(p[0], p[1], p[2], n0);
+			triNormal(q[0], q[1], q[2], n1);
+			if(n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.0)
+				ok = false;
+		}
+		if(!ok)
+			continue;
+		moveTo[v] = u;
+		addQuadric(s.quadrics[u], s.quadrics[v]);
+		if(order[c].cost > s.maxErr)
+			s.maxErr = order[c].cost;
+		for(size_t j = first[v]; j < first[v + 1]; j++)
+		{
+			const unsigned int* tri = &inds[adj[j] * 3];
+			touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+		}
+		removed += kills;
+		made++;
+	}
+
+	//nothing that moved was also moved onto, so one lookup is enough
+	size_t out = 0;
+	for(size_t t = 0; t < numTri; t++)
+	{
+		unsigned int a = moveTo[inds[t * 3]], b = moveTo[inds[t * 3 + 1]], c = moveTo[inds[t * 3 + 2]];
+		if(a == b || b == c || a == c)
+			continue;
+		inds[out++] = a;
+		inds[out++] = b;
+		inds[out++] = c;
+	}
+	inds.resize(out);
+	return made;
+}
+
+//builds up to numRatios levels, each aiming for ratios[i] of the full mesh's triangles. Each level carries on
+//from the one before. The chain stops early at a level that can't get any smaller than the last (what's left
+//is all seams and corners). Every level comes out vertex cache optimized. Returns the number of levels made.
+size_t simplifyLods(const unsigned int* indices, size_t numInd, const float* verts, size_t numVert,
+	const unsigned int* groups, const float* ratios, size_t numRatios, vector<lodLevel>& out)
+{
+	out.clear();
+	size_t numTri = numInd / 3;
+	if(numTri < 2 || numVert == 0)
+		return 0;
+	simplifier s;
+	s.verts = verts;
+	s.numVert = numVert;
+	s.groups = groups;
+	initSimplifier(s, indices, numTri * 3);
+
+	vector<unsigned int> inds(indices, indices + numTri * 3);
+	size_t last = numTri;
+	for(size_t l = 0; l < numRatios; l++)
+	{
+		size_t target = (size_t)(numTri * ratios[l]);
+		while(inds.size() / 3 > target && collapsePass(s, inds, target) > 0)
+		{
+		}
+		if(inds.size() / 3 >= last || inds.empty())
+			break;
+		last = inds.size() / 3;
+		lodLevel level;
+		level.indices.resize(inds.size());
+		optimizeVertexCache(&level.indices[0], &inds[0], inds.size(), numVert);
+		level.error = (float)sqrt(s.maxErr);
+		out.push_back(level);
+	}
+	return out.size();
+}
@@ -0,0 +1,29 @@
+///		***
+///
+///		meshSimplify.h - quadric error edge collapse, for building a mesh's chain of LOD index buffers
+///		Every collapse moves a vertex onto one of its neighbours rather than somewhere new, so each level is just
+///		another index buffer over the mesh's own vertices. Vertices on a UV or normal seam (more than one vertex
+///		at the same position) never move, a vertex on an open border only slides along the border, and when
+///		groups are given (the loader passes each vertex's strongest bone) a vertex only collapses into one of
+///		its own group. Like meshOptimize.h this makes no GL or ASSIMP calls.
+///
+///		***
+
+#ifndef MESHSIMPLIFY_H
+#define MESHSIMPLIFY_H
+
+#include <stddef.h>
+#include <vector>
+
+#define MAX_LODS 3 //simplified levels a mesh can have below the full one
+
+//one level of a chain, indices are over the same vertices as the mesh it came from
+struct lodLevel{
+	std::vector<unsigned int> indices;
+	float error; //the furthest any surface moved getting to this level, in model units
+};
+
+size_t simplifyLods(const unsigned int* indices, size_t numInd, const float* verts, size_t numVert,
+	const unsigned int* groups, const float* ratios, size_t numRatios, std::vector<lodLevel>& out);
+
+#endif
@@ -0,0 +1,226 @@
+///		***
+///
+///		meshlet.cpp - meshlet building, bounds and CPU culling
+///
+///		***
+
+#include "meshlet.h"
+#include <vector>
+#include <math.h>
+
+using namespace std;
+
+//cuts the triangles, in order, into runs that stay within the meshlet limits. Fills out if it isn't NULL,
+//returns how many there are either way.
+static size_t partition(const unsigned int* indices, size_t numInd, size_t numVert, meshlet* out)
+{
+	vector<unsigned int> seen(numVert, 0); //the id of the last meshlet each vertex went in
+	unsigned int id = 1;
+	size_t num = 0, verts = 0, tris = 0, first = 0;
+	for(size_t t = 0; t + 2 < numInd; t += 3)
+	{
+		const unsigned int* tri = &indices[t];
+		size_t added = (seen[tri[0]] != id) + (seen[tri[1]] != id && tri[1] != tri[0]) +
+			(seen[tri[2]] != id && tri[2] != tri[0] && tri[2] != tri[1]);
+		if(tris > 0 && (verts + added > MESHLET_MAX_VERTS || tris + 1 > MESHLET_MAX_TRIS))
+		{
+			if(out)
+			{
+				out[num].firstInd = (unsigned int)first;
+				out[num].numInd = (unsigned int)(tris * 3);
+			}
+			num++;
+			id++;
+			verts = tris = 0;
+			first = t;
+			added = 1 + (tri[1] != tri[0]) + (tri[2] != tri[0] && tri[2] != tri[1]);
+		}
+		seen[tri[0]] = seen[tri[1]] = seen[tri[2]] = id;
+		verts += added;
+		tris++;
+	}
+	if(tris > 0)
+	{
+		if(out)
+		{
+			out[num].firstInd = (unsigned int)first;
+			out[num].numInd = (unsigned int)(tris * 3);
+		}
+		num++;
+	}
+	return num;
+}
+
+size_t countMeshlets(const unsigned int* indices, size_t numInd, size_t numVert)
+{
+	return partition(indices, numInd, numVert, NULL);
+}
+
+//fills out (countMeshlets long) with the mesh's meshlets and works out their bounds
+size_t buildMeshlets(meshlet* out, const unsigned int* indices, size_t numInd, const float* verts, size_t numVert)
+{
+	size_t num = partition(indices, numInd, numVert, out);
+	for(size_t i = 0; i < num; i++)
+	{
+		meshlet& ml = out[i];
+		const unsigned int* inds = &indices[ml.firstInd];
+		//the sphere around the middle of the box, near enough for culling
+		float lo[3], hi[3];
+		for(size_t k = 0; k < 3; k++)
+		{
+			lo[k] = hi[k] = verts[inds[0] * 3 + k];
+		}
+		for(size_t j = 0; j < ml.numInd; j++)
+		{
+			const float* p = &verts[inds[j] * 3];
+			for(size_t k = 0; k < 3; k++)
+			{
+				if(p[k] < lo[k]) lo[k] = p[k];
+				if(p[k] > hi[k]) hi[k] = p[k];
+			}
+		}
+		float r2 = 0.0f;
+		for(size_t k = 0; k < 3; k++)
+		{
+			ml.centre[k] = (lo[k] + hi[k]) * 0.5f;
+		}
+		for(size_t j = 0; j < ml.numInd; j++)
+		{
+			const float* p = &verts[inds[j] * 3];
+			float dx = p[0] - ml.centre[0], dy = p[1] - ml.centre[1], dz = p[2] - ml.centre[2];
+			float d2 = dx * dx + dy * dy + dz * dz;
+			if(d2 > r2) r2 = d2;
+		}
+		ml.radius = sqrtf(r2);
+
+		//the normal cone, the axis is the average of the unit normals and the cutoff comes from the one furthest off it
+		vector<float> normals;
+		float axis[3] = {0.0f, 0.0f, 0.0f};
+		for(size_t j = 0; j + 2 < ml.numInd; j += 3)
+		{
+			const float* p0 = &verts[inds[j] * 3];
+			const float* p1 = &verts[inds[j + 1] * 3];
+			const float* p2 = &verts[inds[j + 2] * 3];
+			float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+			float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+			float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+			float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if(len <= 0.0f)
+				continue;
+			for(size_t k = 0; k < 3; k++)
+			{
+				normals.push_back(n[k] / len);
+				axis[k] += n[k] / len;
+			}
+		}
+		float len = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+		ml.coneCutoff = 1.0f;
+		ml.coneAxis[0] = ml.coneAxis[1] = ml.coneAxis[2] = 0.0f;
+		if(len <= 0.0f)
+			continue;
+		float minDot = 1.0f;
+		for(size_t k = 0; k < 3; k++)
+		{
+			ml.coneAxis[k] = axis[k] / len;
+		}
+		for(size_t j = 0; j < normals.size(); j += 3)
+		{
+			float d = normals[j] * ml.coneAxis[0] + normals[j + 1] * ml.coneAxis[1] + normals[j + 2] * ml.coneAxis[2];
+			if(d < minDot) minDot = d;
+		}
+		//past about 85 degrees off the axis the cone would almost never cull anything, so don't bother testing it
+		if(minDot > 0.1f)
+			ml.coneCutoff = sqrtf(1.0f - minDot * minDot);
+	}
+	return num;
+}
+
+//the six clip planes of a column major model view projection matrix, in model space and normalized so a
+//point's distance to them is in model units. Each faces into the frustum.
+void frustumPlanes(const float* mvp, float planes[6][4])
+{
+	for(int p = 0; p < 6; p++)
+	{
+		int row = p / 2;
+		float sign = (p % 2) ? -1.0f : 1.0f;
+		for(int c = 0; c < 4; c++)
+		{
+			planes[p][c] = mvp[c * 4 + 3] + sign * mvp[c * 4 + row];
+		}
+		float len = sqrtf(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] + planes[p][2] * planes[p][2]);
+		if(len > 0.0f)
+		{
+			for(int c = 0; c < 4; c++)
+			{
+				planes[p][c] /= len;
+			}
+		}
+	}
+}
+
+//where the camera is in model space, from a column major model view matrix. False if it can't be inverted.
+bool cameraPosition(const float* modelView, float pos[3])
+{
+	//the camera is the point the matrix takes to the origin, the inverse of the top 3x3 applied to -translation
+	const float* m = modelView;
+	float a = m[0], b = m[4], c = m[8];
+	float d = m[1], e = m[5], f = m[9];
+	float g = m[2], h = m[6], i = m[10];
+	float det = a * (e * i - f * h) - b * (d * i - f * g) + c * (d * h - e * g);
+	if(fabsf(det) < 1e-12f)
+		return false;
+	float tx = -m[12], ty = -m[13], tz = -m[14];
+	pos[0] = ((e * i - f * h) * tx + (c * h - b * i) * ty + (b * f - c * e) * tz) / det;
+	pos[1] = ((f * g - d * i) * tx + (a * i - c * g) * ty + (c * d - a * f) * tz) / det;
+	pos[2] = ((d * h - e * g) * tx + (b * g - a * h) * ty + (a * e - b * d) * tz) / det;
+	return true;
+}
+
+//writes the index ranges that survive culling to rangeFirst and rangeCount (each num long at most), joining
+//meshlets that follow on from each other. camPos NULL skips the backface test. Returns the number of ranges.
+size_t cullMeshlets(const meshlet* ml, size_t num, const float planes[6][4], const float* camPos,
+	unsigned int* rangeFirst, unsigned int* rangeCount, cullStats& stats)
+{
+	size_t ranges = 0;
+	for(size_t i = 0; i < num; i++)
+	{
+		const meshlet& m = ml[i];
+		size_t tris = m.numInd / 3;
+		stats.meshlets++;
+		stats.triangles += tris;
+		bool outside = false;
+		for(int p = 0; p < 6 && !outside; p++)
+		{
+			outside = planes[p][0] * m.centre[0] + planes[p][1] * m.centre[1] + planes[p][2] * m.centre[2] +
+				planes[p][3] < -m.radius;
+		}
+		if(outside)
+		{
+			stats.frustumCulled++;
+			stats.trianglesCulled += tris;
+			continue;
+		}
+		//every triangle faces away if the camera looks along the axis closely enough, allowing for the sphere's size
+		if(camPos && m.coneCutoff < 1.0f)
+		{
+			float d[3] = {m.centre[0] - camPos[0], m.centre[1] - camPos[1], m.centre[2] - camPos[2]};
+			float len = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+			if(d[0] * m.coneAxis[0] + d[1] * m.coneAxis[1] + d[2] * m.coneAxis[2] >= m.coneCutoff * len + m.radius)
+			{
+				stats.backfaceCulled++;
+				stats.trianglesCulled += tris;
+				continue;
+			}
+		}
+		if(ranges > 0 && rangeFirst[ranges - 1] + rangeCount[ranges - 1] == m.firstInd)
+			rangeCount[ranges - 1] += m.numInd;
+		else
+		{
+			rangeFirst[ranges] = m.firstInd;
+			rangeCount[ranges] = m.numInd;
+			ranges++;
+		}
+	}
+	stats.ranges += ranges;
+	return ranges;
+}
@@ -0,0 +1,42 @@
+///		***
+///
+///		meshlet.h - splitting meshes into small clusters and culling them on the CPU
+///		A meshlet is a run of a mesh's triangles (in the order the index buffer already has them) touching at
+///		most MESHLET_MAX_VERTS vertices, with a bounding sphere and a cone around its triangles' normals. Every
+///		frame cullMeshlets drops the clusters outside the frustum or facing wholly away from the camera, and what
+///		is left goes to GL as a handful of index ranges. Nothing in here touches GL, the culling can be driven
+///		with made up matrices (meshletTest.cpp does).
+///
+///		***
+
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <stddef.h>
+
+#define MESHLET_MAX_VERTS 64
+#define MESHLET_MAX_TRIS 124
+
+struct meshlet{
+	unsigned int firstInd, numInd; //the range of the mesh's indices it covers
+	float centre[3], radius; //bounding sphere, model space
+	float coneAxis[3]; //the average direction its triangles face
+	float coneCutoff; //sine of the widest angle between a triangle and the axis, 1 if the cone is too wide to cull with
+};
+
+//what cullMeshlets threw away, added to on every call
+struct cullStats{
+	size_t meshlets, triangles; //considered
+	size_t frustumCulled, backfaceCulled; //meshlets
+	size_t trianglesCulled;
+	size_t ranges; //the index ranges what was left was drawn with
+};
+
+size_t buildMeshlets(meshlet* out, const unsigned int* indices, size_t numInd, const float* verts, size_t numVert);
+size_t countMeshlets(const unsigned int* indices, size_t numInd, size_t numVert);
+void frustumPlanes(const float* mvp, float planes[6][4]);
+bool cameraPosition(const float* modelView, float pos[3]);
+size_t cullMeshlets(const meshlet* ml, size_t num, const float planes[6][4], const float* camPos,
+	unsigned int* rangeFirst, unsigned int* rangeCount, cullStats& stats);
+
+#endif
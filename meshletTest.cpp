@@ -0,0 +1,224 @@
+///		***
+///
+///		meshletTest.cpp - command line checks for the meshlet building and CPU culling in meshlet.cpp
+///		usage: meshletTest
+///		Builds meshlets for a few small known meshes and culls them with made up matrices, no GL context or model
+///		files needed. Prints every check and returns 1 if any fails.
+///
+///		***
+
+#include "meshlet.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+static int s_Failed = 0;
+
+static void check(bool ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	if(!ok)
+		s_Failed++;
+}
+
+//a column major orthographic projection looking down -z from the origin, as glm::ortho makes it
+static void ortho(float l, float r, float b, float t, float n, float f, float* m)
+{
+	memset(m, 0, sizeof(float) * 16);
+	m[0] = 2.0f / (r - l);
+	m[5] = 2.0f / (t - b);
+	m[10] = -2.0f / (f - n);
+	m[12] = -(r + l) / (r - l);
+	m[13] = -(t + b) / (t - b);
+	m[14] = -(f + n) / (f - n);
+	m[15] = 1.0f;
+}
+
+static void identity(float* m)
+{
+	memset(m, 0, sizeof(float) * 16);
+	m[0] = m[5] = m[10] = m[15] = 1.0f;
+}
+
+//a meshlet that is only a bounding sphere, its cone too wide to cull with
+static meshlet sphereMeshlet(float x, float y, float z, float r, unsigned int firstInd)
+{
+	meshlet ml;
+	ml.firstInd = firstInd;
+	ml.numInd = 3;
+	ml.centre[0] = x; ml.centre[1] = y; ml.centre[2] = z;
+	ml.radius = r;
+	ml.coneAxis[0] = ml.coneAxis[1] = ml.coneAxis[2] = 0.0f;
+	ml.coneCutoff = 1.0f;
+	return ml;
+}
+
+//the unit cube, four vertices per face so every face has its own normals like a real exported box
+static const float s_BoxVerts[24 * 3] = {
+	-1,-1, 1,  1,-1, 1,  1, 1, 1, -1, 1, 1, //+z
+	 1,-1,-1, -1,-1,-1, -1, 1,-1,  1, 1,-1, //-z
+	 1,-1, 1,  1,-1,-1,  1, 1,-1,  1, 1, 1, //+x
+	-1,-1,-1, -1,-1, 1, -1, 1, 1, -1, 1,-1, //-x
+	-1, 1, 1,  1, 1, 1,  1, 1,-1, -1, 1,-1, //+y
+	-1,-1,-1,  1,-1,-1,  1,-1, 1, -1,-1, 1  //-y
+};
+
+static void boxIndices(unsigned int* inds)
+{
+	for(unsigned int f = 0; f < 6; f++)
+	{
+		unsigned int b = f * 4;
+		unsigned int quad[6] = {b, b + 1, b + 2, b, b + 2, b + 3};
+		memcpy(&inds[f * 6], quad, sizeof(quad));
+	}
+}
+
+static void testBox()
+{
+	unsigned int inds[36];
+	boxIndices(inds);
+	size_t n = countMeshlets(inds, 36, 24);
+	check(n == 1, "a 24 vertex box is one meshlet");
+	meshlet ml;
+	buildMeshlets(&ml, inds, 36, s_BoxVerts, 24);
+	check(ml.firstInd == 0 && ml.numInd == 36, "the box meshlet covers every index");
+	bool inside = true;
+	for(size_t v = 0; v < 24; v++)
+	{
+		const float* p = &s_BoxVerts[v * 3];
+		float dx = p[0] - ml.centre[0], dy = p[1] - ml.centre[1], dz = p[2] - ml.centre[2];
+		if(sqrtf(dx * dx + dy * dy + dz * dz) > ml.radius + 1e-5f)
+			inside = false;
+	}
+	check(inside, "the box's bounding sphere holds every vertex");
+	check(fabsf(ml.radius - sqrtf(3.0f)) < 1e-4f, "the box's bounding sphere is as tight as the box allows");
+	check(ml.coneCutoff >= 1.0f, "a closed box faces every way, so its cone never culls");
+
+	//more vertices than one meshlet can hold splits it, in order and without gaps
+	const size_t numQuads = 40;
+	float verts[numQuads * 4 * 3];
+	unsigned int many[numQuads * 6];
+	for(size_t q = 0; q < numQuads; q++)
+	{
+		float quad[12] = {(float)q, 0, 0, (float)q + 1, 0, 0, (float)q + 1, 1, 0, (float)q, 1, 0};
+		memcpy(&verts[q * 12], quad, sizeof(quad));
+		unsigned int b = (unsigned int)q * 4;
+		unsigned int tris[6] = {b, b + 1, b + 2, b, b + 2, b + 3};
+		memcpy(&many[q * 6], tris, sizeof(tris));
+	}
+	n = countMeshlets(many, numQuads * 6, numQuads * 4);
+	meshlet split[8];
+	bool fits = n == 3 && buildMeshlets(split, many, numQuads * 6, verts, numQuads * 4) == n;
+	for(size_t i = 0; fits && i < n; i++)
+	{
+		fits = split[i].firstInd == (i == 0 ? 0 : split[i - 1].firstInd + split[i - 1].numInd) &&
+			split[i].numInd / 3 * 2 <= MESHLET_MAX_VERTS;
+	}
+	check(fits && split[n - 1].firstInd + split[n - 1].numInd == numQuads * 6,
+		"160 vertices split into 3 meshlets of at most 64 back to back");
+}
+
+static void testFrustum()
+{
+	float mvp[16], planes[6][4];
+	ortho(-1.0f, 1.0f, -1.0f, 1.0f, 0.1f, 10.0f, mvp);
+	frustumPlanes(mvp, planes);
+	//the planes face in, so the middle of the box is in front of all six
+	bool facingIn = true;
+	for(int p = 0; p < 6; p++)
+	{
+		if(planes[p][2] * -5.0f + planes[p][3] <= 0.0f)
+			facingIn = false;
+	}
+	check(facingIn, "every plane of an ortho frustum faces in");
+
+	meshlet ml[7];
+	ml[0] = sphereMeshlet(3.0f, 0.0f, -5.0f, 0.5f, 0); //right of the box
+	ml[1] = sphereMeshlet(-3.0f, 0.0f, -5.0f, 0.5f, 3); //left
+	ml[2] = sphereMeshlet(0.0f, 3.0f, -5.0f, 0.5f, 6); //above
+	ml[3] = sphereMeshlet(0.0f, -3.0f, -5.0f, 0.5f, 9); //below
+	ml[4] = sphereMeshlet(0.0f, 0.0f, 1.0f, 0.5f, 12); //behind the near plane
+	ml[5] = sphereMeshlet(0.0f, 0.0f, -20.0f, 0.5f, 15); //past the far plane
+	ml[6] = sphereMeshlet(1.2f, 0.0f, -5.0f, 0.5f, 18); //its centre is outside but the sphere pokes in
+	const char* names[6] = {"right", "left", "top", "bottom", "near", "far"};
+	unsigned int first[7], count[7];
+	for(int i = 0; i < 6; i++)
+	{
+		cullStats cs;
+		memset(&cs, 0, sizeof(cs));
+		size_t ranges = cullMeshlets(&ml[i], 1, planes, NULL, first, count, cs);
+		char what[64];
+		sprintf(what, "a meshlet past the %s plane is culled", names[i]);
+		check(ranges == 0 && cs.frustumCulled == 1 && cs.trianglesCulled == 1, what);
+	}
+	cullStats cs;
+	memset(&cs, 0, sizeof(cs));
+	size_t ranges = cullMeshlets(&ml[6], 1, planes, NULL, first, count, cs);
+	check(ranges == 1 && cs.frustumCulled == 0, "a meshlet straddling a plane is kept");
+}
+
+static void testCones()
+{
+	//one quad facing +z towards a camera at the origin, and the same quad wound the other way
+	const float quad[12] = {-1, -1, -5, 1, -1, -5, 1, 1, -5, -1, 1, -5};
+	const unsigned int front[6] = {0, 1, 2, 0, 2, 3};
+	const unsigned int back[6] = {0, 2, 1, 0, 3, 2};
+	meshlet ml[2];
+	buildMeshlets(&ml[0], front, 6, quad, 4);
+	buildMeshlets(&ml[1], back, 6, quad, 4);
+	check(fabsf(ml[0].coneAxis[2] - 1.0f) < 1e-5f && ml[0].coneCutoff < 1e-3f, "a flat quad's cone is its normal");
+
+	float modelView[16], camPos[3], planes[6][4], mvp[16];
+	identity(modelView);
+	check(cameraPosition(modelView, camPos) && camPos[0] == 0.0f && camPos[1] == 0.0f && camPos[2] == 0.0f,
+		"an identity model view puts the camera at the origin");
+	ortho(-2.0f, 2.0f, -2.0f, 2.0f, 0.1f, 10.0f, mvp);
+	frustumPlanes(mvp, planes);
+	unsigned int first[2], count[2];
+	cullStats cs;
+	memset(&cs, 0, sizeof(cs));
+	size_t ranges = cullMeshlets(&ml[0], 1, planes, camPos, first, count, cs);
+	check(ranges == 1 && cs.backfaceCulled == 0, "a meshlet facing the camera is kept");
+	ranges = cullMeshlets(&ml[1], 1, planes, camPos, first, count, cs);
+	check(ranges == 0 && cs.backfaceCulled == 1, "a meshlet facing away from the camera is culled");
+	ranges = cullMeshlets(&ml[1], 1, planes, NULL, first, count, cs);
+	check(ranges == 1, "with no camera the backface test is skipped");
+
+	//moving the model 3 along x leaves the camera at -3 in model space
+	modelView[12] = 3.0f;
+	check(cameraPosition(modelView, camPos) && fabsf(camPos[0] + 3.0f) < 1e-5f, "the camera comes back in model space");
+}
+
+static void testRanges()
+{
+	float mvp[16], planes[6][4];
+	ortho(-10.0f, 10.0f, -10.0f, 10.0f, 0.1f, 10.0f, mvp);
+	frustumPlanes(mvp, planes);
+	meshlet ml[4];
+	for(unsigned int i = 0; i < 4; i++)
+	{
+		ml[i] = sphereMeshlet((float)i, 0.0f, -5.0f, 0.5f, i * 3);
+	}
+	unsigned int first[4], count[4];
+	cullStats cs;
+	memset(&cs, 0, sizeof(cs));
+	size_t ranges = cullMeshlets(ml, 4, planes, NULL, first, count, cs);
+	check(ranges == 1 && first[0] == 0 && count[0] == 12, "neighbouring survivors merge into one range");
+	check(cs.ranges == 1 && cs.meshlets == 4 && cs.triangles == 4, "the stats count what was considered");
+
+	//knock out the second, the first stays on its own and the last two join up
+	ml[1].centre[0] = 50.0f;
+	ranges = cullMeshlets(ml, 4, planes, NULL, first, count, cs);
+	check(ranges == 2 && first[0] == 0 && count[0] == 3 && first[1] == 6 && count[1] == 6,
+		"a culled meshlet splits the range around it");
+}
+
+int main()
+{
+	testBox();
+	testFrustum();
+	testCones();
+	testRanges();
+	printf("%s, %i failed\n", s_Failed ? "FAILED" : "all passed", s_Failed);
+	return s_Failed ? 1 : 0;
+}
@@ -0,0 +1,501 @@
+///		***
+///
+///		modelCache.cpp - reading and writing of the binary model cache
+///		A cache file is written after every cold load and is keyed on the source path, size, last write
+///		time and a hash of its contents. A warm load maps the file and points the mesh arrays straight into
+///		it, the skeleton and animations are copied out into their own small arrays.
+///		Reading the cache makes no GL calls, uploadModel does that once the model is parsed.
+///
+///		***
+
+#include "modelLoader.h"
+
+//walks a mapped cache file, every read is bounds checked so a truncated or corrupt file just fails the load
+struct cacheReader{
+	const char* base;
+	size_t pos, size;
+	bool ok;
+	cacheReader(const char* b, size_t s) : base(b), pos(0), size(s), ok(true) {}
+
+	//copies len bytes out of the file
+	void read(void* dst, size_t len)
+	{
+		if(!ok || len > size - pos){ ok = false; return; }
+		memcpy(dst, base + pos, len);
+		pos += len;
+	}
+
+	//returns a pointer to an aligned array inside the mapping, nothing is copied
+	const void* take(size_t len)
+	{
+		size_t aligned = (pos + MODEL_CACHE_ALIGN - 1) & ~(size_t)(MODEL_CACHE_ALIGN - 1);
+		if(!ok || aligned > size || len > size - aligned){ ok = false; return NULL; }
+		pos = aligned + len;
+		return base + aligned;
+	}
+
+	string str(unsigned int len)
+	{
+		if(!ok || len > size - pos){ ok = false; return string(); }
+		string s(base + pos, len);
+		pos += len;
+		return s;
+	}
+
+	string str()
+	{
+		unsigned int len = 0;
+		read(&len, sizeof(len));
+		return str(len);
+	}
+
+	//guards the allocation of count elements against a corrupt count
+	bool plausible(unsigned int count)
+	{
+		if(count > size - pos) ok = false;
+		return ok;
+	}
+};
+
+//the mirror of cacheReader, arrays are padded out so they land on MODEL_CACHE_ALIGN in the file
+struct cacheWriter{
+	FILE* f;
+	size_t pos;
+	cacheWriter(FILE* file) : f(file), pos(0) {}
+
+	void write(const void* src, size_t len)
+	{
+		if(len > 0) fwrite(src, 1, len, f);
+		pos += len;
+	}
+
+	void put(const void* src, size_t len)
+	{
+		static const char zero[MODEL_CACHE_ALIGN] = {0};
+		write(zero, (MODEL_CACHE_ALIGN - pos % MODEL_CACHE_ALIGN) % MODEL_CACHE_ALIGN);
+		write(src, len);
+	}
+
+	void str(const string& s)
+	{
+		unsigned int len = (unsigned int)s.size();
+		write(&len, sizeof(len));
+		write(s.data(), len);
+	}
+};
+
+//64 bit FNV-1a, pass a previous result as the seed to hash several blocks as one
+unsigned long long hashBytes(const void* data, size_t len, unsigned long long seed)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	unsigned long long h = seed;
+	for(size_t i = 0; i < len; i++)
+	{
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+bool hashFile(const char* path, unsigned long long& hash)
+{
+	unsigned long long size, time;
+	if(!getFileStamp(path, size, time))
+		return false;
+	hash = hashBytes(NULL, 0);
+	if(size == 0)
+		return true;
+	fileMapping fm;
+	if(!mapFile(path, fm, false))
+		return false;
+	hash = hashBytes(fm.view, fm.size);
+	unmapFile(fm);
+	return true;
+}
+
+//every source file and profile gets its own cache file, named after a hash of the path
+string cachePathFor(const string& dir, const char* file, unsigned int profile)
+{
+	char name[48];
+	sprintf(name, "%016llx-%u.mlc", hashBytes(file, strlen(file)), profile);
+	return dir + "/" + name;
+}
+
+//copies count elements of an aligned array in the file into v
+template<class T>
+static void readArray(cacheReader& rd, vector<T>& v, unsigned int count)
+{
+	v.clear();
+	const T* src = (const T*)rd.take(sizeof(T) * count);
+	if(src && count > 0)
+		v.assign(src, src + count);
+}
+
+template<class T>
+static void writeArray(cacheWriter& wr, const vector<T>& v)
+{
+	wr.put(v.empty() ? NULL : &v[0], sizeof(T) * v.size());
+}
+
+//the skeleton is stored exactly as it is held in memory: the flattened nodes, then each clip's channels
+static void readSkeleton(cacheReader& rd, skeleton& sk, unsigned int numNodes, unsigned int numAnims, unsigned int numBones)
+{
+	sk.clear();
+	if(!rd.plausible(numNodes) || !rd.plausible(numAnims))
+		return;
+	sk.nodes.resize(numNodes);
+	for(unsigned int i = 0; i < numNodes && rd.ok; i++)
+	{
+		skelNode& node = sk.nodes[i];
+		node.name = rd.str();
+		rd.read(&node.parent, sizeof(node.parent));
+		rd.read(&node.bone, sizeof(node.bone));
+		rd.read(node.bind.m, sizeof(node.bind.m));
+		//parents always come first and bones index m_BoneInfo, anything else means the file is damaged
+		if(node.parent >= (int)i || node.bone < -1 || node.bone >= (int)numBones)
+			rd.ok = false;
+	}
+	sk.anims.resize(numAnims);
+	for(unsigned int a = 0; a < numAnims && rd.ok; a++)
+	{
+		animClip& clip = sk.anims[a];
+		clip.name = rd.str();
+		rd.read(&clip.duration, sizeof(clip.duration));
+		rd.read(&clip.ticksPerSec, sizeof(clip.ticksPerSec));
+		unsigned int numChannels = 0;
+		rd.read(&numChannels, sizeof(numChannels));
+		if(!rd.plausible(numChannels))
+			break;
+		clip.channels.resize(numChannels);
+		for(unsigned int c = 0; c < numChannels && rd.ok; c++)
+		{
+			animChannel& ch = clip.channels[c];
+			rd.read(&ch.node, sizeof(ch.node));
+			unsigned int counts[3] = {0, 0, 0};
+			rd.read(counts, sizeof(counts));
+			if(ch.node < 0 || ch.node >= (int)numNodes)
+				rd.ok = false;
+			readArray(rd, ch.posTimes, counts[0]);
+			readArray(rd, ch.pos, counts[0]);
+			readArray(rd, ch.rotTimes, counts[1]);
+			readArray(rd, ch.rot, counts[1]);
+			readArray(rd, ch.scaleTimes, counts[2]);
+			readArray(rd, ch.scale, counts[2]);
+		}
+	}
+	sk.linkChannels();
+}
+
+static void writeSkeleton(cacheWriter& wr, const skeleton& sk)
+{
+	for(size_t i = 0; i < sk.nodes.size(); i++)
+	{
+		const skelNode& node = sk.nodes[i];
+		wr.str(node.name);
+		wr.write(&node.parent, sizeof(node.parent));
+		wr.write(&node.bone, sizeof(node.bone));
+		wr.write(node.bind.m, sizeof(node.bind.m));
+	}
+	for(size_t a = 0; a < sk.anims.size(); a++)
+	{
+		const animClip& clip = sk.anims[a];
+		wr.str(clip.name);
+		wr.write(&clip.duration, sizeof(clip.duration));
+		wr.write(&clip.ticksPerSec, sizeof(clip.ticksPerSec));
+		unsigned int numChannels = (unsigned int)clip.channels.size();
+		wr.write(&numChannels, sizeof(numChannels));
+		for(size_t c = 0; c < clip.channels.size(); c++)
+		{
+			const animChannel& ch = clip.channels[c];
+			wr.write(&ch.node, sizeof(ch.node));
+			unsigned int counts[3] = {(unsigned int)ch.pos.size(), (unsigned int)ch.rot.size(), (unsigned int)ch.scale.size()};
+			wr.write(counts, sizeof(counts));
+			writeArray(wr, ch.posTimes);
+			writeArray(wr, ch.pos);
+			writeArray(wr, ch.rotTimes);
+			writeArray(wr, ch.rot);
+			writeArray(wr, ch.scaleTimes);
+			writeArray(wr, ch.scale);
+		}
+	}
+}
+
+bool modelLoader::readCache(const char* file, importProfile profile, model*& out)
+{
+	out = NULL;
+	if(m_CacheDir.empty())
+		return false;
+	unsigned long long size, time;
+	if(!getFileStamp(file, size, time))
+		return false;
+	fileMapping* fm = new fileMapping;
+	if(!mapFile(cachePathFor(m_CacheDir, file, profile).c_str(), *fm, true))
+	{
+		delete fm;
+		return false;
+	}
+
+	cacheReader rd(fm->view, fm->size);
+	cacheHeader hdr;
+	rd.read(&hdr, sizeof(hdr));
+	bool valid = rd.ok && hdr.magic == MODEL_CACHE_MAGIC && hdr.version == MODEL_CACHE_VERSION
+		&& hdr.key.srcSize == size && hdr.key.profile == (unsigned int)profile && rd.str(hdr.pathLen) == file;
+	//the source has been touched since the cache was written, it is only stale if the contents changed too
+	if(valid && hdr.key.srcTime != time)
+	{
+		unsigned long long hash;
+		valid = hashFile(file, hash) && hash == hdr.key.srcHash;
+	}
+	if(!valid)
+	{
+		unmapFile(*fm);
+		delete fm;
+		return false;
+	}
+
+	model* theModel = newModel(file);
+	theModel->profile = profile;
+	theModel->numMesh = hdr.numMesh;
+	theModel->numMat = hdr.numMat;
+	theModel->cache = fm;
+	for(size_t i = 0; i < hdr.numMesh && rd.ok; i++)
+	{
+		cacheMesh cm;
+		rd.read(&cm, sizeof(cm));
+		sMesh theMesh;
+		theMesh.vao = theMesh.ibo = theMesh.nbo = theMesh.vbo = theMesh.tbo = theMesh.bbo = 0;
+		theMesh.numFaces = cm.numFaces;
+		theMesh.numInd = cm.numInd;
+		theMesh.numVert = cm.numVert;
+		theMesh.indexType = theMesh.numVert <= MAX_SHORT_VERTS ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		theMesh.matInd = cm.matInd;
+		theMesh.hasNorm = cm.hasNorm != 0;
+		theMesh.hasTexCoords = cm.hasTexCoords != 0;
+		theMesh.hasBones = cm.hasBones != 0;
+		theMesh.hasTangents = cm.hasTangents != 0;
+		theMesh.baseVert = cm.baseVert;
+		theMesh.baseInd = cm.baseInd;
+		theMesh.packed = NULL;
+		theMesh.stride = 0;
+		theMesh.hash = 0;
+		theMesh.shared = false;
+		theMesh.quantized = theMesh.octNorm8 = false;
+		theMesh.numLods = cm.numLods < MAX_LODS ? cm.numLods : MAX_LODS;
+		theMesh.numLodInd = cm.numLodInd;
+		memcpy(theMesh.lodFirst, cm.lodFirst, sizeof(theMesh.lodFirst));
+		memcpy(theMesh.lodCount, cm.lodCount, sizeof(theMesh.lodCount));
+		memcpy(theMesh.lodError, cm.lodError, sizeof(theMesh.lodError));
+		theMesh.lodBase = cm.numInd;
+		theMesh.lod = 0;
+		theMesh.numMeshlets = cm.numMeshlets;
+		theMesh.depthVao = 0;
+		theMesh.shadowIndexes = NULL;
+		theMesh.shadowVerts = 0;
+		theMesh.shadowBase = 0;
+		//these point straight into the mapped file, freeModel knows not to free them
+		theMesh.indexes = (GLuint*)rd.take(sizeof(GLuint) * cm.numInd);
+		theMesh.verts = (GLfloat*)rd.take(sizeof(GLfloat) * 3 * cm.numVert);
+		theMesh.normals = theMesh.hasNorm ? (GLfloat*)rd.take(sizeof(GLfloat) * 3 * cm.numVert) : NULL;
+		theMesh.texCoords = theMesh.hasTexCoords ? (GLfloat*)rd.take(sizeof(GLfloat) * 2 * cm.numVert) : NULL;
+		theMesh.tangents = theMesh.hasTangents ? (GLshort*)rd.take(sizeof(GLshort) * 4 * cm.numVert) : NULL;
+		theMesh.lodIndexes = cm.numLodInd > 0 ? (GLuint*)rd.take(sizeof(GLuint) * cm.numLodInd) : NULL;
+		theMesh.meshlets = cm.numMeshlets > 0 ? (meshlet*)rd.take(sizeof(meshlet) * cm.numMeshlets) : NULL;
+		for(size_t l = 0; l < theMesh.numLods; l++)
+		{
+			if(cm.lodFirst[l] > cm.numLodInd || cm.lodCount[l] > cm.numLodInd - cm.lodFirst[l])
+				rd.ok = false;
+		}
+		for(size_t c = 0; theMesh.meshlets && c < cm.numMeshlets; c++)
+		{
+			if(theMesh.meshlets[c].firstInd > cm.numInd || theMesh.meshlets[c].numInd > cm.numInd - theMesh.meshlets[c].firstInd)
+				rd.ok = false;
+		}
+		//everything after this indexes other arrays with these without checking
+		for(size_t j = 0; theMesh.indexes && j < cm.numInd && rd.ok; j++)
+		{
+			if(theMesh.indexes[j] >= cm.numVert)
+				rd.ok = false;
+		}
+		for(size_t j = 0; theMesh.lodIndexes && j < cm.numLodInd && rd.ok; j++)
+		{
+			if(theMesh.lodIndexes[j] >= cm.numVert)
+				rd.ok = false;
+		}
+		if(cm.matInd >= hdr.numMat)
+			rd.ok = false;
+		theModel->vMesh.push_back(theMesh);
+	}
+
+	if(hdr.numVertBones > 0)
+	{
+		const vBoneData* vb = (const vBoneData*)rd.take(sizeof(vBoneData) * hdr.numVertBones);
+		if(vb) theModel->vBones.assign(vb, vb + hdr.numVertBones);
+	}
+	//a skinned mesh's bone data is at its baseVert in there
+	for(size_t i = 0; i < theModel->vMesh.size() && rd.ok; i++)
+	{
+		const sMesh& theMesh = theModel->vMesh[i];
+		if(theMesh.hasBones && (theMesh.baseVert > theModel->vBones.size() ||
+			theMesh.numVert > theModel->vBones.size() - theMesh.baseVert))
+			rd.ok = false;
+	}
+
+	for(size_t i = 0; i < hdr.numMat && rd.ok; i++)
+	{
+		cacheMat cmat;
+		rd.read(&cmat, sizeof(cmat));
+		mat theMat;
+		memcpy(theMat.diff, cmat.diff, sizeof(GLfloat)*4);
+		memcpy(theMat.amb, cmat.amb, sizeof(GLfloat)*4);
+		memcpy(theMat.spec, cmat.spec, sizeof(GLfloat)*4);
+		memcpy(theMat.emis, cmat.emis, sizeof(GLfloat)*4);
+		theMat.shininess = cmat.shininess;
+		theMat.matTex = theMat.matNorm = 0;
+		theMat.texPath = rd.str(cmat.texLen);
+		theMat.normPath = rd.str(cmat.normLen);
+		theModel->vMat.push_back(theMat);
+	}
+
+	//the bones belong to this model only, exactly as they do on a cold load
+	resetBones();
+	for(size_t i = 0; i < hdr.numBones && rd.ok; i++)
+	{
+		string bName = rd.str();
+		boneInfo bi;
+		rd.read(bi.boneOffset.m, sizeof(bi.boneOffset.m));
+		m_BoneInfo.push_back(bi);
+		m_Bonemapping[bName] = i;
+		numBones++;
+	}
+	memcpy(m_GlobalInverseTransform.m, hdr.globalInverse, sizeof(hdr.globalInverse));
+
+	readSkeleton(rd, m_Skeleton, hdr.numNodes, hdr.numAnims, hdr.numBones);
+
+	if(!rd.ok)
+	{
+		printf("ERROR, model cache for %s is corrupt, reimporting\n", file);
+		resetBones();
+		unmapFile(*fm);
+		delete fm;
+		free(theModel->cPath);
+		delete theModel;
+		return false;
+	}
+
+	for(size_t i = 0; i < theModel->vMat.size(); i++)
+	{
+		decodeMatTextures(theModel->vMat[i]);
+	}
+	out = theModel;
+	return true;
+}
+
+void modelLoader::writeCache(model* m, const char* file)
+{
+	if(m_CacheDir.empty())
+		return;
+	cacheHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = MODEL_CACHE_MAGIC;
+	hdr.version = MODEL_CACHE_VERSION;
+	if(!getFileStamp(file, hdr.key.srcSize, hdr.key.srcTime) || !hashFile(file, hdr.key.srcHash))
+		return;
+	hdr.key.profile = m->profile;
+	hdr.pathLen = (unsigned int)strlen(file);
+	hdr.numMesh = m->numMesh;
+	hdr.numMat = (unsigned int)m->vMat.size();
+	hdr.numBones = (unsigned int)numBones;
+	hdr.numVertBones = (unsigned int)m->vBones.size();
+	hdr.numNodes = (unsigned int)m_Skeleton.nodes.size();
+	hdr.numAnims = (unsigned int)m_Skeleton.anims.size();
+	memcpy(hdr.globalInverse, m_GlobalInverseTransform.m, sizeof(hdr.globalInverse));
+
+	CreateDirectoryA(m_CacheDir.c_str(), NULL);
+	string cPath = cachePathFor(m_CacheDir, file, m->profile);
+	//write to a temporary file and swap it in, so a crash half way never leaves a broken cache behind. The name is
+	//this thread's own, two workers loading the same file would otherwise interleave their writes in one file
+	char tmpName[64];
+	sprintf(tmpName, ".%lu-%lu.tmp", (unsigned long)GetCurrentProcessId(), (unsigned long)GetCurrentThreadId());
+	string tmpPath = cPath + tmpName;
+	FILE* f = fopen(tmpPath.c_str(), "wb");
+	if(!f)
+	{
+		printf("ERROR, could not write model cache %s\n", cPath.c_str());
+		return;
+	}
+
+	cacheWriter wr(f);
+	wr.write(&hdr, sizeof(hdr));
+	wr.write(file, hdr.pathLen);
+	for(size_t i = 0; i < m->numMesh; i++)
+	{
+		const sMesh& theMesh = m->vMesh[i];
+		cacheMesh cm;
+		cm.numFaces = theMesh.numFaces;
+		cm.numInd = theMesh.numInd;
+		cm.numVert = theMesh.numVert;
+		cm.matInd = theMesh.matInd;
+		cm.hasNorm = theMesh.hasNorm;
+		cm.hasTexCoords = theMesh.hasTexCoords;
+		cm.hasBones = theMesh.hasBones;
+		cm.hasTangents = theMesh.hasTangents;
+		cm.baseVert = (unsigned int)theMesh.baseVert;
+		cm.baseInd = (unsigned int)theMesh.baseInd;
+		cm.numLods = theMesh.numLods;
+		cm.numLodInd = theMesh.numLodInd;
+		memcpy(cm.lodFirst, theMesh.lodFirst, sizeof(cm.lodFirst));
+		memcpy(cm.lodCount, theMesh.lodCount, sizeof(cm.lodCount));
+		memcpy(cm.lodError, theMesh.lodError, sizeof(cm.lodError));
+		cm.numMeshlets = theMesh.meshlets ? theMesh.numMeshlets : 0;
+		cm.pad = 0;
+		wr.write(&cm, sizeof(cm));
+		wr.put(theMesh.indexes, sizeof(GLuint) * theMesh.numInd);
+		wr.put(theMesh.verts, sizeof(GLfloat) * 3 * theMesh.numVert);
+		if(theMesh.hasNorm) wr.put(theMesh.normals, sizeof(GLfloat) * 3 * theMesh.numVert);
+		if(theMesh.hasTexCoords) wr.put(theMesh.texCoords, sizeof(GLfloat) * 2 * theMesh.numVert);
+		if(theMesh.hasTangents) wr.put(theMesh.tangents, sizeof(GLshort) * 4 * theMesh.numVert);
+		if(theMesh.numLodInd > 0) wr.put(theMesh.lodIndexes, sizeof(GLuint) * theMesh.numLodInd);
+		if(cm.numMeshlets > 0) wr.put(theMesh.meshlets, sizeof(meshlet) * cm.numMeshlets);
+	}
+
+	if(hdr.numVertBones > 0)
+		wr.put(&m->vBones[0], sizeof(vBoneData) * hdr.numVertBones);
+
+	for(size_t i = 0; i < m->vMat.size(); i++)
+	{
+		const mat& theMat = m->vMat[i];
+		cacheMat cmat;
+		memcpy(cmat.diff, theMat.diff, sizeof(GLfloat)*4);
+		memcpy(cmat.amb, theMat.amb, sizeof(GLfloat)*4);
+		memcpy(cmat.spec, theMat.spec, sizeof(GLfloat)*4);
+		memcpy(cmat.emis, theMat.emis, sizeof(GLfloat)*4);
+		cmat.shininess = theMat.shininess;
+		cmat.texLen = (unsigned int)theMat.texPath.size();
+		cmat.normLen = (unsigned int)theMat.normPath.size();
+		wr.write(&cmat, sizeof(cmat));
+		wr.write(theMat.texPath.data(), cmat.texLen);
+		wr.write(theMat.normPath.data(), cmat.normLen);
+	}
+
+	//bones are written in index order, so the per vertex IDs stay valid when read back
+	vector<string> boneNames(numBones);
+	for(map<string, size_t>::const_iterator it = m_Bonemapping.begin(); it != m_Bonemapping.end(); it++)
+	{
+		boneNames[it->second] = it->first;
+	}
+	for(size_t i = 0; i < numBones; i++)
+	{
+		wr.str(boneNames[i]);
+		wr.write(m_BoneInfo[i].boneOffset.m, sizeof(m_BoneInfo[i].boneOffset.m));
+	}
+
+	writeSkeleton(wr, m_Skeleton);
+
+	bool failed = ferror(f) != 0;
+	fclose(f);
+	if(failed || !MoveFileExA(tmpPath.c_str(), cPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		printf("ERROR, could not write model cache %s\n", cPath.c_str());
+		DeleteFileA(tmpPath.c_str());
+	}
+}
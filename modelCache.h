@@ -0,0 +1,63 @@
+///		***
+///
+///		modelCache.h - binary model cache file layout and file helpers
+///		The cache holds the post processed output of loadVert, loadMat, loadBones and the
+///		skeleton/animation data so that a warm load can map the file and skip ASSIMP entirely.
+///
+///		***
+
+#ifndef MODELCACHE_H
+#define MODELCACHE_H
+
+#include <Windows.h>
+#include <string>
+#include "mappedIO.h"
+#include "meshSimplify.h"
+#include "meshlet.h"
+
+using namespace std;
+
+#define MODEL_CACHE_MAGIC 0x31434C4D //"MLC1"
+#define MODEL_CACHE_VERSION 9 //bump this whenever any of the structs below change
+#define MODEL_CACHE_ALIGN 16 //every array in the file starts on this boundary so it can be used in place
+
+//identifies the exact source file a cache entry was built from
+struct cacheKey{
+	unsigned long long srcSize;
+	unsigned long long srcTime; //last write time of the source file
+	unsigned long long srcHash; //FNV-1a hash of the source file contents
+	unsigned int profile; //the importProfile the cached data was imported with
+	unsigned int pad;
+};
+
+//the header at the very start of every cache file
+struct cacheHeader{
+	unsigned int magic, version;
+	cacheKey key;
+	unsigned int pathLen, numMesh, numMat, numBones, numVertBones, numNodes, numAnims;
+	float globalInverse[4][4];
+};
+
+//one of these per mesh, followed by the index, vertex, normal, texture coord, tangent, LOD index and meshlet arrays
+struct cacheMesh{
+	unsigned int numFaces, numInd, numVert, matInd;
+	unsigned int hasNorm, hasTexCoords, hasBones, hasTangents;
+	unsigned int baseVert, baseInd;
+	unsigned int numLods, numLodInd;
+	unsigned int lodFirst[MAX_LODS], lodCount[MAX_LODS];
+	float lodError[MAX_LODS];
+	unsigned int numMeshlets, pad;
+};
+
+//one of these per material, followed by the diffuse and normal texture paths
+struct cacheMat{
+	float diff[4], amb[4], spec[4], emis[4];
+	float shininess;
+	unsigned int texLen, normLen;
+};
+
+unsigned long long hashBytes(const void* data, size_t len, unsigned long long seed = 14695981039346656037ULL);
+bool hashFile(const char* path, unsigned long long& hash);
+string cachePathFor(const string& dir, const char* file, unsigned int profile);
+
+#endif
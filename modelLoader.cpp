@@ -10,8 +10,12 @@
 
 
 #include "modelLoader.h"
+#include "assimp\DefaultLogger.hpp"
+#include "assimp\LogStream.hpp"
+#include <Psapi.h>
+#pragma comment(lib, "psapi.lib")
 
-// the current aiProcess Preset implements all of these processes as default
+// the runtime profile's aiProcess Preset implements all of these processes as default
 //
 //  aiProcess_CalcTangentSpace				//Calculates the tangents and bitangents 
 //  aiProcess_GenSmoothNormals				//Generates smooth normals for all vertices 
@@ -26,35 +30,364 @@
 //  aiProcess_FindDegenerates				//Finds any degenerate primitives and converts them to proper lines or points
 //  aiProcess_FindInvalidData				//removes or fixes any invalid normal vectors or UV coords
 
+//everything an import profile changes about how ASSIMP processes a file
+struct profileSettings{
+	const char* name;
+	unsigned int flags; //aiProcess_ post processing steps
+	int slmVertexLimit; //AI_CONFIG_PP_SLM_VERTEX_LIMIT, only used if aiProcess_SplitLargeMeshes is set
+	int iclCacheSize; //AI_CONFIG_PP_ICL_PTCACHE_SIZE, only used if aiProcess_ImproveCacheLocality is set
+	bool favourSpeed; //AI_CONFIG_FAVOUR_SPEED
+	bool optimize; //run optimizeMeshes, which takes the place of aiProcess_ImproveCacheLocality
+	bool lods; //run buildLods
+	bool clusters; //run buildClusters
+};
+
+//indexed by importProfile. Preview keeps only what loadVert can't do without: triangles, some kind of normal
+//and at most 4 bones per vertex. Offline bake adds the MaxQuality steps and assumes a bigger vertex cache.
+static const profileSettings s_Profiles[numProfiles] = {
+	{"preview", aiProcess_Triangulate | aiProcess_SortByPType | aiProcess_GenNormals | aiProcess_LimitBoneWeights,
+		AI_SLM_DEFAULT_MAX_VERTICES, PP_ICL_PTCACHE_SIZE, true, false, false, false},
+	{"runtime", aiProcessPreset_TargetRealtime_Quality, AI_SLM_DEFAULT_MAX_VERTICES, PP_ICL_PTCACHE_SIZE, false, true, true, true},
+	{"offline-bake", aiProcessPreset_TargetRealtime_MaxQuality, AI_SLM_DEFAULT_MAX_VERTICES, 24, false, true, true, true}
+};
+
+//sets up importer for profile and returns the post processing flags to import with
+static unsigned int applyProfile(Assimp::Importer& importer, importProfile profile)
+{
+	const profileSettings& ps = s_Profiles[profile];
+	importer.SetPropertyInteger(AI_CONFIG_PP_SLM_VERTEX_LIMIT, ps.slmVertexLimit);
+	importer.SetPropertyInteger(AI_CONFIG_PP_ICL_PTCACHE_SIZE, ps.iclCacheSize);
+	importer.SetPropertyBool(AI_CONFIG_FAVOUR_SPEED, ps.favourSpeed);
+	//loadVert only understands triangles, so drop any point and line meshes SortByPType splits off
+	importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, aiPrimitiveType_POINT | aiPrimitiveType_LINE);
+	//no point ASSIMP ordering the triangles just for optimizeMeshes to do it again
+	return ps.optimize ? ps.flags & ~aiProcess_ImproveCacheLocality : ps.flags;
+}
+
+//how much of a load's progress each stage accounts for
+#define PROGRESS_IMPORT 0.5f
+#define PROGRESS_VERT 0.3f
+#define PROGRESS_MAT 0.15f
+
+//forwards ASSIMP's progress to a load request and aborts the import as soon as the request is cancelled
+class requestProgress : public Assimp::ProgressHandler{
+public:
+	requestProgress(loadRequest* r) : m_Request(r) {}
+	bool Update(float percentage)
+	{
+		if(percentage >= 0.0f)
+			m_Request->progress = (percentage < 1.0f ? percentage : 1.0f) * PROGRESS_IMPORT;
+		return !m_Request->cancelled;
+	}
+private:
+	loadRequest* m_Request;
+};
+
+static LARGE_INTEGER timeNow()
+{
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return t;
+}
+
+static double secondsSince(const LARGE_INTEGER& start)
+{
+	LARGE_INTEGER freq, end;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&end);
+	return (double)(end.QuadPart - start.QuadPart) / (double)freq.QuadPart;
+}
+
+//keeps the lines ASSIMP's profiler logs when AI_CONFIG_GLOB_MEASURE_TIME is on ("END   `Total`, dt= 0.1 s")
+class timingLogStream : public Assimp::LogStream{
+public:
+	timingLogStream(vector<string>& out) : m_Out(out) {}
+	void write(const char* message)
+	{
+		string line(message);
+		if(line.find("dt=") == string::npos)
+			return;
+		while(!line.empty() && (line[line.size() - 1] == '\n' || line[line.size() - 1] == '\r'))
+			line.erase(line.size() - 1);
+		m_Out.push_back(line);
+	}
+private:
+	vector<string>& m_Out;
+};
+
+//ASSIMP's logger is one per process, so only one import at a time gets to listen to it
+static mutex s_LoggerLock;
+
 //struct method definition
-void vBoneData::addBoneData(size_t bID, float w)
+//packs a vertex's bones and weights, renormalizing the weights so the bytes add up to exactly 255. Each weight
+//is rounded down and what that loses goes one at a time to the weights that lost the most.
+void vBoneData::setBones(const size_t* bIDs, const float* w)
 {
-	for(size_t i = 0; i < sizeof(IDs); i++)
+	reset();
+	float sum = 0.0f;
+	for(size_t i = 0; i < BONES_PER_VERTEX; i++)
 	{
-		if (weights[i]==0.0)
+		if(w[i] > 0.0f)
+			sum += w[i];
+	}
+	if(sum <= 0.0f)
+		return;
+	float rest[BONES_PER_VERTEX];
+	int total = 0;
+	for(size_t i = 0; i < BONES_PER_VERTEX; i++)
+	{
+		IDs[i] = (GLubyte)bIDs[i];
+		float f = w[i] > 0.0f ? w[i] / sum * 255.0f : 0.0f;
+		weights[i] = (GLubyte)f;
+		rest[i] = f - weights[i];
+		total += weights[i];
+	}
+	for(; total < 255; total++)
+	{
+		size_t most = 0;
+		for(size_t i = 1; i < BONES_PER_VERTEX; i++)
 		{
-			IDs[i]		= bID;
-			weights[i]	= w;
-			return;
+			if(rest[i] > rest[most])
+				most = i;
 		}
+		weights[most]++;
+		rest[most] = -1.0f;
 	}
-	//we should never see this place as it infers we have more bones than we allocated space for =)
-	assert(0);
 }
 
-model* modelLoader::loadModel(char* file){
-	theScene = aiImportFile(file, aiProcessPreset_TargetRealtime_Quality);
-	if(!theScene){
-		//print->error("reading mesh ", file, 4);
-		printf("ERROR reading mesh - %s", file);
-		exit(1);
+//a vertex's bones while loadBones gathers them, at full precision until they are packed
+struct rawBones{
+	size_t IDs[BONES_PER_VERTEX];
+	float weights[BONES_PER_VERTEX];
+	rawBones()
+	{
+		for(size_t i = 0; i < BONES_PER_VERTEX; i++)
+		{
+			IDs[i] = 0;
+			weights[i] = 0.0f;
+		}
 	}
-	//check that the scene has at least one mesh, though it may contain more!
-	assert(theScene->mNumMeshes>0);
+	//aiProcess_LimitBoneWeights keeps it to BONES_PER_VERTEX, but if a file gets past that the weakest goes
+	void add(size_t bID, float w)
+	{
+		size_t weakest = 0;
+		for(size_t i = 0; i < BONES_PER_VERTEX; i++)
+		{
+			if(weights[i] < weights[weakest])
+				weakest = i;
+		}
+		if(w <= weights[weakest])
+			return;
+		IDs[weakest] = bID;
+		weights[weakest] = w;
+	}
+};
 
+modelLoader::modelLoader()
+{
+	numBones = 0;
+	m_CacheDir = "modelCache";
+	m_MappedIO = true;
+	m_Request = NULL;
+	m_Stats = NULL;
+	m_MeasureTime = false;
+	m_Quit = false;
+	m_NumWorkers = 0;
+	m_LodThreads = 0;
+	m_RegHits = m_RegMisses = 0;
+	m_WatchQuit = NULL;
+	m_Dedup = true;
+	m_Interleave = false;
+	m_Quantize = false;
+	m_QuantNorm8 = true;
+	m_SingleBuffer = false;
+	m_Pool = false;
+	m_Retain = retainAll;
+	m_LodPixels = 0.0f;
+	m_LodPixelsPerUnit = 0.0f;
+	m_ClusterCull = false;
+	m_CullBackfaces = true;
+	memset(&m_CullStats, 0, sizeof(m_CullStats));
+	m_DepthStream = false;
+}
+
+modelLoader::~modelLoader()
+{
+	stopWatching();
+	{
+		lock_guard<mutex> lock(m_JobLock);
+		m_Quit = true;
+	}
+	m_JobSignal.notify_all();
+	for(size_t i = 0; i < m_Workers.size(); i++)
+	{
+		m_Workers[i].join();
+	}
+	//anything still in flight will never finish now
+	for(size_t i = 0; i < m_Jobs.size(); i++)
+	{
+		delete m_Jobs[i]->parser;
+		m_Jobs[i]->parser = NULL;
+		m_Jobs[i]->state = loadFailed;
+	}
+	modelHandle h;
+	while(m_Uploads.pop(h))
+	{
+		discardModel(h->result);
+		h->result = NULL;
+		SOIL_free_image_data(h->texImg.pixels);
+		h->texImg.pixels = NULL;
+		delete h->parser;
+		h->parser = NULL;
+		h->state = loadFailed;
+	}
+}
+
+//sets the directory the binary model cache lives in, pass NULL or "" to turn the cache off
+void modelLoader::setCacheDir(const char* dir)
+{
+	lock_guard<mutex> lock(m_JobLock);
+	m_CacheDir = dir ? dir : "";
+}
+
+//picks between reading files through memory mapping (the default) or ASSIMP's and SOIL's own stdio code
+void modelLoader::setMappedIO(bool mapped)
+{
+	lock_guard<mutex> lock(m_JobLock);
+	m_MappedIO = mapped;
+}
+
+//models and textures are looked up in every mounted pack (in the order they were mounted) before the disk
+bool modelLoader::mountPack(const char* path)
+{
+	shared_ptr<assetPack> pack(new assetPack);
+	if(!pack->open(path))
+		return false;
+	{
+		lock_guard<mutex> lock(m_JobLock);
+		m_Packs.push_back(pack);
+	}
+	printf("Mounted asset pack %s\n", path);
+	return true;
+}
+
+//forwards ASSIMP's own per step timings (AI_CONFIG_GLOB_MEASURE_TIME) into loadStats::assimpTimes.
+//The logger it listens on is global, so while this is on imports that want stats take turns.
+void modelLoader::setMeasureTime(bool measure)
+{
+	lock_guard<mutex> lock(m_JobLock);
+	m_MeasureTime = measure;
+}
+
+//starts recording a load into stats (which may be NULL) and zeroes it
+void modelLoader::beginStats(loadStats* stats)
+{
+	m_Stats = stats;
+	if(!m_Stats)
+		return;
+	m_Stats->fromCache = false;
+	m_Stats->cacheReadSecs = m_Stats->importSecs = m_Stats->vertSecs = m_Stats->matSecs = 0.0;
+	m_Stats->cacheWriteSecs = m_Stats->vaoSecs = m_Stats->texUploadSecs = m_Stats->totalSecs = 0.0;
+	m_Stats->indexBytes = m_Stats->vertBytes = m_Stats->normBytes = m_Stats->texCoordBytes = 0;
+	m_Stats->boneBytes = m_Stats->textureBytes = 0;
+	m_Stats->numMesh = m_Stats->numMat = m_Stats->numVert = m_Stats->numInd = m_Stats->numBones = 0;
+	m_Stats->geomBlocks = m_Stats->geomAllocs = 0;
+	m_Stats->textures.clear();
+	m_Stats->peakMemDelta = 0;
+	m_Stats->assimpTimes.clear();
+	m_Stats->quantErrors.clear();
+	m_Stats->meshOpt.clear();
+	m_Stats->lods.clear();
+	m_Stats->lodSecs = 0.0;
+	m_Stats->shadowWelded = 0;
+	PROCESS_MEMORY_COUNTERS pmc;
+	m_StatsMemBase = m_StatsPeakBase = 0;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+	{
+		m_StatsMemBase = pmc.PagefileUsage;
+		m_StatsPeakBase = pmc.PeakPagefileUsage;
+	}
+	m_StatsStart = timeNow();
+}
+
+//the CPU half of a load is done, fill in the totals
+void modelLoader::endStats()
+{
+	if(!m_Stats)
+		return;
+	m_Stats->totalSecs += secondsSince(m_StatsStart);
+	PROCESS_MEMORY_COUNTERS pmc;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+	{
+		long long delta;
+		if(pmc.PeakPagefileUsage > m_StatsPeakBase)
+			delta = (long long)pmc.PeakPagefileUsage - (long long)m_StatsMemBase;
+		else
+			delta = (long long)pmc.PagefileUsage - (long long)m_StatsMemBase;
+		if(delta > m_Stats->peakMemDelta)
+			m_Stats->peakMemDelta = delta;
+	}
+	m_Stats = NULL;
+}
+
+void modelLoader::printStats(const loadStats& ls)
+{
+	printf("Load took %.2fms%s (cache read %.2f, import %.2f, verts %.2f, materials %.2f, cache write %.2f, "
+		"VAOs %.2f, textures %.2f)\n", ls.totalSecs * 1000.0, ls.fromCache ? " from the cache" : "",
+		ls.cacheReadSecs * 1000.0, ls.importSecs * 1000.0, ls.vertSecs * 1000.0, ls.matSecs * 1000.0,
+		ls.cacheWriteSecs * 1000.0, ls.vaoSecs * 1000.0, ls.texUploadSecs * 1000.0);
+	printf("%u meshes, %u materials, %u vertices, %u indices, %u bones, peak memory +%lldKB\n",
+		(unsigned int)ls.numMesh, (unsigned int)ls.numMat, (unsigned int)ls.numVert, (unsigned int)ls.numInd,
+		(unsigned int)ls.numBones, ls.peakMemDelta / 1024);
+	if(ls.geomBlocks > 0)
+		printf("vertex arrays: %u allocations from %u heap blocks\n", (unsigned int)ls.geomAllocs, (unsigned int)ls.geomBlocks);
+	printf("uploaded %lluKB indices, %lluKB positions, %lluKB normals, %lluKB tex coords, %lluKB bones, %lluKB textures\n",
+		ls.indexBytes / 1024, ls.vertBytes / 1024, ls.normBytes / 1024, ls.texCoordBytes / 1024,
+		ls.boneBytes / 1024, ls.textureBytes / 1024);
+	for(size_t i = 0; i < ls.textures.size(); i++)
+	{
+		printf("  decoded %s (%ix%ix%i) in %.2fms\n", ls.textures[i].file.c_str(), ls.textures[i].width,
+			ls.textures[i].height, ls.textures[i].channels, ls.textures[i].decodeSecs * 1000.0);
+	}
+	for(size_t i = 0; i < ls.assimpTimes.size(); i++)
+	{
+		printf("  assimp: %s\n", ls.assimpTimes[i].c_str());
+	}
+	for(size_t i = 0; i < ls.meshOpt.size(); i++)
+	{
+		const meshOptStats& mo = ls.meshOpt[i];
+		printf("  mesh %u reordered in %u clusters, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", (unsigned int)mo.mesh,
+			(unsigned int)mo.clusters, mo.acmrBefore, mo.acmrAfter, mo.atvrBefore, mo.atvrAfter);
+	}
+	for(size_t i = 0; i < ls.lods.size(); i++)
+	{
+		const lodStats& lo = ls.lods[i];
+		printf("  mesh %u LOD %u: %u indices, error %g\n", (unsigned int)lo.mesh, (unsigned int)lo.level,
+			(unsigned int)lo.numInd, lo.error);
+	}
+	if(!ls.lods.empty())
+		printf("  LODs took %.2fms\n", ls.lodSecs * 1000.0);
+	if(ls.shadowWelded > 0)
+		printf("  depth stream welded %u seam vertices\n", (unsigned int)ls.shadowWelded);
+	for(size_t i = 0; i < ls.quantErrors.size(); i++)
+	{
+		const quantError& qe = ls.quantErrors[i];
+		printf("  mesh %u quantized to %u bytes per vertex (from %u), max error: position %g, normal %.3f degrees, uv %g\n",
+			(unsigned int)qe.mesh, qe.bytesPerVert, qe.floatBytesPerVert, qe.posErr, qe.normErr, qe.uvErr);
+	}
+}
+
+model* modelLoader::newModel(const char* file)
+{
 	model* theModel = new model;
 	theModel->cPath = _strdup(file);
 	theModel->sName = (string)file;
+	theModel->cache = NULL;
+	theModel->arena = NULL;
+	theModel->vao = theModel->vbo = theModel->ibo = theModel->depthVao = 0;
+	theModel->retain = retainAll;
+	theModel->vboRange.page = theModel->iboRange.page = -1;
+	theModel->vboRange.offset = theModel->vboRange.size = theModel->iboRange.offset = theModel->iboRange.size = 0;
 	string::size_type slashInd = theModel->sName.find_last_of("/");
 	if(slashInd == string::npos){
 		theModel->sDir = ".";
@@ -63,34 +396,837 @@ model* modelLoader::loadModel(char* file){
 	}else{
 		theModel->sDir = theModel->sName.substr(0, slashInd);
 	}
-	printf("Model has %i animations\n", theScene->mNumAnimations);
-	printf("Model has %i cameras\n", theScene->mNumCameras);
-	printf("Model has %i lights\n", theScene->mNumLights);
-	printf("Model has %i materials\n", theScene->mNumMaterials);
-	printf("Model has %i meshes\n", theScene->mNumMeshes);
-	printf("Model has %i textures\n", theScene->mNumTextures);
-	printf("Model has %i nodes below root node\n", theScene->mRootNode->mNumChildren);
-	
-	//assign the number of materials and meshes from the scene to the model
-	theModel->numMat = theScene->mNumMaterials;
-	theModel->numMesh = theScene->mNumMeshes;
-	//load the vertices, normals and textures for the model
-	loadVert(theModel, theScene);
-	//create the VAOs and VBOs associated with the model
-	makeVAO(theModel);
-	//if there are materials, use SOIL to load them
-	if(theScene->HasMaterials()){
-		loadMat(theModel, theScene);
+	return theModel;
+}
+
+//if stats isn't NULL it gets the timings and counts for this load, see loadStats
+model* modelLoader::loadModel(char* file, importProfile profile, loadStats* stats){
+	model* theModel = NULL;
+	beginStats(stats);
+	bool ok = parseModel(file, profile, theModel);
+	endStats();
+	if(!ok){
+		exit(1);
+	}
+	m_Stats = stats;
+	uploadModel(theModel, NULL);
+	m_Stats = NULL;
+	printf("Loaded "); printf(file); printf("\n");
+	return theModel;
+}
+
+//the same file always gets the same key however it is written (relative, mixed case, either slash),
+//each profile is a separate entry as the meshes it produces differ
+string modelLoader::registryKey(const char* file, importProfile profile)
+{
+	char full[MAX_PATH];
+	DWORD len = GetFullPathNameA(file, MAX_PATH, full, NULL);
+	string key = packName((len > 0 && len < MAX_PATH) ? full : file);
+	char suffix[16];
+	sprintf(suffix, "|%d", (int)profile);
+	return key + suffix;
+}
+
+//loadModel through the registry: a file that is already loaded hands back the same model and only
+//costs a reference. Every acquireModel needs a matching releaseModel (or freeModel).
+//Hits are safe from any thread. A miss loads the model on the calling thread, so like loadModel it
+//must own the GL context, and any other thread asking for the same file waits for that load rather
+//than starting another. Returns NULL if the file can't be loaded.
+model* modelLoader::acquireModel(const char* file, importProfile profile)
+{
+	string key = registryKey(file, profile);
+	{
+		unique_lock<mutex> lock(m_RegistryLock);
+		map<string, regEntry>::iterator it = m_Registry.find(key);
+		if(it != m_Registry.end())
+		{
+			m_RegHits++;
+			if(it->second.failed)
+				return NULL;
+			regEntry& e = it->second;
+			e.refs++;
+			//someone else is still loading it, map entries don't move so e stays valid while we hold a reference
+			while(e.m == NULL && !e.failed)
+				m_RegistrySignal.wait(lock);
+			if(e.failed)
+			{
+				if(--e.refs == 0)
+					m_Registry.erase(key);
+				return NULL;
+			}
+			return e.m;
+		}
+		regEntry e;
+		e.m = NULL;
+		e.refs = 1;
+		e.failed = false;
+		m_Registry[key] = e;
+		m_RegMisses++;
+	}
+
+	//unlike loadModel a file that won't load isn't fatal here, the caller gets NULL
+	model* theModel = NULL;
+	bool ok = parseModel(file, profile, theModel);
+	if(ok)
+	{
+		uploadModel(theModel, NULL);
+		theModel->regKey = key;
+		printf("Loaded %s\n", file);
+	}
+	{
+		lock_guard<mutex> lock(m_RegistryLock);
+		regEntry& e = m_Registry[key];
+		if(ok)
+			e.m = theModel;
+		else
+		{
+			//the entry stays until every waiter has seen the failure
+			e.failed = true;
+			if(--e.refs == 0)
+				m_Registry.erase(key);
+		}
+	}
+	m_RegistrySignal.notify_all();
+	return theModel;
+}
+
+//drops one reference to a model from acquireModel, the last one frees it (GPU and CPU side) so that
+//call has to be made on the thread that owns the GL context
+void modelLoader::releaseModel(model* m)
+{
+	if(!m)
+		return;
+	{
+		lock_guard<mutex> lock(m_RegistryLock);
+		map<string, regEntry>::iterator it = m_Registry.find(m->regKey);
+		if(it == m_Registry.end() || it->second.m != m)
+		{
+			printf("WARNING, releaseModel called on %s which the registry doesn't hold\n", m->sName.c_str());
+			return;
+		}
+		if(--it->second.refs > 0)
+			return;
+		m_Registry.erase(it);
+	}
+	unwatchModel(m);
+	printf("delete model and free memory\n");
+	releaseGL(m);
+	discardModel(m);
+}
+
+registryStats modelLoader::getRegistryStats()
+{
+	lock_guard<mutex> lock(m_RegistryLock);
+	registryStats rs;
+	rs.hits = m_RegHits;
+	rs.misses = m_RegMisses;
+	rs.numModels = 0;
+	rs.numRefs = 0;
+	for(map<string, regEntry>::iterator it = m_Registry.begin(); it != m_Registry.end(); it++)
+	{
+		if(it->second.m)
+			rs.numModels++;
+		else
+			continue;
+		rs.numRefs += it->second.refs;
+	}
+	return rs;
+}
+
+//queues file to be parsed on the worker thread, processUploads finishes it off on the GL thread
+modelHandle modelLoader::loadModelAsync(const char* file, importProfile profile)
+{
+	modelHandle h = newRequest(file, profile);
+	pushJob(h);
+	return h;
+}
+
+//a request for file with its own parser loader, ready to be handed to pushJob
+modelHandle modelLoader::newRequest(const char* file, importProfile profile)
+{
+	modelHandle h(new loadRequest);
+	h->file = file;
+	h->profile = profile;
+	h->state = loadParsing;
+	h->result = NULL;
+	h->target = NULL;
+	h->texImg.pixels = NULL;
+	h->progress = 0.0f;
+	h->cancelled = false;
+	//each load gets its own loader so the CPU stage never touches the bones the render thread is animating
+	h->parser = new modelLoader;
+	size_t cores = thread::hardware_concurrency();
+	if(cores == 0)
+		cores = 1;
+	//the watcher thread makes requests too, so the settings are copied under the lock their setters take
+	lock_guard<mutex> lock(m_JobLock);
+	h->parser->m_CacheDir = m_CacheDir;
+	h->parser->m_MappedIO = m_MappedIO;
+	h->parser->m_Packs = m_Packs;
+	h->parser->m_MeasureTime = m_MeasureTime;
+	h->parser->m_Dedup = m_Dedup;
+	h->parser->m_Interleave = m_Interleave;
+	h->parser->m_Quantize = m_Quantize;
+	h->parser->m_QuantNorm8 = m_QuantNorm8;
+	h->parser->m_SingleBuffer = m_SingleBuffer;
+	h->parser->m_Pool = m_Pool;
+	h->parser->m_Retain = m_Retain;
+	h->parser->m_DepthStream = m_DepthStream;
+	//the parse runs on one of the pool's workers, so its LOD jobs only get that worker's share of the cores
+	size_t workers = m_NumWorkers > 0 ? m_NumWorkers : cores;
+	if(m_Workers.size() > workers)
+		workers = m_Workers.size();
+	h->parser->m_LodThreads = cores > workers ? cores / workers : 1;
+	return h;
+}
+
+void modelLoader::pushJob(const modelHandle& h)
+{
+	{
+		lock_guard<mutex> lock(m_JobLock);
+		startWorkers();
+		m_Jobs.push_back(h);
+	}
+	m_JobSignal.notify_one();
+}
+
+//loads every file in files across the worker threads and returns the models in the same order.
+//Each distinct path is only loaded once, so repeated paths get the same model back (free it once).
+//Must be called from the thread that owns the GL context as it does all the uploads itself.
+vector<model*> modelLoader::loadModels(const vector<string>& files, batchStats* stats, importProfile profile)
+{
+	LARGE_INTEGER freq, start, end;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&start);
+
+	map<string, size_t> unique;
+	vector<modelHandle> handles;
+	vector<size_t> slot(files.size());
+	unsigned long long bytes = 0;
+	for(size_t i = 0; i < files.size(); i++)
+	{
+		map<string, size_t>::iterator it = unique.find(files[i]);
+		if(it == unique.end())
+		{
+			it = unique.insert(make_pair(files[i], handles.size())).first;
+			handles.push_back(loadModelAsync(files[i].c_str(), profile));
+			unsigned long long size, time;
+			if(getFileStamp(files[i].c_str(), size, time))
+				bytes += size;
+		}
+		slot[i] = it->second;
+	}
+
+	//the workers parse in parallel while this thread uploads each model as soon as it is ready
+	size_t finished = 0;
+	while(finished < handles.size())
+	{
+		processUploads();
+		finished = 0;
+		for(size_t i = 0; i < handles.size(); i++)
+		{
+			if(handles[i]->done()) finished++;
+		}
+		if(finished < handles.size())
+		{
+			unique_lock<mutex> lock(m_JobLock);
+			m_UploadSignal.wait_for(lock, chrono::milliseconds(1));
+		}
+	}
+
+	vector<model*> models(files.size());
+	for(size_t i = 0; i < files.size(); i++)
+	{
+		models[i] = handles[slot[i]]->result;
+	}
+
+	QueryPerformanceCounter(&end);
+	batchStats bs;
+	bs.numModels = handles.size();
+	bs.numFailed = 0;
+	for(size_t i = 0; i < handles.size(); i++)
+	{
+		if(handles[i]->state == loadFailed) bs.numFailed++;
+	}
+	bs.bytes = bytes;
+	bs.seconds = (double)(end.QuadPart - start.QuadPart) / (double)freq.QuadPart;
+	bs.modelsPerSec = bs.seconds > 0.0 ? bs.numModels / bs.seconds : 0.0;
+	bs.mbPerSec = bs.seconds > 0.0 ? (bs.bytes / (1024.0 * 1024.0)) / bs.seconds : 0.0;
+	printf("Loaded %u models (%u failed) in %.2fs - %.1f models/s, %.1f MB/s\n", (unsigned int)bs.numModels, 
+		(unsigned int)bs.numFailed, bs.seconds, bs.modelsPerSec, bs.mbPerSec);
+	if(stats)
+		*stats = bs;
+	return models;
+}
+
+//sets how many threads parse models for loadModelAsync and loadModels, 0 means one per core.
+//The pool only ever grows, so call this before the first load if you want fewer threads.
+void modelLoader::setWorkerThreads(size_t n)
+{
+	lock_guard<mutex> lock(m_JobLock);
+	m_NumWorkers = n;
+	if(!m_Workers.empty())
+		startWorkers();
+}
+
+//m_JobLock must be held
+void modelLoader::startWorkers()
+{
+	size_t n = m_NumWorkers;
+	if(n == 0)
+		n = thread::hardware_concurrency();
+	if(n == 0)
+		n = 1;
+	while(m_Workers.size() < n)
+	{
+		m_Workers.push_back(thread(&modelLoader::workerLoop, this));
+	}
+}
+
+//call once a frame from the thread that owns the GL context, 0 uploads everything that is ready
+void modelLoader::processUploads(size_t maxModels)
+{
+	modelHandle h;
+	for(size_t n = 0; (maxModels == 0 || n < maxModels) && m_Uploads.pop(h); n++)
+	{
+		//hot reloads patch a model that is already on the GPU instead of making a new one
+		if(h->target || !h->texture.empty())
+		{
+			applyReload(h);
+			continue;
+		}
+		bool uploaded = false;
+		if(h->cancelled)
+			discardModel(h->result); //nothing has been made on the GL side yet
+		else
+		{
+			m_Stats = &h->stats;
+			uploaded = uploadModel(h->result, h.get()); //releases everything itself if it gets cancelled
+			m_Stats = NULL;
+		}
+		if(!uploaded)
+		{
+			h->result = NULL;
+			delete h->parser;
+			h->parser = NULL;
+			printf("Cancelled loading %s\n", h->file.c_str());
+			h->state = loadCancelled;
+			continue;
+		}
+		//the newest model to finish becomes the animated one, exactly like a synchronous loadModel
+		adoptBones(*h->parser);
+		delete h->parser;
+		h->parser = NULL;
+		printf("Loaded %s\n", h->file.c_str());
+		h->progress = 1.0f;
+		h->state = loadReady;
+	}
+}
+
+void modelLoader::workerLoop()
+{
+	for(;;)
+	{
+		modelHandle h;
+		{
+			unique_lock<mutex> lock(m_JobLock);
+			while(m_Jobs.empty() && !m_Quit)
+				m_JobSignal.wait(lock);
+			if(m_Quit)
+				return;
+			h = m_Jobs.front();
+			m_Jobs.pop_front();
+		}
+		h->parser->m_Request = h.get();
+		h->parser->beginStats(&h->stats);
+		bool ok = false;
+		if(h->cancelled)
+			ok = false;
+		else if(!h->texture.empty())
+		{
+			//a texture reload only needs decoding
+			h->parser->decodeTexture(h->texture, h->texImg, "reloaded");
+			ok = h->texImg.pixels != NULL;
+		}
+		else
+			ok = h->parser->parseModel(h->file.c_str(), h->profile, h->result);
+		h->parser->endStats();
+		if(ok)
+		{
+			h->state = loadUploading;
+			m_Uploads.push(h);
+		}
+		else
+		{
+			delete h->parser;
+			h->parser = NULL;
+			h->state = h->cancelled ? loadCancelled : loadFailed;
+		}
+		m_UploadSignal.notify_all();
+	}
+}
+
+//the CPU half of a load, safe to run on any thread as it makes no GL calls
+bool modelLoader::parseModel(const char* file, importProfile profile, model*& out)
+{
+	//if this file has been loaded before and hasn't changed since, the cache lets us skip ASSIMP entirely
+	out = NULL;
+	LARGE_INTEGER t = timeNow();
+	bool hit = readCache(file, profile, out);
+	if(m_Stats){
+		m_Stats->cacheReadSecs = secondsSince(t);
+		m_Stats->fromCache = hit;
+	}
+	if(hit){
+		if(cancelled()){
+			discardModel(out);
+			out = NULL;
+			resetBones();
+			return false;
+		}
+		printf("Loaded %s from the model cache\n", file);
+		out->retain = m_Retain;
+		calcBounds(out);
+		hashMeshes(out);
+		packVertices(out);
+		buildShadowIndices(out);
+		countModel(out);
+		return true;
+	}
+
+	Assimp::Importer importer;
+	//serve the file, and anything it references, straight out of a pack or mapped memory rather than through fread
+	if(!m_Packs.empty()){
+		importer.SetIOHandler(new packIOSystem(m_Packs));
+	}else if(m_MappedIO){
+		importer.SetIOHandler(new mappedIOSystem);
+	}
+	//the importer owns the handler, it is what lets a cancelled load stop part way through ASSIMP
+	if(m_Request){
+		importer.SetProgressHandler(new requestProgress(m_Request));
+	}
+	//ASSIMP's profiler reports through its global logger, listen in on it for the length of the import
+	unique_lock<mutex> logLock(s_LoggerLock, defer_lock);
+	timingLogStream* timing = NULL;
+	bool madeLogger = false;
+	Assimp::Logger::LogSeverity oldSeverity = Assimp::Logger::NORMAL;
+	if(m_MeasureTime && m_Stats){
+		logLock.lock();
+		if(Assimp::DefaultLogger::isNullLogger()){
+			Assimp::DefaultLogger::create("", Assimp::Logger::VERBOSE, 0);
+			madeLogger = true;
+		}
+		//the profiler logs at debug level, which only a verbose logger passes on
+		oldSeverity = Assimp::DefaultLogger::get()->getLogSeverity();
+		Assimp::DefaultLogger::get()->setLogSeverity(Assimp::Logger::VERBOSE);
+		timing = new timingLogStream(m_Stats->assimpTimes);
+		Assimp::DefaultLogger::get()->attachStream(timing, Assimp::Logger::Debugging);
+		importer.SetPropertyBool(AI_CONFIG_GLOB_MEASURE_TIME, true);
+	}
+	t = timeNow();
+	importer.ReadFile(file, applyProfile(importer, profile));
+	if(m_Stats)
+		m_Stats->importSecs = secondsSince(t);
+	if(timing){
+		//detaching hands the stream back to us
+		Assimp::DefaultLogger::get()->detatchStream(timing, Assimp::Logger::Debugging);
+		delete timing;
+		if(madeLogger)
+			Assimp::DefaultLogger::kill();
+		else
+			Assimp::DefaultLogger::get()->setLogSeverity(oldSeverity);
+		logLock.unlock();
+	}
+	//take the scene off the importer, it is only needed until the skeleton has been copied out of it
+	const aiScene* scene = importer.GetOrphanedScene();
+	if(!scene){
+		if(cancelled())
+			return false;
+		//print->error("reading mesh ", file, 4);
+		printf("ERROR reading mesh - %s (%s)", file, importer.GetErrorString());
+		return false;
+	}
+	//check that the scene has at least one mesh, though it may contain more!
+	assert(scene->mNumMeshes>0);
+
+	model* theModel = newModel(file);
+	theModel->profile = profile;
+	printf("Model imported with the %s profile\n", s_Profiles[profile].name);
+	printf("Model has %i animations\n", scene->mNumAnimations);
+	printf("Model has %i cameras\n", scene->mNumCameras);
+	printf("Model has %i lights\n", scene->mNumLights);
+	printf("Model has %i materials\n", scene->mNumMaterials);
+	printf("Model has %i meshes\n", scene->mNumMeshes);
+	printf("Model has %i textures\n", scene->mNumTextures);
+	printf("Model has %i nodes below root node\n", scene->mRootNode->mNumChildren);
+	
+	//assign the number of materials and meshes from the scene to the model
+	theModel->numMat = scene->mNumMaterials;
+	theModel->numMesh = scene->mNumMeshes;
+	//the bones belong to this model only, so start the mapping from scratch
+	resetBones();
+	//load the vertices, normals and textures for the model
+	t = timeNow();
+	loadVert(theModel, scene);
+	optimizeMeshes(theModel);
+	splitMeshes(theModel);
+	if(m_Stats)
+		m_Stats->vertSecs = secondsSince(t);
+	buildLods(theModel);
+	buildClusters(theModel);
+	//if there are materials, use SOIL to decode them
+	if(scene->HasMaterials() && !cancelled()){
+		t = timeNow();
+		loadMat(theModel, scene);
+		if(m_Stats)
+			m_Stats->matSecs = secondsSince(t);
+	}
+	//a cancelled load stops at the first check it reaches, so throw away whatever got made before that
+	if(cancelled()){
+		discardModel(theModel);
+		aiReleaseImport(scene);
+		resetBones();
+		return false;
+	}
+	//if the scene has bones do these things
+	m_GlobalInverseTransform = scene->mRootNode->mTransformation;
+	m_GlobalInverseTransform.Inverse();
+	//everything the animation code needs gets copied out, after that the scene is no use to anyone
+	buildSkeleton(scene, m_Bonemapping, m_Skeleton);
+	aiReleaseImport(scene);
+	printf("Skeleton has %i nodes and %i animations (%iKB)\n", (int)m_Skeleton.nodes.size(),
+		(int)m_Skeleton.anims.size(), (int)(m_Skeleton.byteSize() / 1024));
+	//store everything we just worked out so the next load of this file can skip all of the above
+	t = timeNow();
+	writeCache(theModel, file);
+	if(m_Stats)
+		m_Stats->cacheWriteSecs = secondsSince(t);
+	theModel->retain = m_Retain;
+	calcBounds(theModel);
+	hashMeshes(theModel);
+	packVertices(theModel);
+	buildShadowIndices(theModel);
+	countModel(theModel);
+	out = theModel;
+	return true;
+}
+
+//fills in the counts part of the stats from a parsed model
+void modelLoader::countModel(model* m)
+{
+	if(!m_Stats)
+		return;
+	m_Stats->numMesh = m->vMesh.size();
+	m_Stats->numMat = m->vMat.size();
+	m_Stats->numBones = numBones;
+	if(m->arena)
+	{
+		m_Stats->geomBlocks = m->arena->numBlocks();
+		m_Stats->geomAllocs = m->arena->numAllocs();
+	}
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		m_Stats->numVert += m->vMesh[i].numVert;
+		m_Stats->numInd += m->vMesh[i].numInd;
+		if(m->vMesh[i].shadowVerts > 0)
+			m_Stats->shadowWelded += m->vMesh[i].numVert - m->vMesh[i].shadowVerts;
+	}
+}
+
+//the GL half of a load, must run on the thread that owns the context.
+//If req is cancelled part way through, everything made so far is released and false is returned.
+bool modelLoader::uploadModel(model* m, const loadRequest* req)
+{
+	//create the VAOs and VBOs associated with the model
+	LARGE_INTEGER t = timeNow();
+	makeVAO(m);
+	if(m_Stats)
+		m_Stats->vaoSecs = secondsSince(t);
+	t = timeNow();
+	for(size_t i = 0; i < m->vMat.size(); i++)
+	{
+		if(req && req->cancelled)
+			break;
+		if(m_Stats)
+		{
+			const texImage& ti = m->vMat[i].texImg;
+			const texImage& ni = m->vMat[i].normImg;
+			if(ti.pixels) m_Stats->textureBytes += (unsigned long long)ti.width * ti.height * ti.channels;
+			if(ni.pixels) m_Stats->textureBytes += (unsigned long long)ni.width * ni.height * ni.channels;
+		}
+		createMatTextures(m->vMat[i]);
+	}
+	if(m_Stats)
+	{
+		m_Stats->texUploadSecs = secondsSince(t);
+		m_Stats->totalSecs += m_Stats->vaoSecs + m_Stats->texUploadSecs;
+	}
+	if(req && req->cancelled)
+	{
+		releaseGL(m);
+		discardModel(m);
+		return false;
+	}
+	releaseCPU(m);
+	return true;
+}
+
+//sets how much vertex data models loaded from now on keep once they are uploaded
+void modelLoader::setRetainPolicy(retainPolicy retain)
+{
+	lock_guard<mutex> lock(m_JobLock);
+	m_Retain = retain;
+}
+
+//the model's bounding box and sphere, worked out while every vertex is still about
+void modelLoader::calcBounds(model* m)
+{
+	float lo[3] = {0.0f, 0.0f, 0.0f}, hi[3] = {0.0f, 0.0f, 0.0f};
+	bool any = false;
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		const sMesh& theMesh = m->vMesh[i];
+		if(!theMesh.verts)
+			continue;
+		for(size_t v = 0; v < theMesh.numVert; v++)
+		{
+			const GLfloat* p = &theMesh.verts[v * 3];
+			for(size_t c = 0; c < 3; c++)
+			{
+				if(!any || p[c] < lo[c]) lo[c] = p[c];
+				if(!any || p[c] > hi[c]) hi[c] = p[c];
+			}
+			any = true;
+		}
+	}
+	m->min_x = lo[0]; m->min_y = lo[1]; m->min_z = lo[2];
+	m->max_x = hi[0]; m->max_y = hi[1]; m->max_z = hi[2];
+	float mid[3] = {(lo[0] + hi[0]) * 0.5f, (lo[1] + hi[1]) * 0.5f, (lo[2] + hi[2]) * 0.5f};
+	m->centre = glm::vec3(mid[0], mid[1], mid[2]);
+	//the sphere is centred on the box but only as big as the furthest vertex needs, which is often a lot less
+	float r2 = 0.0f;
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		const sMesh& theMesh = m->vMesh[i];
+		if(!theMesh.verts)
+			continue;
+		for(size_t v = 0; v < theMesh.numVert; v++)
+		{
+			const GLfloat* p = &theMesh.verts[v * 3];
+			float dx = p[0] - mid[0], dy = p[1] - mid[1], dz = p[2] - mid[2];
+			float l2 = dx * dx + dy * dy + dz * dz;
+			if(l2 > r2) r2 = l2;
+		}
+	}
+	m->radius = sqrtf(r2);
+}
+
+//copies len bytes of src into the arena, NULL (or nothing) comes back NULL
+static void* keepArray(meshArena* kept, const void* src, size_t len)
+{
+	if(!src || len == 0)
+		return NULL;
+	void* dst = kept->alloc(len);
+	memcpy(dst, src, len);
+	return dst;
+}
+
+//frees whatever the model's retain policy says it doesn't need now the GPU has it, along with the model's own
+//copy of every mesh that now uses the shared mesh table's (see meshDedup.cpp), so dedup saves memory rather than
+//adding the table's copy to it. Arrays that belong to the table stay, the table compares later loads against them.
+void modelLoader::releaseCPU(model* m)
+{
+	bool anyShared = false;
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		anyShared |= m->vMesh[i].shared;
+	}
+	if(m->retain == retainAll && !anyShared)
+		return;
+	bool keepAll = m->retain == retainAll;
+	unsigned long long freed = 0;
+	//the arrays can't be freed one by one, so anything staying is copied into a small arena of its own and the
+	//old arena and mapping go whole. The meshlets always stay, renderModel culls with them.
+	size_t bytes = 0;
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		const sMesh& theMesh = m->vMesh[i];
+		if(theMesh.shared)
+			continue;
+		size_t n = theMesh.numVert;
+		if(keepAll)
+		{
+			if(theMesh.indexes) bytes += meshArena::aligned(sizeof(GLuint) * theMesh.numInd);
+			if(theMesh.normals) bytes += meshArena::aligned(sizeof(GLfloat) * 3 * n);
+			if(theMesh.texCoords) bytes += meshArena::aligned(sizeof(GLfloat) * 2 * n);
+			if(theMesh.tangents) bytes += meshArena::aligned(sizeof(GLshort) * 4 * n);
+			if(theMesh.lodIndexes) bytes += meshArena::aligned(sizeof(GLuint) * theMesh.numLodInd);
+		}
+		if(m->retain != retainNone && theMesh.verts)
+			bytes += meshArena::aligned(sizeof(GLfloat) * 3 * n);
+		if(theMesh.meshlets)
+			bytes += meshArena::aligned(sizeof(meshlet) * theMesh.numMeshlets);
+	}
+	meshArena* kept = bytes > 0 ? new meshArena(bytes) : NULL;
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		sMesh& theMesh = m->vMesh[i];
+		if(theMesh.shared)
+			continue;
+		size_t n = theMesh.numVert;
+		if(keepAll)
+		{
+			theMesh.indexes = (GLuint*)keepArray(kept, theMesh.indexes, sizeof(GLuint) * theMesh.numInd);
+			theMesh.normals = (GLfloat*)keepArray(kept, theMesh.normals, sizeof(GLfloat) * 3 * n);
+			theMesh.texCoords = (GLfloat*)keepArray(kept, theMesh.texCoords, sizeof(GLfloat) * 2 * n);
+			theMesh.tangents = (GLshort*)keepArray(kept, theMesh.tangents, sizeof(GLshort) * 4 * n);
+			theMesh.lodIndexes = (GLuint*)keepArray(kept, theMesh.lodIndexes, sizeof(GLuint) * theMesh.numLodInd);
+		}
+		else
+		{
+			freed += sizeof(GLuint) * theMesh.numInd;
+			if(theMesh.normals) freed += sizeof(GLfloat) * 3 * n;
+			if(theMesh.texCoords) freed += sizeof(GLfloat) * 2 * n;
+			if(theMesh.tangents) freed += sizeof(GLshort) * 4 * n;
+			freed += sizeof(GLuint) * theMesh.numLodInd;
+			theMesh.indexes = theMesh.lodIndexes = NULL;
+			theMesh.normals = theMesh.texCoords = NULL;
+			theMesh.tangents = NULL;
+		}
+		theMesh.meshlets = (meshlet*)keepArray(kept, theMesh.meshlets, sizeof(meshlet) * theMesh.numMeshlets);
+		if(m->retain == retainNone || !theMesh.verts)
+		{
+			if(theMesh.verts) freed += sizeof(GLfloat) * 3 * n;
+			theMesh.verts = NULL;
+		}
+		else
+			theMesh.verts = (GLfloat*)keepArray(kept, theMesh.verts, sizeof(GLfloat) * 3 * n);
+	}
+	if(!keepAll)
+	{
+		freed += sizeof(vBoneData) * m->vBones.size();
+		vector<vBoneData>().swap(m->vBones);
+	}
+	//nothing points into the old arena or the mapping any more
+	delete m->arena;
+	m->arena = kept;
+	if(m->cache)
+	{
+		unmapFile(*m->cache);
+		delete m->cache;
+		m->cache = NULL;
+	}
+	if(!keepAll)
+		printf("Released %lluKB of vertex data from %s\n", freed / 1024, m->sName.c_str());
+}
+
+//deletes every GL object the model owns, anything that was never created is still 0 and skipped
+void modelLoader::releaseGL(model* m)
+{
+	glBindVertexArray(0);
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		releaseMeshGL(m->vMesh[i]);
+	}
+	releaseModelGL(m);
+	for(size_t i = 0; i < m->vMat.size(); i++)
+	{
+		GLuint textures[2] = {m->vMat[i].matTex, m->vMat[i].matNorm};
+		glDeleteTextures(2, textures);
+		m->vMat[i].matTex = m->vMat[i].matNorm = 0;
+	}
+}
+
+//deletes the single buffer layout's objects, or hands its ranges back to the pool
+void modelLoader::releaseModelGL(model* m)
+{
+	if(m->vboRange.page >= 0)
+	{
+		vertexPool().free(m->vboRange);
+		indexPool().free(m->iboRange);
+	}
+	else
+	{
+		GLuint buffers[2] = {m->vbo, m->ibo};
+		glDeleteBuffers(2, buffers);
+	}
+	if(m->vao != 0)
+		glDeleteVertexArrays(1, &m->vao);
+	if(m->depthVao != 0)
+		glDeleteVertexArrays(1, &m->depthVao);
+	m->vao = m->vbo = m->ibo = m->depthVao = 0;
+}
+
+void modelLoader::releaseMeshGL(sMesh& theMesh)
+{
+	//somebody else may still be drawing with these, the table deletes them once nobody is
+	if(theMesh.shared)
+	{
+		releaseSharedMesh(theMesh);
+		return;
+	}
+	GLuint buffers[5] = {theMesh.ibo, theMesh.vbo, theMesh.nbo, theMesh.tbo, theMesh.bbo};
+	glDeleteBuffers(5, buffers);
+	if(theMesh.vao != 0)
+		glDeleteVertexArrays(1, &theMesh.vao);
+	if(theMesh.depthVao != 0)
+		glDeleteVertexArrays(1, &theMesh.depthVao);
+	theMesh.vao = theMesh.ibo = theMesh.vbo = theMesh.nbo = theMesh.tbo = theMesh.bbo = theMesh.depthVao = 0;
+}
+
+//frees the CPU side of a model, call releaseGL first if it was ever uploaded
+void modelLoader::discardModel(model* m)
+{
+	if(!m)
+		return;
+	for(size_t i = 0; i < m->vMat.size(); i++)
+	{
+		SOIL_free_image_data(m->vMat[i].texImg.pixels);
+		SOIL_free_image_data(m->vMat[i].normImg.pixels);
+	}
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		free(m->vMesh[i].packed);
+		free(m->vMesh[i].shadowIndexes);
 	}
-	//if the scene has bones do these things
-	m_GlobalInverseTransform = theScene->mRootNode->mTransformation;
-	m_GlobalInverseTransform.Inverse();
-	printf("Loaded "); printf(file); printf("\n");
-	return theModel;
+	//every mesh array is in one or the other
+	if(m->cache)
+	{
+		unmapFile(*m->cache);
+		delete m->cache;
+	}
+	delete m->arena;
+	free(m->cPath);
+	delete m;
+}
+
+bool modelLoader::cancelled() const
+{
+	return m_Request && m_Request->cancelled;
+}
+
+void modelLoader::setProgress(float p)
+{
+	if(m_Request)
+		m_Request->progress = p;
+}
+
+//takes over the bones and animations of a loader that has just parsed a model
+void modelLoader::adoptBones(modelLoader& from)
+{
+	m_Bonemapping.swap(from.m_Bonemapping);
+	m_BoneInfo.swap(from.m_BoneInfo);
+	numBones = from.numBones;
+	m_GlobalInverseTransform = from.m_GlobalInverseTransform;
+	m_Skeleton.nodes.swap(from.m_Skeleton.nodes);
+	m_Skeleton.anims.swap(from.m_Skeleton.anims);
 }
 
 void modelLoader::loadMat(model* m, const aiScene* s){
 	for(size_t i = 0; i < s->mNumMaterials; i++){
+		if(cancelled())
+			return;
+		setProgress(PROGRESS_IMPORT + PROGRESS_VERT + PROGRESS_MAT * i / s->mNumMaterials);
 		struct aiMaterial *tm = s->mMaterials[i];
 		//create a mat struct object
 		mat theMat;
@@ -128,25 +1264,14 @@ void modelLoader::loadMat(model* m, const aiScene* s){
 		//finally get the shininess array
 		aiGetMaterialFloatArray(tm, AI_MATKEY_SHININESS, &shininess, &max);
 		theMat.shininess = shininess;
+		theMat.matTex = theMat.matNorm = 0;
 		//if the texture count is greater than 0, then....
 		if(tm->GetTextureCount(aiTextureType_DIFFUSE) > 0){
 			aiString path;
 			//if we can get get a material...
 			if(tm->GetTexture(aiTextureType_DIFFUSE, 0, &path, NULL, NULL, NULL, NULL, NULL)==AI_SUCCESS){
 				//create a string with the correct path
-				string fp = m->sDir +"/"+path.data;
-				//print->loading("Texture Diffuse ", fp);
-				printf("Loading Texture, diffuse - %s", fp);
-				//use the SOIL library to load the texture into memory
-				theMat.matTex = SOIL_load_OGL_texture(fp.c_str(), SOIL_LOAD_AUTO, 
-											SOIL_CREATE_NEW_ID, SOIL_FLAG_INVERT_Y);
-				//if success then continue, else print error
-				if(theMat.matTex == 0){
-					//print->loadingFailed();
-					printf("ERROR, failed to load texture: %s", fp);
-				}else 
-					//print->loadingComp();
-					printf("Succesfully loaded %s", fp);
+				theMat.texPath = m->sDir +"/"+path.data;
 			}
 		}
 		
@@ -154,114 +1279,969 @@ void modelLoader::loadMat(model* m, const aiScene* s){
 		if(tm->GetTextureCount(aiTextureType_HEIGHT) > 0){
 			aiString path;
 			if(tm->GetTexture(aiTextureType_HEIGHT, 0, &path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS){
-				string fp = m->sDir+"/"+path.data;
-				//print->loading("Texture Normal ", fp);
-				printf("Loading Texture, normal - %s", fp);
-				theMat.matNorm = SOIL_load_OGL_texture(fp.c_str(), SOIL_LOAD_AUTO, SOIL_CREATE_NEW_ID, SOIL_FLAG_INVERT_Y);
-				if(theMat.matNorm == 0){
-					//print->loadingFailed();
-					printf("ERROR, failed to load texture: %s", fp);
-				}else 
-					//print->loadingComp();
-					printf("Succesfully loaded %s", fp);
+				theMat.normPath = m->sDir+"/"+path.data;
+			}
+
+		}
+		//use the SOIL library to decode the textures into memory, they're uploaded later by uploadModel
+		decodeMatTextures(theMat);
+		//push back the material vector of the model with the currently used material object.
+		m->vMat.push_back(theMat);
+	}
+}
+
+void modelLoader::decodeTexture(const string& path, texImage& img, const char* kind)
+{
+	img.pixels = NULL;
+	img.width = img.height = img.channels = 0;
+	if(path.empty() || m_KeepTextures.count(path))
+		return;
+	//print->loading("Texture ", fp);
+	printf("Loading Texture, %s - %s", kind, path.c_str());
+	LARGE_INTEGER t = timeNow();
+	fileMapping fm;
+	int entry;
+	const assetPack* pack = findInPacks(m_Packs, path.c_str(), entry);
+	if(pack){
+		//uncompressed entries are decoded straight out of the pack, the rest are unpacked first
+		vector<char> buf;
+		const char* data = pack->view(entry);
+		if(!data && pack->read(entry, buf) && !buf.empty())
+			data = &buf[0];
+		if(data)
+			img.pixels = SOIL_load_image_from_memory((const unsigned char*)data, (int)pack->entrySize(entry), 
+										&img.width, &img.height, &img.channels, SOIL_LOAD_AUTO);
+	}else if(m_MappedIO && mapFile(path.c_str(), fm, false)){
+		img.pixels = SOIL_load_image_from_memory((const unsigned char*)fm.view, (int)fm.size, 
+									&img.width, &img.height, &img.channels, SOIL_LOAD_AUTO);
+		unmapFile(fm);
+	}else{
+		img.pixels = SOIL_load_image(path.c_str(), &img.width, &img.height, &img.channels, SOIL_LOAD_AUTO);
+	}
+	if(m_Stats){
+		texStats ts;
+		ts.file = path;
+		ts.decodeSecs = secondsSince(t);
+		ts.width = img.width; ts.height = img.height; ts.channels = img.channels;
+		m_Stats->textures.push_back(ts);
+	}
+	//if success then continue, else print error
+	if(img.pixels == NULL){
+		//print->loadingFailed();
+		printf("ERROR, failed to load texture: %s", path.c_str());
+	}
+}
+
+static GLuint createTexture(texImage& img, const string& path)
+{
+	if(img.pixels == NULL)
+		return 0;
+	GLuint tex = SOIL_create_OGL_texture(img.pixels, img.width, img.height, img.channels, 
+								SOIL_CREATE_NEW_ID, SOIL_FLAG_INVERT_Y);
+	SOIL_free_image_data(img.pixels);
+	img.pixels = NULL;
+	if(tex == 0){
+		//print->loadingFailed();
+		printf("ERROR, failed to load texture: %s", path.c_str());
+	}else 
+		//print->loadingComp();
+		printf("Succesfully loaded %s", path.c_str());
+	return tex;
+}
+
+//the CPU half of the texture loads, SOIL decodes the files but nothing touches GL
+void modelLoader::decodeMatTextures(mat& theMat)
+{
+	decodeTexture(theMat.texPath, theMat.texImg, "diffuse");
+	decodeTexture(theMat.normPath, theMat.normImg, "normal");
+}
+
+//the GL half, hands the decoded images to GL and frees them
+//uploads whatever decodeMatTextures decoded, a texture the material already has is left alone
+void modelLoader::createMatTextures(mat& theMat)
+{
+	if(theMat.matTex == 0)
+		theMat.matTex = createTexture(theMat.texImg, theMat.texPath);
+	if(theMat.matNorm == 0)
+		theMat.matNorm = createTexture(theMat.normImg, theMat.normPath);
+}
+
+static GLshort toSnorm16(float v)
+{
+	if(v < -1.0f) v = -1.0f;
+	if(v > 1.0f) v = 1.0f;
+	return (GLshort)floorf(v * 32767.0f + 0.5f);
+}
+
+//makes the tangent orthogonal to the normal (so the bitangent can be rebuilt from the two) and works out
+//which way the bitangent points, then stores both as 4 snorm16s
+static void packTangent(const aiVector3D& n, const aiVector3D& t, const aiVector3D& b, GLshort* out)
+{
+	float nt = n.x * t.x + n.y * t.y + n.z * t.z;
+	float tx = t.x - n.x * nt, ty = t.y - n.y * nt, tz = t.z - n.z * nt;
+	float len = sqrtf(tx * tx + ty * ty + tz * tz);
+	if(len > 0.0f)
+	{
+		tx /= len; ty /= len; tz /= len;
+	}
+	//cross(n, t) against the real bitangent
+	float cx = n.y * tz - n.z * ty, cy = n.z * tx - n.x * tz, cz = n.x * ty - n.y * tx;
+	float w = (cx * b.x + cy * b.y + cz * b.z) < 0.0f ? -1.0f : 1.0f;
+	out[0] = toSnorm16(tx);
+	out[1] = toSnorm16(ty);
+	out[2] = toSnorm16(tz);
+	out[3] = toSnorm16(w);
+}
+
+void modelLoader::loadVert(model* m, const aiScene*s){
+	const aiMesh *mesh;
+	const aiFace *face;
+	aiNode* theNode;
+	sMesh theMesh;
+	
+	size_t bv = 0;
+	size_t bi = 0;
+
+	//one block for every array of every mesh, rather than four or five mallocs a mesh
+	size_t bytes = 0;
+	for(size_t mCount = 0; mCount<s->mNumMeshes;mCount++){
+		mesh = s->mMeshes[mCount];
+		bytes += meshArena::aligned(sizeof(unsigned int) * mesh->mNumFaces * 3);
+		if(mesh->HasPositions()) bytes += meshArena::aligned(sizeof(GLfloat) * 3 * mesh->mNumVertices);
+		if(mesh->HasNormals()) bytes += meshArena::aligned(sizeof(GLfloat) * 3 * mesh->mNumVertices);
+		if(mesh->HasTextureCoords(0)) bytes += meshArena::aligned(sizeof(GLfloat) * 2 * mesh->mNumVertices);
+		if(mesh->HasTangentsAndBitangents() && mesh->HasNormals()) bytes += meshArena::aligned(sizeof(GLshort) * 4 * mesh->mNumVertices);
+	}
+	delete m->arena;
+	m->arena = new meshArena(bytes);
+
+	for(size_t mCount = 0; mCount<s->mNumMeshes;mCount++){
+		if(cancelled())
+			return;
+		setProgress(PROGRESS_IMPORT + PROGRESS_VERT * mCount / s->mNumMeshes);
+		mesh = s->mMeshes[mCount];
+		//set all of the values relating to the sMesh object
+		theMesh.vao = theMesh.ibo = theMesh.nbo = theMesh.vbo = theMesh.tbo = theMesh.bbo = 0;
+		theMesh.indexes=NULL;theMesh.verts=NULL;theMesh.normals=NULL;theMesh.texCoords=NULL;theMesh.tangents=NULL;
+		theMesh.packed = NULL; theMesh.stride = 0;
+		theMesh.hash = 0; theMesh.shared = false;
+		theMesh.hasBones = false;
+		theMesh.quantized = theMesh.octNorm8 = false;
+		theMesh.lodIndexes = NULL; theMesh.numLods = theMesh.numLodInd = 0;
+		memset(theMesh.lodFirst, 0, sizeof(theMesh.lodFirst));
+		memset(theMesh.lodCount, 0, sizeof(theMesh.lodCount));
+		memset(theMesh.lodError, 0, sizeof(theMesh.lodError));
+		theMesh.lodBase = 0; theMesh.lod = 0;
+		theMesh.meshlets = NULL; theMesh.numMeshlets = 0;
+		theMesh.depthVao = 0; theMesh.shadowIndexes = NULL; theMesh.shadowVerts = 0; theMesh.shadowBase = 0;
+		theMesh.numFaces = s->mMeshes[mCount]->mNumFaces;
+		theMesh.numInd = s->mMeshes[mCount]->mNumFaces*3;
+		theMesh.numVert = s->mMeshes[mCount]->mNumVertices;
+		theMesh.indexType = theMesh.numVert <= MAX_SHORT_VERTS ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		theMesh.matInd = s->mMeshes[mCount]->mMaterialIndex;
+		theMesh.baseInd = bi;
+		theMesh.baseVert = bv;
+
+		m->vBones.resize(m->vBones.size() + theMesh.numVert);
+		bi += theMesh.numInd;
+		bv += theMesh.numVert;
+		//theMesh.numFaces = mesh->mNumFaces;
+		theMesh.indexes = (unsigned int*)m->arena->alloc(sizeof(unsigned int) * mesh->mNumFaces * 3);
+		unsigned int fIndex = 0;
+		
+		for(size_t i = 0; i<mesh->mNumFaces;i++){
+			face=&mesh->mFaces[i];
+			memcpy(&theMesh.indexes[fIndex], face->mIndices, 3 * sizeof(unsigned int));
+			fIndex+=3;
+		}
+
+		//create a buffer of the correct size to hold the vertex positions
+		if(mesh->HasPositions()){
+			theMesh.verts = (GLfloat *) m->arena->alloc(sizeof(GLfloat) * 3 * mesh->mNumVertices);
+			memcpy(theMesh.verts, mesh->mVertices, sizeof(GLfloat)*3*mesh->mNumVertices);
+		}
+		
+		//create a buffer of the correct size to hold the vertex normals
+		if(mesh->HasNormals()){
+			theMesh.hasNorm = true;
+			theMesh.normals = (GLfloat *) m->arena->alloc(sizeof(GLfloat) * 3 * mesh->mNumVertices);
+			memcpy(theMesh.normals, mesh->mNormals, sizeof (GLfloat) * 3 * mesh->mNumVertices);
+		} else {theMesh.hasNorm = false;}
+
+		//create a buffer of the correct size to hold the vertex texture positions
+		if(mesh->HasTextureCoords(0)){
+			theMesh.hasTexCoords = true;
+			theMesh.texCoords = (GLfloat *) m->arena->alloc(sizeof(GLfloat) * 2 * mesh->mNumVertices);
+			for (size_t j = 0;j<mesh->mNumVertices;j++)
+			{
+				theMesh.texCoords[j*2]		= mesh->mTextureCoords[0][j].x;
+				theMesh.texCoords[j*2+1]	= mesh->mTextureCoords[0][j].y;
+			}
+		} else theMesh.hasTexCoords = false;
+
+		//the tangent frame, packed down to a tangent and the side the bitangent is on. The shader gets
+		//the bitangent back as cross(normal, tangent.xyz) * tangent.w
+		if(mesh->HasTangentsAndBitangents() && theMesh.hasNorm){
+			theMesh.hasTangents = true;
+			theMesh.tangents = (GLshort *) m->arena->alloc(sizeof(GLshort) * 4 * mesh->mNumVertices);
+			for (size_t j = 0;j<mesh->mNumVertices;j++)
+			{
+				packTangent(mesh->mNormals[j], mesh->mTangents[j], mesh->mBitangents[j], &theMesh.tangents[j*4]);
+			}
+		} else theMesh.hasTangents = false;
+
+		//bone stuff go here
+		if(mesh->HasBones() && !cancelled()){
+			theMesh.hasBones = true;
+			printf("mesh %i has %i bones\n", mCount,  mesh->mNumBones);
+			//print->mlPrint("mesh ", " has bones totalling: ", mCount, mesh->mNumBones, 7);
+			loadBones(mCount, mesh, m->vBones, theMesh);
+		}
+		//push_back the model vector with the current mesh
+		m->vMesh.push_back(theMesh);
+	}
+}
+
+//reorders every mesh's triangles for the vertex cache and overdraw, then its vertices (and their bone data) for
+//fetching them in order, if the model's profile asks for it. Runs before splitMeshes and the cache write, so a
+//cached model is already optimized. The work itself is in meshOptimize.cpp, which needs neither GL nor ASSIMP.
+void modelLoader::optimizeMeshes(model* m)
+{
+	if(!s_Profiles[m->profile].optimize)
+		return;
+	for(size_t i = 0; i < m->vMesh.size() && !cancelled(); i++)
+	{
+		sMesh& theMesh = m->vMesh[i];
+		if(theMesh.numInd < 3 || !theMesh.indexes || !theMesh.verts)
+			continue;
+		size_t n = theMesh.numVert;
+		vcacheStats before = analyzeVertexCache(theMesh.indexes, theMesh.numInd, n, VCACHE_ANALYZE_SIZE);
+		vector<GLuint> inds(theMesh.numInd);
+		optimizeVertexCache(&inds[0], theMesh.indexes, theMesh.numInd, n);
+		size_t clusters = optimizeOverdraw(&inds[0], theMesh.numInd, theMesh.verts, n, OVERDRAW_THRESHOLD);
+		vector<GLuint> remap(n);
+		optimizeVertexFetch(&remap[0], &inds[0], theMesh.numInd, n);
+		for(size_t j = 0; j < theMesh.numInd; j++)
+		{
+			theMesh.indexes[j] = remap[inds[j]];
+		}
+		remapVertices(theMesh.verts, n, sizeof(GLfloat) * 3, &remap[0]);
+		remapVertices(theMesh.normals, n, sizeof(GLfloat) * 3, &remap[0]);
+		remapVertices(theMesh.texCoords, n, sizeof(GLfloat) * 2, &remap[0]);
+		remapVertices(theMesh.tangents, n, sizeof(GLshort) * 4, &remap[0]);
+		if(theMesh.hasBones && m->vBones.size() >= theMesh.baseVert + n)
+			remapVertices(&m->vBones[theMesh.baseVert], n, sizeof(vBoneData), &remap[0]);
+		if(m_Stats)
+		{
+			vcacheStats after = analyzeVertexCache(theMesh.indexes, theMesh.numInd, n, VCACHE_ANALYZE_SIZE);
+			meshOptStats mo;
+			mo.mesh = i;
+			mo.acmrBefore = before.acmr;
+			mo.acmrAfter = after.acmr;
+			mo.atvrBefore = before.atvr;
+			mo.atvrAfter = after.atvr;
+			mo.clusters = clusters;
+			m_Stats->meshOpt.push_back(mo);
+		}
+	}
+}
+
+//the fraction of the full mesh's triangles each LOD level aims for
+static const float s_LodRatios[MAX_LODS] = {0.5f, 0.25f, 0.125f};
+
+//a buildLods thread, takes meshes until there are none left
+static void lodWorker(const model* m, const vector<vector<GLuint> >* groups, vector<vector<lodLevel> >* levels,
+	atomic<size_t>* next)
+{
+	for(size_t i = (*next)++; i < m->vMesh.size(); i = (*next)++)
+	{
+		const sMesh& theMesh = m->vMesh[i];
+		if(theMesh.numInd < 3 || !theMesh.indexes || !theMesh.verts)
+			continue;
+		const vector<GLuint>& g = (*groups)[i];
+		simplifyLods(theMesh.indexes, theMesh.numInd, theMesh.verts, theMesh.numVert, g.empty() ? NULL : &g[0],
+			s_LodRatios, MAX_LODS, (*levels)[i]);
+	}
+}
+
+//builds every mesh's chain of LOD index buffers if the model's profile asks for it. Runs after splitMeshes so
+//each level indexes the same vertices its mesh draws with, and before the cache write so a cached model has
+//them already. The meshes are simplified a thread each (up to m_LodThreads), then copied into the model's
+//arena on this thread.
+void modelLoader::buildLods(model* m)
+{
+	if(!s_Profiles[m->profile].lods || m->vMesh.empty() || cancelled())
+		return;
+	LARGE_INTEGER t = timeNow();
+	//a vertex may only collapse into one pulled hardest by the same bone, so skinned parts don't smear into each other
+	vector<vector<GLuint> > groups(m->vMesh.size());
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		const sMesh& theMesh = m->vMesh[i];
+		if(!theMesh.hasBones || m->vBones.size() < theMesh.baseVert + theMesh.numVert)
+			continue;
+		groups[i].resize(theMesh.numVert);
+		for(size_t v = 0; v < theMesh.numVert; v++)
+		{
+			const vBoneData& vb = m->vBones[theMesh.baseVert + v];
+			size_t strongest = 0;
+			for(size_t b = 1; b < BONES_PER_VERTEX; b++)
+			{
+				if(vb.weights[b] > vb.weights[strongest])
+					strongest = b;
+			}
+			groups[i][v] = (GLuint)vb.IDs[strongest];
+		}
+	}
+
+	vector<vector<lodLevel> > levels(m->vMesh.size());
+	atomic<size_t> next(0);
+	size_t numThreads = m_LodThreads > 0 ? m_LodThreads : thread::hardware_concurrency();
+	if(numThreads == 0)
+		numThreads = 1;
+	if(numThreads > m->vMesh.size())
+		numThreads = m->vMesh.size();
+	vector<thread> threads;
+	for(size_t w = 1; w < numThreads; w++)
+	{
+		threads.push_back(thread(lodWorker, m, &groups, &levels, &next));
+	}
+	lodWorker(m, &groups, &levels, &next);
+	for(size_t w = 0; w < threads.size(); w++)
+	{
+		threads[w].join();
+	}
+
+	if(!m->arena)
+		m->arena = new meshArena(0);
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		sMesh& theMesh = m->vMesh[i];
+		const vector<lodLevel>& lv = levels[i];
+		size_t total = 0;
+		for(size_t l = 0; l < lv.size(); l++)
+		{
+			total += lv[l].indices.size();
+		}
+		if(total == 0)
+			continue;
+		theMesh.lodIndexes = (GLuint*)m->arena->alloc(sizeof(GLuint) * total);
+		theMesh.numLods = (GLuint)lv.size();
+		theMesh.numLodInd = (GLuint)total;
+		theMesh.lodBase = theMesh.numInd;
+		size_t at = 0;
+		for(size_t l = 0; l < lv.size(); l++)
+		{
+			theMesh.lodFirst[l] = (GLuint)at;
+			theMesh.lodCount[l] = (GLuint)lv[l].indices.size();
+			theMesh.lodError[l] = lv[l].error;
+			memcpy(&theMesh.lodIndexes[at], &lv[l].indices[0], sizeof(GLuint) * lv[l].indices.size());
+			at += lv[l].indices.size();
+			if(m_Stats)
+			{
+				lodStats lo;
+				lo.mesh = i;
+				lo.level = l + 1;
+				lo.numInd = lv[l].indices.size();
+				lo.error = lv[l].error;
+				m_Stats->lods.push_back(lo);
+			}
+		}
+	}
+	if(m_Stats)
+		m_Stats->lodSecs = secondsSince(t);
+}
+
+//splits every unskinned mesh into meshlets for setClusterCulling, if the model's profile asks for it. The
+//meshlets are runs of the index buffer as it is, so this has to come after anything that reorders it.
+void modelLoader::buildClusters(model* m)
+{
+	if(!s_Profiles[m->profile].clusters || cancelled())
+		return;
+	if(!m->arena)
+		m->arena = new meshArena(0);
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		sMesh& theMesh = m->vMesh[i];
+		//a skinned mesh's triangles go wherever its bones take them, bounds worked out now would be no use
+		if(theMesh.hasBones || theMesh.numInd < 3 || !theMesh.indexes || !theMesh.verts)
+			continue;
+		size_t n = countMeshlets(theMesh.indexes, theMesh.numInd, theMesh.numVert);
+		theMesh.meshlets = (meshlet*)m->arena->alloc(sizeof(meshlet) * n);
+		theMesh.numMeshlets = (GLuint)buildMeshlets(theMesh.meshlets, theMesh.indexes, theMesh.numInd, theMesh.verts,
+			theMesh.numVert);
+	}
+}
+
+//cuts every mesh with more than MAX_SHORT_VERTS vertices (up to MAX_SPLIT_VERTS) into pieces 16 bit indices can
+//address. Triangles are taken in order, which after optimizeMeshes keeps each piece together, so the only
+//vertices duplicated are the ones on the seams. Each piece's vertices come out in the order its indices use
+//them. Runs before the cache is written so a cached model is already split.
+void modelLoader::splitMeshes(model* m)
+{
+	bool any = false;
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		const sMesh& theMesh = m->vMesh[i];
+		if(theMesh.numVert > MAX_SHORT_VERTS && theMesh.numVert <= MAX_SPLIT_VERTS && theMesh.indexes && theMesh.verts)
+			any = true;
+	}
+	if(!any)
+		return;
+	if(!m->arena)
+		m->arena = new meshArena(0);
+
+	//every mesh after the first split moves, so the bone data is laid out again from scratch
+	vector<sMesh> meshes;
+	vector<vBoneData> bones;
+	size_t bv = 0, bi = 0;
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		sMesh& src = m->vMesh[i];
+		const vBoneData* srcBones = m->vBones.empty() ? NULL : &m->vBones[src.baseVert];
+		if(src.numVert <= MAX_SHORT_VERTS || src.numVert > MAX_SPLIT_VERTS || !src.indexes || !src.verts)
+		{
+			if(srcBones)
+				bones.insert(bones.end(), srcBones, srcBones + src.numVert);
+			src.baseVert = bv;
+			src.baseInd = bi;
+			bv += src.numVert;
+			bi += src.numInd;
+			meshes.push_back(src);
+			continue;
+		}
+
+		const GLuint none = 0xFFFFFFFF;
+		vector<GLuint> remap(src.numVert, none); //source vertex to its index in the piece being built
+		vector<GLuint> used; //the piece's vertices, by source index
+		vector<GLuint> inds;
+		size_t numTri = src.numInd / 3, pieces = 0, dupes = 0;
+		for(size_t f = 0; f <= numTri; f++)
+		{
+			bool flush = f == numTri;
+			if(!flush)
+			{
+				const GLuint* tri = &src.indexes[f * 3];
+				size_t added = (remap[tri[0]] == none) + (remap[tri[1]] == none && tri[1] != tri[0]) +
+					(remap[tri[2]] == none && tri[2] != tri[0] && tri[2] != tri[1]);
+				flush = used.size() + added > MAX_SHORT_VERTS;
+			}
+			if(flush && !inds.empty())
+			{
+				sMesh piece = src;
+				piece.numVert = (GLuint)used.size();
+				piece.numInd = (GLuint)inds.size();
+				piece.numFaces = piece.numInd / 3;
+				piece.indexType = GL_UNSIGNED_SHORT;
+				piece.baseVert = bv;
+				piece.baseInd = bi;
+				piece.indexes = (GLuint*)m->arena->alloc(sizeof(GLuint) * piece.numInd);
+				memcpy(piece.indexes, &inds[0], sizeof(GLuint) * piece.numInd);
+				piece.verts = (GLfloat*)m->arena->alloc(sizeof(GLfloat) * 3 * piece.numVert);
+				piece.normals = src.hasNorm ? (GLfloat*)m->arena->alloc(sizeof(GLfloat) * 3 * piece.numVert) : NULL;
+				piece.texCoords = src.hasTexCoords ? (GLfloat*)m->arena->alloc(sizeof(GLfloat) * 2 * piece.numVert) : NULL;
+				piece.tangents = src.hasTangents ? (GLshort*)m->arena->alloc(sizeof(GLshort) * 4 * piece.numVert) : NULL;
+				for(size_t v = 0; v < used.size(); v++)
+				{
+					GLuint o = used[v];
+					memcpy(&piece.verts[v * 3], &src.verts[o * 3], sizeof(GLfloat) * 3);
+					if(src.hasNorm) memcpy(&piece.normals[v * 3], &src.normals[o * 3], sizeof(GLfloat) * 3);
+					if(src.hasTexCoords) memcpy(&piece.texCoords[v * 2], &src.texCoords[o * 2], sizeof(GLfloat) * 2);
+					if(src.hasTangents) memcpy(&piece.tangents[v * 4], &src.tangents[o * 4], sizeof(GLshort) * 4);
+					if(srcBones) bones.push_back(srcBones[o]);
+					remap[o] = none;
+				}
+				bv += piece.numVert;
+				bi += piece.numInd;
+				dupes += piece.numVert;
+				meshes.push_back(piece);
+				pieces++;
+				used.clear();
+				inds.clear();
+			}
+			if(f == numTri)
+				break;
+			for(size_t k = 0; k < 3; k++)
+			{
+				GLuint idx = src.indexes[f * 3 + k];
+				if(remap[idx] == none)
+				{
+					remap[idx] = (GLuint)used.size();
+					used.push_back(idx);
+				}
+				inds.push_back(remap[idx]);
+			}
+		}
+		//vertices no triangle uses are dropped, so this can come out below 0
+		dupes = dupes > src.numVert ? dupes - src.numVert : 0;
+		//the source arrays stay in the arena until the model goes, a split is rare enough not to matter
+		printf("mesh %i split into %i pieces for 16 bit indices, %i vertices duplicated\n", (int)i, (int)pieces, (int)dupes);
+	}
+	m->vMesh.swap(meshes);
+	m->vBones.swap(bones);
+	m->numMesh = (GLuint)m->vMesh.size();
+}
+
+void modelLoader::makeVAO(model* m)
+{
+	if(m_SingleBuffer || m_Pool)
+	{
+		makeModelVAO(m);
+		return;
+	}
+	for (size_t i = 0; i < m->numMesh; i++)
+	{
+		uploadMesh(m, i);
+	}
+}
+
+//puts every model loaded from now on in one VAO, one vertex buffer and one index buffer, drawn mesh by mesh with
+//glDrawElementsBaseVertex. It takes the place of mesh dedup, interleaving and quantizing for those models.
+void modelLoader::setSingleBuffer(bool single)
+{
+	lock_guard<mutex> lock(m_JobLock);
+	m_SingleBuffer = single;
+}
+
+//makes models loaded from now on take a range of the shared pool buffers (see geometryPool.h) rather than
+//buffers of their own, so loading and freeing them doesn't make or delete any. It implies setSingleBuffer.
+void modelLoader::setGeometryPool(bool pool)
+{
+	lock_guard<mutex> lock(m_JobLock);
+	m_Pool = pool;
+}
+
+void modelLoader::getPoolStats(poolStats& vertex, poolStats& index)
+{
+	vertex = vertexPool().stats();
+	index = indexPool().stats();
+}
+
+//writes n indices to dst as 16 or 32 bit
+static void copyIndices(unsigned char* dst, const GLuint* src, size_t n, bool shortInd)
+{
+	if(shortInd)
+	{
+		for(size_t j = 0; j < n; j++)
+		{
+			((GLushort*)dst)[j] = (GLushort)src[j];
+		}
+	}
+	else
+		memcpy(dst, src, sizeof(GLuint) * n);
+}
+
+//the single buffer layout. The vertex buffer holds one block per attribute, each covering every vertex of the
+//model in baseVert order (so vBones goes in as it is), a mesh without an attribute the others have is zero
+//filled. Indices stay relative to their mesh, the draw adds baseVert. Returns the bytes uploaded.
+size_t modelLoader::makeModelVAO(model* m)
+{
+	size_t numVert = 0, numInd = 0;
+	bool hasNorm = false, hasTexCoords = false, hasBones = false, hasTangents = false, shortInd = true;
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		const sMesh& theMesh = m->vMesh[i];
+		numVert = max(numVert, theMesh.baseVert + theMesh.numVert);
+		numInd = max(numInd, theMesh.baseInd + theMesh.numInd);
+		hasNorm |= theMesh.hasNorm;
+		hasTexCoords |= theMesh.hasTexCoords;
+		hasBones |= theMesh.hasBones;
+		hasTangents |= theMesh.hasTangents;
+		if(theMesh.numVert > MAX_SHORT_VERTS)
+			shortInd = false;
+	}
+	if(numVert == 0 || numInd == 0)
+		return 0;
+
+	//one index type for the lot, so baseInd gives every mesh's offset. The LOD levels go after every
+	//mesh's full indices, and the shadow indices after them.
+	size_t indSize = shortInd ? sizeof(GLushort) : sizeof(GLuint);
+	size_t numLodInd = 0, numShadowInd = 0;
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		m->vMesh[i].lodBase = numInd + numLodInd;
+		numLodInd += m->vMesh[i].numLodInd;
+	}
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		m->vMesh[i].shadowBase = numInd + numLodInd + numShadowInd;
+		if(m->vMesh[i].shadowIndexes)
+			numShadowInd += m->vMesh[i].numInd;
+	}
+	vector<unsigned char> indices(indSize * (numInd + numLodInd + numShadowInd), 0);
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		sMesh& theMesh = m->vMesh[i];
+		theMesh.indexType = shortInd ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		if(!theMesh.indexes)
+			continue;
+		copyIndices(&indices[indSize * theMesh.baseInd], theMesh.indexes, theMesh.numInd, shortInd);
+		if(theMesh.lodIndexes)
+			copyIndices(&indices[indSize * theMesh.lodBase], theMesh.lodIndexes, theMesh.numLodInd, shortInd);
+		if(theMesh.shadowIndexes)
+		{
+			copyIndices(&indices[indSize * theMesh.shadowBase], theMesh.shadowIndexes, theMesh.numInd, shortInd);
+			free(theMesh.shadowIndexes);
+			theMesh.shadowIndexes = NULL;
+		}
+	}
+
+	//where each attribute's block starts
+	size_t normStride = sizeof(GLfloat) * 3 + (hasTangents ? sizeof(GLshort) * 4 : 0);
+	size_t posStart = 0;
+	size_t normStart = posStart + sizeof(GLfloat) * 3 * numVert;
+	size_t texStart = normStart + (hasNorm ? normStride * numVert : 0);
+	size_t boneStart = texStart + (hasTexCoords ? sizeof(GLfloat) * 2 * numVert : 0);
+	size_t total = boneStart + (hasBones ? sizeof(vBoneData) * numVert : 0);
+	vector<unsigned char> verts(total, 0);
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		const sMesh& theMesh = m->vMesh[i];
+		size_t bv = theMesh.baseVert;
+		if(theMesh.verts)
+			memcpy(&verts[posStart + sizeof(GLfloat) * 3 * bv], theMesh.verts, sizeof(GLfloat) * 3 * theMesh.numVert);
+		if(theMesh.hasNorm)
+		{
+			for(size_t v = 0; v < theMesh.numVert; v++)
+			{
+				unsigned char* dst = &verts[normStart + normStride * (bv + v)];
+				memcpy(dst, &theMesh.normals[v * 3], sizeof(GLfloat) * 3);
+				if(theMesh.hasTangents)
+					memcpy(dst + sizeof(GLfloat) * 3, &theMesh.tangents[v * 4], sizeof(GLshort) * 4);
 			}
+		}
+		if(theMesh.hasTexCoords)
+			memcpy(&verts[texStart + sizeof(GLfloat) * 2 * bv], theMesh.texCoords, sizeof(GLfloat) * 2 * theMesh.numVert);
+	}
+	if(hasBones && m->vBones.size() >= numVert)
+		memcpy(&verts[boneStart], &m->vBones[0], sizeof(vBoneData) * numVert);
+
+	//in the pool the model's blocks start at its range rather than at 0
+	if(m_Pool && vertexPool().alloc(verts.size(), m->vboRange))
+	{
+		if(indexPool().alloc(indices.size(), m->iboRange))
+		{
+			vertexPool().upload(m->vboRange, &verts[0], verts.size());
+			indexPool().upload(m->iboRange, &indices[0], indices.size());
+			m->vbo = vertexPool().buffer(m->vboRange);
+			m->ibo = indexPool().buffer(m->iboRange);
+			posStart += m->vboRange.offset;
+			normStart += m->vboRange.offset;
+			texStart += m->vboRange.offset;
+			boneStart += m->vboRange.offset;
+		}
+		else
+			vertexPool().free(m->vboRange);
+	}
+	glGenVertexArrays(1, &m->vao);
+	glBindVertexArray(m->vao);
+	if(m->ibo == 0)
+	{
+		glGenBuffers(1, &m->ibo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->ibo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size(), &indices[0], GL_STATIC_DRAW);
+		glGenBuffers(1, &m->vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
+		glBufferData(GL_ARRAY_BUFFER, verts.size(), &verts[0], GL_STATIC_DRAW);
+	}
+	else
+	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->ibo);
+		glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
+	}
+	if(m_Stats)
+	{
+		m_Stats->indexBytes += indices.size();
+		m_Stats->vertBytes += sizeof(GLfloat) * 3 * numVert;
+		m_Stats->normBytes += hasNorm ? normStride * numVert : 0;
+		m_Stats->texCoordBytes += hasTexCoords ? sizeof(GLfloat) * 2 * numVert : 0;
+		m_Stats->boneBytes += hasBones ? sizeof(vBoneData) * numVert : 0;
+	}
+
+	glEnableVertexAttribArray(vertAt);
+	glVertexAttribPointer(vertAt, 3, GL_FLOAT, GL_FALSE, 0, (const GLvoid*)posStart);
+	if(hasNorm)
+	{
+		glEnableVertexAttribArray(normAt);
+		glVertexAttribPointer(normAt, 3, GL_FLOAT, GL_FALSE, (GLsizei)normStride, (const GLvoid*)normStart);
+		if(hasTangents)
+		{
+			glEnableVertexAttribArray(tanAt);
+			glVertexAttribPointer(tanAt, 4, GL_SHORT, GL_TRUE, (GLsizei)normStride, (const GLvoid*)(normStart + sizeof(GLfloat) * 3));
+		}
+	}
+	if(hasTexCoords)
+	{
+		glEnableVertexAttribArray(texCAt);
+		glVertexAttribPointer(texCAt, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid*)texStart);
+	}
+	if(hasBones)
+	{
+		skinPointers(sizeof(vBoneData), boneStart);
+	}
 
-		}
-		//push back the material vector of the model with the currently used material object.
-		m->vMat.push_back(theMat);
+	//the same buffers again with nothing but what a depth pass reads
+	if(m_DepthStream)
+	{
+		glGenVertexArrays(1, &m->depthVao);
+		glBindVertexArray(m->depthVao);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->ibo);
+		glEnableVertexAttribArray(vertAt);
+		glVertexAttribPointer(vertAt, 3, GL_FLOAT, GL_FALSE, 0, (const GLvoid*)posStart);
+		if(hasBones)
+			skinPointers(sizeof(vBoneData), boneStart);
 	}
-}
 
-void modelLoader::loadVert(model* m, const aiScene*s){
-	const aiMesh *mesh;
-	const aiFace *face;
-	aiNode* theNode;
-	sMesh theMesh;
-	
-	size_t bv = 0;
-	size_t bi = 0;
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	return indices.size() + verts.size();
+}
 
-	for(size_t mCount = 0; mCount<s->mNumMeshes;mCount++){
-		mesh = s->mMeshes[mCount];
-		//set all of the values relating to the sMesh object
-		theMesh.vao = theMesh.ibo = theMesh.nbo = theMesh.vbo = theMesh.tbo = theMesh.bbo = 0;
-		theMesh.indexes=NULL;theMesh.verts=NULL;theMesh.normals=NULL;theMesh.texCoords=NULL;
-		theMesh.numFaces = s->mMeshes[mCount]->mNumFaces;
-		theMesh.numInd = s->mMeshes[mCount]->mNumFaces*3;
-		theMesh.numVert = s->mMeshes[mCount]->mNumVertices;
-		theMesh.matInd = s->mMeshes[mCount]->mMaterialIndex;
-		theMesh.baseInd = bi;
-		theMesh.baseVert = bv;
+//switches models loaded from now on between one vertex buffer per attribute (the default) and a single
+//interleaved buffer per mesh, which fetches each vertex from one place rather than four
+void modelLoader::setInterleaved(bool interleaved)
+{
+	lock_guard<mutex> lock(m_JobLock);
+	m_Interleave = interleaved;
+}
 
-		theBones.resize(theBones.size() + theMesh.numVert);
-		bi += theMesh.numInd;
-		bv += theMesh.numVert;
-		//theMesh.numFaces = mesh->mNumFaces;
-		theMesh.indexes = (unsigned int*)malloc(sizeof(unsigned int) * mesh->mNumFaces * 3);
-		unsigned int fIndex = 0;
-		
-		for(size_t i = 0; i<mesh->mNumFaces;i++){
-			face=&mesh->mFaces[i];
-			memcpy(&theMesh.indexes[fIndex], face->mIndices, 3 * sizeof(unsigned int));
-			fIndex+=3;
+//packs each vertex's attributes next to each other (position, normal, tangent, tex coord, bone IDs, bone weights,
+//skipping any the mesh doesn't have), on the loading thread so makeMeshVAO only has to upload it
+void modelLoader::packVertices(model* m)
+{
+	if((!m_Interleave && !m_Quantize) || m_SingleBuffer || m_Pool)
+		return;
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		sMesh& theMesh = m->vMesh[i];
+		if(theMesh.numVert == 0 || theMesh.verts == NULL)
+			continue;
+		if(m_Quantize)
+		{
+			quantizeMesh(m, i);
+			continue;
 		}
-
-		//create a buffer of the correct size to hold the vertex positions
-		if(mesh->HasPositions()){
-			theMesh.verts = (GLfloat *) malloc(sizeof(GLfloat) * 3 * mesh->mNumVertices);
-			memcpy(theMesh.verts, mesh->mVertices, sizeof(GLfloat)*3*mesh->mNumVertices);
+		GLuint stride = sizeof(GLfloat) * 3;
+		if(theMesh.hasNorm) stride += sizeof(GLfloat) * 3;
+		if(theMesh.hasTangents) stride += sizeof(GLshort) * 4;
+		if(theMesh.hasTexCoords) stride += sizeof(GLfloat) * 2;
+		if(theMesh.hasBones) stride += sizeof(vBoneData);
+		theMesh.stride = stride;
+		theMesh.packed = (unsigned char*)malloc(stride * theMesh.numVert);
+		for(size_t v = 0; v < theMesh.numVert; v++)
+		{
+			unsigned char* dst = theMesh.packed + stride * v;
+			memcpy(dst, &theMesh.verts[v * 3], sizeof(GLfloat) * 3);
+			dst += sizeof(GLfloat) * 3;
+			if(theMesh.hasNorm)
+			{
+				memcpy(dst, &theMesh.normals[v * 3], sizeof(GLfloat) * 3);
+				dst += sizeof(GLfloat) * 3;
+			}
+			if(theMesh.hasTangents)
+			{
+				memcpy(dst, &theMesh.tangents[v * 4], sizeof(GLshort) * 4);
+				dst += sizeof(GLshort) * 4;
+			}
+			if(theMesh.hasTexCoords)
+			{
+				memcpy(dst, &theMesh.texCoords[v * 2], sizeof(GLfloat) * 2);
+				dst += sizeof(GLfloat) * 2;
+			}
+			if(theMesh.hasBones)
+				memcpy(dst, &m->vBones[theMesh.baseVert + v], sizeof(vBoneData));
 		}
-		
-		//create a buffer of the correct size to hold the vertex normals
-		if(mesh->HasNormals()){
-			theMesh.hasNorm = true;
-			theMesh.normals = (GLfloat *) malloc(sizeof(GLfloat) * 3 * mesh->mNumVertices);
-			memcpy(theMesh.normals, mesh->mNormals, sizeof (GLfloat) * 3 * mesh->mNumVertices);
-		} else {theMesh.hasNorm = false;}
+	}
+}
 
-		//create a buffer of the correct size to hold the vertex texture positions
-		if(mesh->HasTextureCoords(0)){
-			theMesh.hasTexCoords = true;
-			theMesh.texCoords = (GLfloat *) malloc(sizeof(GLfloat) * 2 * mesh->mNumVertices);
-			for (size_t j = 0;j<mesh->mNumVertices;j++)
+//gives every mesh whose vertices were split by a UV or normal seam a second copy of its indices, pointing each
+//vertex at the first one with the same position (and bone data, for a skinned mesh). A depth pass reads nothing
+//else, so those extra vertices only cost it transforms. The triangles keep their order, so the LOD levels and
+//meshlets still line up. Like packed these wait for the upload and are freed once it is done.
+void modelLoader::buildShadowIndices(model* m)
+{
+	if(!m_DepthStream)
+		return;
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		sMesh& theMesh = m->vMesh[i];
+		if(theMesh.numInd == 0 || theMesh.indexes == NULL || theMesh.verts == NULL)
+			continue;
+		const void* data = theMesh.verts;
+		size_t vertBytes = sizeof(GLfloat) * 3;
+		vector<unsigned char> keys;
+		if(theMesh.hasBones)
+		{
+			vertBytes += sizeof(vBoneData);
+			keys.resize(vertBytes * theMesh.numVert);
+			for(size_t v = 0; v < theMesh.numVert; v++)
 			{
-				theMesh.texCoords[j*2]		= mesh->mTextureCoords[0][j].x;
-				theMesh.texCoords[j*2+1]	= mesh->mTextureCoords[0][j].y;
+				memcpy(&keys[vertBytes * v], &theMesh.verts[v * 3], sizeof(GLfloat) * 3);
+				memcpy(&keys[vertBytes * v + sizeof(GLfloat) * 3], &m->vBones[theMesh.baseVert + v], sizeof(vBoneData));
 			}
-		} else theMesh.hasTexCoords = false;
+			data = &keys[0];
+		}
+		vector<unsigned int> remap(theMesh.numVert);
+		size_t distinct = weldVertices(&remap[0], data, theMesh.numVert, vertBytes);
+		//no seams, the full indices are already as good as it gets
+		if(distinct == theMesh.numVert)
+			continue;
+		theMesh.shadowIndexes = (GLuint*)malloc(sizeof(GLuint) * theMesh.numInd);
+		for(size_t j = 0; j < theMesh.numInd; j++)
+		{
+			theMesh.shadowIndexes[j] = remap[theMesh.indexes[j]];
+		}
+		theMesh.shadowVerts = (GLuint)distinct;
+		theMesh.shadowBase = theMesh.numInd + theMesh.numLodInd;
+	}
+}
 
-		//bone stuff go here
-		if(mesh->HasBones()){
-			theMesh.hasBones = true;
-			printf("mesh %i has %i bones\n", mCount,  mesh->mNumBones);
-			//print->mlPrint("mesh ", " has bones totalling: ", mCount, mesh->mNumBones, 7);
-			loadBones(mCount, mesh, theBones, theMesh);
+//fills the bound element buffer with the mesh's indices in its indexType, followed by its LOD levels' and then
+//its shadow indices if it has any. update overwrites what is there rather than making new storage. Returns the
+//bytes uploaded.
+size_t modelLoader::uploadIndices(const sMesh& theMesh, bool update)
+{
+	const GLuint* src = theMesh.indexes;
+	size_t numShadowInd = theMesh.shadowIndexes ? theMesh.numInd : 0;
+	size_t count = theMesh.numInd + theMesh.numLodInd + numShadowInd;
+	vector<GLuint> all;
+	if((theMesh.numLodInd > 0 || numShadowInd > 0) && theMesh.indexes)
+	{
+		all.resize(count);
+		memcpy(&all[0], theMesh.indexes, sizeof(GLuint) * theMesh.numInd);
+		if(theMesh.numLodInd > 0)
+			memcpy(&all[theMesh.numInd], theMesh.lodIndexes, sizeof(GLuint) * theMesh.numLodInd);
+		if(numShadowInd > 0)
+			memcpy(&all[theMesh.shadowBase], theMesh.shadowIndexes, sizeof(GLuint) * numShadowInd);
+		src = &all[0];
+	}
+	const void* data = src;
+	size_t len = sizeof(GLuint) * count;
+	vector<GLushort> shorts;
+	if(theMesh.indexType == GL_UNSIGNED_SHORT)
+	{
+		shorts.resize(src ? count : 0);
+		for(size_t i = 0; i < shorts.size(); i++)
+		{
+			shorts[i] = (GLushort)src[i];
 		}
-		glBindVertexArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-		//push_back the model vector with the current mesh
-		m->vMesh.push_back(theMesh);
+		data = shorts.empty() ? NULL : &shorts[0];
+		len = sizeof(GLushort) * count;
 	}
+	if(update)
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, len, data);
+	else
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, len, data, GL_STATIC_DRAW);
+	return len;
 }
 
-void modelLoader::makeVAO(model* m)
+//fills the bound array buffer with the mesh's normals, each followed by its packed tangent if it has them.
+//The frame is always used together, so one buffer saves a fetch. Returns the bytes uploaded.
+size_t modelLoader::uploadNormals(const sMesh& theMesh, bool update)
 {
-	sMesh* theMesh;
-	for (size_t i = 0; i < m->numMesh; i++)
+	const void* data = theMesh.normals;
+	size_t len = sizeof(GLfloat) * 3 * theMesh.numVert;
+	vector<unsigned char> frames;
+	if(theMesh.hasTangents)
 	{
-		theMesh = &m->vMesh[i];
+		const size_t stride = sizeof(GLfloat) * 3 + sizeof(GLshort) * 4;
+		frames.resize(stride * theMesh.numVert);
+		for(size_t v = 0; v < theMesh.numVert; v++)
+		{
+			memcpy(&frames[stride * v], &theMesh.normals[v * 3], sizeof(GLfloat) * 3);
+			memcpy(&frames[stride * v + sizeof(GLfloat) * 3], &theMesh.tangents[v * 4], sizeof(GLshort) * 4);
+		}
+		data = frames.empty() ? NULL : &frames[0];
+		len = frames.size();
+	}
+	if(update)
+		glBufferSubData(GL_ARRAY_BUFFER, 0, len, data);
+	else
+		glBufferData(GL_ARRAY_BUFFER, len, data, GL_STATIC_DRAW);
+	return len;
+}
 
-		//generate vertex array object for each mesh
-		glGenVertexArrays(1, &m->vMesh[i].vao);
-		glBindVertexArray(m->vMesh[i].vao);
+//makes mesh i's GL objects, or points it at an identical mesh that already has them
+void modelLoader::uploadMesh(model* m, size_t i)
+{
+	if(m_Dedup)
+		shareMesh(m, i);
+	else
+		makeMeshVAO(m, i);
+}
+
+//points the bone attributes of the bound VAO at a vBoneData every stride bytes from offset in the bound array
+//buffer. The IDs go in as integers and the weights as unorm8, which the shader reads back as floats.
+void modelLoader::skinPointers(GLsizei stride, size_t offset)
+{
+	glEnableVertexAttribArray(boneAt);
+	glVertexAttribIPointer(boneAt, BONES_PER_VERTEX, GL_UNSIGNED_BYTE, stride, (const GLvoid*)(offset + offsetof(vBoneData, IDs)));
+	glEnableVertexAttribArray(boneWLoc);
+	glVertexAttribPointer(boneWLoc, BONES_PER_VERTEX, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+		(const GLvoid*)(offset + offsetof(vBoneData, weights)));
+}
+
+//creates the VAO and buffers of mesh i
+void modelLoader::makeMeshVAO(model* m, size_t i)
+{
+	sMesh* theMesh = &m->vMesh[i];
+
+	//generate vertex array object for the mesh
+	glGenVertexArrays(1, &m->vMesh[i].vao);
+	glBindVertexArray(m->vMesh[i].vao);
 
-		//generate a buffer for the faces
-		glGenBuffers(1, &theMesh->ibo);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, theMesh->ibo);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, 
-			sizeof(unsigned int) * theMesh->numInd, m->vMesh[i].indexes, GL_STATIC_DRAW);
+	//generate a buffer for the faces, it stays bound to the VAO
+	glGenBuffers(1, &theMesh->ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, theMesh->ibo);
+	size_t indBytes = uploadIndices(*theMesh, false);
+	if(m_Stats) m_Stats->indexBytes += indBytes;
 
+	//the interleaved layout, one buffer and one fetch stream holding every attribute
+	if(theMesh->packed)
+	{
+		glGenBuffers(1, &theMesh->vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, theMesh->vbo);
+		glBufferData(GL_ARRAY_BUFFER, theMesh->stride * theMesh->numVert, theMesh->packed, GL_STATIC_DRAW);
+		if(m_Stats) m_Stats->vertBytes += theMesh->stride * theMesh->numVert;
+		if(theMesh->quantized)
+		{
+			quantPointers(*theMesh);
+		}
+		else
+		{
+			//the order here has to match packVertices
+			size_t offset = 0;
+			glEnableVertexAttribArray(vertAt);
+			glVertexAttribPointer(vertAt, 3, GL_FLOAT, GL_FALSE, theMesh->stride, (const GLvoid*)offset);
+			offset += sizeof(GLfloat) * 3;
+			if(theMesh->hasNorm)
+			{
+				glEnableVertexAttribArray(normAt);
+				glVertexAttribPointer(normAt, 3, GL_FLOAT, GL_FALSE, theMesh->stride, (const GLvoid*)offset);
+				offset += sizeof(GLfloat) * 3;
+			}
+			if(theMesh->hasTangents)
+			{
+				glEnableVertexAttribArray(tanAt);
+				glVertexAttribPointer(tanAt, 4, GL_SHORT, GL_TRUE, theMesh->stride, (const GLvoid*)offset);
+				offset += sizeof(GLshort) * 4;
+			}
+			if(theMesh->hasTexCoords)
+			{
+				glEnableVertexAttribArray(texCAt);
+				glVertexAttribPointer(texCAt, 2, GL_FLOAT, GL_FALSE, theMesh->stride, (const GLvoid*)offset);
+				offset += sizeof(GLfloat) * 2;
+			}
+			if(theMesh->hasBones)
+				skinPointers(theMesh->stride, offset);
+		}
+		//the separate arrays are still about for everything else, this copy was only for GL
+		free(theMesh->packed);
+		theMesh->packed = NULL;
+	}
+	else
+	{
 		//generate a buffer for the vertex positions
 		if(theMesh->numVert > 0)
 		{
@@ -269,6 +2249,7 @@ void modelLoader::makeVAO(model* m)
 			glBindBuffer(GL_ARRAY_BUFFER, theMesh->vbo);
 			glBufferData(GL_ARRAY_BUFFER, 
 				sizeof(GLfloat)*3*theMesh->numVert, theMesh->verts, GL_STATIC_DRAW);	
+			if(m_Stats) m_Stats->vertBytes += sizeof(GLfloat)*3*theMesh->numVert;
 			glEnableVertexAttribArray(vertAt);
 			glVertexAttribPointer(vertAt, 3, GL_FLOAT, 0, 0, 0);
 		}
@@ -278,10 +2259,17 @@ void modelLoader::makeVAO(model* m)
 		{
 			glGenBuffers(1, &theMesh->nbo);
 			glBindBuffer(GL_ARRAY_BUFFER, theMesh->nbo);
-			glBufferData(GL_ARRAY_BUFFER, 
-				sizeof(GLfloat)*3*theMesh->numVert, theMesh->normals, GL_STATIC_DRAW);	
+			size_t normBytes = uploadNormals(*theMesh, false);
+			if(m_Stats) m_Stats->normBytes += normBytes;
+			//the tangents share the normals' buffer, see uploadNormals
+			GLsizei normStride = theMesh->hasTangents ? sizeof(GLfloat) * 3 + sizeof(GLshort) * 4 : 0;
 			glEnableVertexAttribArray(normAt);
-			glVertexAttribPointer(normAt, 3, GL_FLOAT, 0, 0, 0);
+			glVertexAttribPointer(normAt, 3, GL_FLOAT, 0, normStride, 0);
+			if(theMesh->hasTangents)
+			{
+				glEnableVertexAttribArray(tanAt);
+				glVertexAttribPointer(tanAt, 4, GL_SHORT, GL_TRUE, normStride, (const GLvoid*)(sizeof(GLfloat) * 3));
+			}
 		}
 
 		//generate a buffer for the texture coords
@@ -291,6 +2279,7 @@ void modelLoader::makeVAO(model* m)
 			glBindBuffer(GL_ARRAY_BUFFER, theMesh->tbo);
 			glBufferData(GL_ARRAY_BUFFER, 
 				sizeof(float)*2*theMesh->numVert, theMesh->texCoords, GL_STATIC_DRAW);	
+			if(m_Stats) m_Stats->texCoordBytes += sizeof(float)*2*theMesh->numVert;
 			glEnableVertexAttribArray(texCAt);
 			glVertexAttribPointer(texCAt, 2, GL_FLOAT, 0, 0, 0);
 		}
@@ -300,26 +2289,171 @@ void modelLoader::makeVAO(model* m)
 		{
 			glGenBuffers(1, &theMesh->bbo);
 			glBindBuffer(GL_ARRAY_BUFFER, theMesh->bbo);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(theBones[0]) * theBones.size(), &theBones[0], GL_STATIC_DRAW);
-			glEnableVertexAttribArray(boneAt);
-			glVertexAttribIPointer(boneAt, 4, GL_INT, sizeof(vBoneData), (const GLvoid*)0);
-			glEnableVertexAttribArray(boneWLoc);
-			glVertexAttribPointer(boneWLoc, 4, GL_FLOAT, GL_FALSE, sizeof(vBoneData), (const GLvoid*)16);
+			//only this mesh's slice of the model's bone data, it starts at the mesh's baseVert
+			glBufferData(GL_ARRAY_BUFFER, sizeof(vBoneData) * theMesh->numVert, &m->vBones[theMesh->baseVert], GL_STATIC_DRAW);
+			if(m_Stats) m_Stats->boneBytes += sizeof(vBoneData) * theMesh->numVert;
+			skinPointers(sizeof(vBoneData), 0);
+		}
+	}
+
+	if(m_DepthStream)
+		makeDepthVAO(*theMesh);
+	//they are in the index buffer now
+	free(theMesh->shadowIndexes);
+	theMesh->shadowIndexes = NULL;
+
+	//finally unbind the buffers
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+//a second VAO over the mesh's buffers with only the position and, for a skinned mesh, the bones enabled. The
+//layouts are makeMeshVAO's, an interleaved vertex has its position first and its bones last.
+void modelLoader::makeDepthVAO(sMesh& theMesh)
+{
+	if(theMesh.vbo == 0)
+		return;
+	glGenVertexArrays(1, &theMesh.depthVao);
+	glBindVertexArray(theMesh.depthVao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, theMesh.ibo);
+	glBindBuffer(GL_ARRAY_BUFFER, theMesh.vbo);
+	glEnableVertexAttribArray(vertAt);
+	if(theMesh.quantized)
+		glVertexAttribPointer(vertAt, 3, GL_UNSIGNED_SHORT, GL_TRUE, theMesh.stride, (const GLvoid*)0);
+	else
+		glVertexAttribPointer(vertAt, 3, GL_FLOAT, GL_FALSE, theMesh.stride, (const GLvoid*)0);
+	if(!theMesh.hasBones)
+		return;
+	if(theMesh.stride != 0)
+		skinPointers(theMesh.stride, theMesh.stride - sizeof(vBoneData));
+	else
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, theMesh.bbo);
+		skinPointers(sizeof(vBoneData), 0);
+	}
+}
+
+//turns on picking a LOD for every mesh in renderModel, from the size the model comes out on screen.
+//fovY is the vertical field of view in radians, pixelError the most a level may be off by in pixels.
+//A pixelError of 0 turns it off and leaves each mesh's lod as it is.
+void modelLoader::setLodSelection(float viewportHeight, float fovY, float pixelError)
+{
+	m_LodPixels = pixelError;
+	m_LodPixelsPerUnit = viewportHeight / (2.0f * tanf(fovY * 0.5f));
+}
+
+//sets each mesh's lod to the coarsest level whose error, seen at the nearest point of the model's bounding
+//sphere, is within the pixel error given to setLodSelection. Uses m->ModelView, so that has to be this frame's.
+void modelLoader::selectLods(model* m)
+{
+	const glm::mat4& mv = m->ModelView;
+	//model units to view units, the largest axis if the scale isn't uniform
+	float scale = 0.0f;
+	for(int c = 0; c < 3; c++)
+	{
+		float len = sqrtf(mv[c].x * mv[c].x + mv[c].y * mv[c].y + mv[c].z * mv[c].z);
+		if(len > scale)
+			scale = len;
+	}
+	float z = mv[0].z * m->centre.x + mv[1].z * m->centre.y + mv[2].z * m->centre.z + mv[3].z;
+	float dist = -z - m->radius * scale;
+	for(size_t i = 0; i < m->vMesh.size(); i++)
+	{
+		sMesh& theMesh = m->vMesh[i];
+		theMesh.lod = 0;
+		//the camera is inside the sphere, nothing but the full mesh will do
+		if(dist <= 0.0f)
+			continue;
+		float pixels = m_LodPixelsPerUnit * scale / dist;
+		for(GLuint l = theMesh.numLods; l > 0; l--)
+		{
+			if(theMesh.lodError[l - 1] * pixels <= m_LodPixels)
+			{
+				theMesh.lod = l;
+				break;
+			}
 		}
+	}
+}
+
+//turns on meshlet culling in renderModel, for models from a profile that builds them. Culls against the
+//frustum in m->MVP and, if backfaces is set, drops meshlets facing wholly away from the camera in m->ModelView.
+//Leave backfaces off for anything drawn two sided.
+void modelLoader::setClusterCulling(bool cull, bool backfaces)
+{
+	m_ClusterCull = cull;
+	m_CullBackfaces = backfaces;
+}
+
+//what cluster culling has dropped since the last reset
+cullStats modelLoader::getCullStats(bool reset)
+{
+	cullStats cs = m_CullStats;
+	if(reset)
+		memset(&m_CullStats, 0, sizeof(m_CullStats));
+	return cs;
+}
 
-		//finally unbind the buffers
-		glBindVertexArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+//culls a mesh's meshlets and fills the multi draw arrays with the ranges left, as byte offsets from base in
+//the bound index buffer. Returns the number of ranges.
+size_t modelLoader::cullClusters(const sMesh& theMesh, const float planes[6][4], const float* camPos, size_t base)
+{
+	size_t n = theMesh.numMeshlets;
+	if(m_CullFirst.size() < n)
+	{
+		m_CullFirst.resize(n);
+		m_CullCount.resize(n);
+		m_DrawCounts.resize(n);
+		m_DrawOffsets.resize(n);
+		m_DrawBaseVerts.resize(n);
+	}
+	size_t ranges = cullMeshlets(theMesh.meshlets, n, planes, camPos, &m_CullFirst[0], &m_CullCount[0], m_CullStats);
+	size_t indSize = theMesh.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+	for(size_t r = 0; r < ranges; r++)
+	{
+		m_DrawCounts[r] = (GLsizei)m_CullCount[r];
+		m_DrawOffsets[r] = (const GLvoid*)(base + indSize * m_CullFirst[r]);
+		m_DrawBaseVerts[r] = (GLint)theMesh.baseVert;
 	}
+	return ranges;
 }
 
 void modelLoader::renderModel(model* m)
 {
+	if(m_LodPixels > 0.0f)
+		selectLods(m);
+	//quantized meshes need their scale and offset in the shader, looked up the first time one comes along
+	GLint posScaleLoc = -1, posOffsetLoc = -1, uvScaleLoc = -1, uvOffsetLoc = -1;
+	bool haveLocs = false;
+	//the frustum and camera in model space, worked out the first time a mesh is cluster culled
+	float planes[6][4], camPos[3];
+	bool cullReady = false, haveCam = false;
+	//a single buffer model binds its VAO once, every mesh is an offset into it
+	if(m->vao)
+		glBindVertexArray(m->vao);
 	//bind the VAO so the model and its associated vbos display
 	for (size_t i = 0; i< m->numMesh; i++)
 	{
-		glBindVertexArray(m->vMesh[i].vao);
+		if(!m->vao)
+			glBindVertexArray(m->vMesh[i].vao);
+		if(m->vMesh[i].quantized)
+		{
+			if(!haveLocs)
+			{
+				GLint prog = 0;
+				glGetIntegerv(GL_CURRENT_PROGRAM, &prog);
+				posScaleLoc = glGetUniformLocation(prog, "posScale");
+				posOffsetLoc = glGetUniformLocation(prog, "posOffset");
+				uvScaleLoc = glGetUniformLocation(prog, "uvScale");
+				uvOffsetLoc = glGetUniformLocation(prog, "uvOffset");
+				haveLocs = true;
+			}
+			glUniform3fv(posScaleLoc, 1, m->vMesh[i].posScale);
+			glUniform3fv(posOffsetLoc, 1, m->vMesh[i].posOffset);
+			glUniform2fv(uvScaleLoc, 1, m->vMesh[i].uvScale);
+			glUniform2fv(uvOffsetLoc, 1, m->vMesh[i].uvOffset);
+		}
 
 		glActiveTexture(GL_TEXTURE1);
 		glBindTexture(GL_TEXTURE_2D, m->vMat[m->vMesh[i].matInd].matNorm);
@@ -343,53 +2477,130 @@ void modelLoader::renderModel(model* m)
 		glGenerateMipmap(GL_TEXTURE_2D);
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-		glDrawElements(GL_TRIANGLES, m->vMesh[i].numInd, GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		//the full mesh, or one of its LOD levels further along the same index buffer
+		const sMesh& theMesh = m->vMesh[i];
+		size_t first = m->vao ? theMesh.baseInd : 0;
+		GLuint count = theMesh.numInd;
+		if(theMesh.lod > 0 && theMesh.lod <= theMesh.numLods)
+		{
+			first = theMesh.lodBase + theMesh.lodFirst[theMesh.lod - 1];
+			count = theMesh.lodCount[theMesh.lod - 1];
+		}
+		//or just the meshlets of the full mesh that could be seen
+		bool cull = m_ClusterCull && theMesh.lod == 0 && theMesh.meshlets && theMesh.numMeshlets > 0;
+		if(cull && !cullReady)
+		{
+			frustumPlanes(&m->MVP[0].x, planes);
+			haveCam = m_CullBackfaces && cameraPosition(&m->ModelView[0].x, camPos);
+			cullReady = true;
+		}
+		drawMesh(m, theMesh, first, count, cull ? planes : NULL, haveCam ? camPos : NULL);
 	}
+	glBindVertexArray(0);
 }
 
-void modelLoader::freeModel(model* m)
+//draws count of the mesh's indices starting at first in its index buffer. With planes, only the meshlets that
+//survive culling against them (and camPos, if that isn't NULL) are drawn, in as few ranges as they join up into,
+//and first has to be the start of a copy of the full mesh's indices.
+void modelLoader::drawMesh(model* m, const sMesh& theMesh, size_t first, GLuint count, const float (*planes)[4],
+	const float* camPos)
 {
-	glBindVertexArray(0);
-	printf("delete model and free memory\n");
-	for(size_t i = 0; i < m->numMesh;i++)
+	size_t indSize = theMesh.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+	size_t base = (m->vao ? m->iboRange.offset : 0) + indSize * first;
+	if(planes)
 	{
-		if(m->vMesh[i].ibo != 0)
-		{
-			glDeleteVertexArrays(1, &m->vMesh[i].ibo);
-			free(m->vMesh[i].indexes);
-			printf("Your vao has been deleted, ");
-		}
-		if(m->vMesh[i].vbo != 0)
-		{
-			glDeleteVertexArrays(1, &m->vMesh[i].vbo);
-			free(m->vMesh[i].verts);
-			printf("Your vbo has been deleted, ");
-		}
-		if(m->vMesh[i].nbo != 0)
+		size_t ranges = cullClusters(theMesh, planes, camPos, base);
+		if(ranges > 0 && m->vao)
+			glMultiDrawElementsBaseVertex(GL_TRIANGLES, &m_DrawCounts[0], theMesh.indexType, &m_DrawOffsets[0],
+				(GLsizei)ranges, &m_DrawBaseVerts[0]);
+		else if(ranges > 0)
+			glMultiDrawElements(GL_TRIANGLES, &m_DrawCounts[0], theMesh.indexType, &m_DrawOffsets[0], (GLsizei)ranges);
+		return;
+	}
+	if(m->vao)
+		glDrawElementsBaseVertex(GL_TRIANGLES, count, theMesh.indexType, (const GLvoid*)base, (GLint)theMesh.baseVert);
+	else
+		glDrawElements(GL_TRIANGLES, count, theMesh.indexType, (const GLvoid*)base);
+}
+
+//gives every mesh of models loaded from now on a depth only VAO for renderModelDepthOnly, and welded shadow
+//indices where seams split its vertices (see buildShadowIndices)
+void modelLoader::setDepthStream(bool depth)
+{
+	lock_guard<mutex> lock(m_JobLock);
+	m_DepthStream = depth;
+}
+
+//draws the model for a shadow map or depth prepass with whatever program is bound: positions only (and bones for
+//skinned meshes), no textures or material state. m->MVP is the pass's own, the light's for a shadow map. Each
+//mesh is drawn at the lod renderModel last gave it, so a prepass matches the colour pass. Cluster culling only
+//culls against the frustum here, a caster facing away from the camera still casts. Meshes without a depth VAO
+//go through their normal one.
+void modelLoader::renderModelDepthOnly(model* m)
+{
+	GLint posScaleLoc = -1, posOffsetLoc = -1;
+	bool haveLocs = false;
+	float planes[6][4];
+	bool cullReady = false;
+	if(m->vao)
+		glBindVertexArray(m->depthVao ? m->depthVao : m->vao);
+	for(size_t i = 0; i < m->numMesh; i++)
+	{
+		const sMesh& theMesh = m->vMesh[i];
+		if(!m->vao)
+			glBindVertexArray(theMesh.depthVao ? theMesh.depthVao : theMesh.vao);
+		if(theMesh.quantized)
 		{
-			glDeleteVertexArrays(1, &m->vMesh[i].nbo);
-			free(m->vMesh[i].normals);
-			printf("Your nbo has been deleted, ");
+			if(!haveLocs)
+			{
+				GLint prog = 0;
+				glGetIntegerv(GL_CURRENT_PROGRAM, &prog);
+				posScaleLoc = glGetUniformLocation(prog, "posScale");
+				posOffsetLoc = glGetUniformLocation(prog, "posOffset");
+				haveLocs = true;
+			}
+			glUniform3fv(posScaleLoc, 1, theMesh.posScale);
+			glUniform3fv(posOffsetLoc, 1, theMesh.posOffset);
 		}
-		if(m->vMesh[i].ibo != 0)
+		//the welded copy of the full mesh if there is one, it has the same triangles in the same order
+		size_t first = m->vao ? theMesh.baseInd : 0;
+		GLuint count = theMesh.numInd;
+		if(theMesh.lod > 0 && theMesh.lod <= theMesh.numLods)
 		{
-			glDeleteVertexArrays(1, &m->vMesh[i].tbo);
-			free(m->vMesh[i].texCoords);
-			printf("Your tbo has been deleted, ");
+			first = theMesh.lodBase + theMesh.lodFirst[theMesh.lod - 1];
+			count = theMesh.lodCount[theMesh.lod - 1];
 		}
-		if(m->vMesh[i].vao != 0)
+		else if(theMesh.shadowVerts > 0)
+			first = theMesh.shadowBase;
+		bool cull = m_ClusterCull && theMesh.lod == 0 && theMesh.meshlets && theMesh.numMeshlets > 0;
+		if(cull && !cullReady)
 		{
-			glDeleteVertexArrays(1, &m->vMesh[i].vao);
-			printf("Your vao has been deleted.");
+			frustumPlanes(&m->MVP[0].x, planes);
+			cullReady = true;
 		}
+		drawMesh(m, theMesh, first, count, cull ? planes : NULL, NULL);
+	}
+	glBindVertexArray(0);
+}
+
+void modelLoader::freeModel(model* m)
+{
+	//shared models only go once nothing else is using them
+	if(!m->regKey.empty())
+	{
+		releaseModel(m);
+		return;
 	}
-	free(m);
+	unwatchModel(m);
+	printf("delete model and free memory\n");
+	releaseGL(m);
+	discardModel(m);
 }
 
 void modelLoader::loadBones(size_t meshInd, const aiMesh* m, vector<vBoneData>& bones, sMesh smash)
 {
 	int bonerCount = 0;
+	vector<rawBones> raw(m->mNumVertices);
 	for(size_t i = 0; i < m->mNumBones; i++)
 	{
 		size_t bIndex = 0;
@@ -407,163 +2618,158 @@ void modelLoader::loadBones(size_t meshInd, const aiMesh* m, vector<vBoneData>&
 		
 		for(size_t j = 0; j < m->mBones[i]->mNumWeights; j++)
 		{
-			size_t vertID = smash.baseVert + m->mBones[i]->mWeights[j].mVertexId; //possible point of contention if tings don't work
+			size_t vertID = m->mBones[i]->mWeights[j].mVertexId; //possible point of contention if tings don't work
 			float weight = m->mBones[i]->mWeights[j].mWeight;
-			bones[vertID].addBoneData(bIndex, weight);
+			if(vertID < raw.size())
+				raw[vertID].add(bIndex, weight);
 		}
 		bonerCount++;
 	}
+	//the IDs are bytes on the GPU
+	if(numBones > 256)
+		printf("WARNING: %i bones, only the first 256 can be skinned to\n", (int)numBones);
+	for(size_t v = 0; v < raw.size(); v++)
+	{
+		bones[smash.baseVert + v].setBones(raw[v].IDs, raw[v].weights);
+	}
 	//print->loaded("bone(s) successfully", bonerCount, 2);
 	printf("Succesfully loaded bones: %i", bonerCount);
 }
 
-size_t modelLoader::findPosition(float animTime, const aiNodeAnim* pNodeAnim)
+void modelLoader::resetBones()
 {
-	for(size_t i = 0; i < pNodeAnim->mNumPositionKeys - 1; i++)
-	{
-		if(animTime < (float)pNodeAnim->mPositionKeys[i + 1].mTime)
-		{
-			return i; 
-		}
-	}
-	assert(0);
-	return 0;
+	m_Bonemapping.clear();
+	m_BoneInfo.clear();
+	numBones = 0;
+	m_Skeleton.clear();
 }
 
-size_t modelLoader::findRotation(float animTime, const aiNodeAnim* pNodeAnim)
+//returns i such that times[i] <= animTime < times[i + 1], times needs at least 2 keys
+static size_t findKey(float animTime, const vector<float>& times)
 {
-	assert(pNodeAnim->mNumRotationKeys > 0);
-	for( size_t i = 0; i < pNodeAnim->mNumRotationKeys-1; i++)
+	for(size_t i = 0; i < times.size() - 1; i++)
 	{
-		if (animTime < (float)pNodeAnim->mRotationKeys[i + 1].mTime)
+		if(animTime < times[i + 1])
 		{
-			return i;
+			return i; 
 		}
 	}
 	assert(0);
 	return 0;
 }
 
-size_t modelLoader::findScaling(float animTime, const aiNodeAnim* pNodeAnim)
+//how far animTime is between times[i] and times[i + 1]
+static float keyFactor(float animTime, const vector<float>& times, size_t i)
 {
-	assert(pNodeAnim->mNumScalingKeys > 0); 
-	for (size_t i = 0; i < pNodeAnim->mNumScalingKeys - 1; i++)
-	{
-		if(animTime < pNodeAnim->mScalingKeys[i+1].mTime)
-		{
-			return i; 
-		}
-	}
-	assert(0);
-	return 0;
+	float deltaTime = times[i + 1] - times[i];
+	float factor = (animTime - times[i]) / deltaTime;
+	assert(factor >= 0.0f && factor <= 1.0f);
+	return factor;
 }
 
-void modelLoader::calcInterpPosition(aiVector3D& out, float animTime, const aiNodeAnim* pNodeAnim)
+void modelLoader::calcInterpPosition(aiVector3D& out, float animTime, const animChannel& ch)
 {
-	if(pNodeAnim->mNumPositionKeys == 1)
+	if(ch.pos.size() <= 1)
 	{
-		out = pNodeAnim->mPositionKeys[0].mValue;
+		out = ch.pos.empty() ? aiVector3D(0.0f, 0.0f, 0.0f) : ch.pos[0];
 		return;
 	}
-	size_t posIndex = findPosition(animTime, pNodeAnim);
-	size_t nextPosIndex = (posIndex + 1);
-	assert(nextPosIndex < pNodeAnim->mNumPositionKeys);
-	float deltaTime = (float)(pNodeAnim->mPositionKeys[nextPosIndex].mTime - pNodeAnim->mPositionKeys[posIndex].mTime);
-	float factor = (animTime - (float)pNodeAnim->mPositionKeys[posIndex].mTime) / deltaTime;
-	assert(factor >=0.0f && factor <= 1.0f);
-	const aiVector3D& start = pNodeAnim->mPositionKeys[posIndex].mValue;
-	const aiVector3D& end = pNodeAnim->mPositionKeys[nextPosIndex].mValue;
+	size_t posIndex = findKey(animTime, ch.posTimes);
+	float factor = keyFactor(animTime, ch.posTimes, posIndex);
+	const aiVector3D& start = ch.pos[posIndex];
+	const aiVector3D& end = ch.pos[posIndex + 1];
 	aiVector3D delta = end - start;
 	out = start + factor * delta;
 }
 
-void modelLoader::calcInterpRotation(aiQuaternion& out, float animTime, const aiNodeAnim* pNodeAnim)
+void modelLoader::calcInterpRotation(aiQuaternion& out, float animTime, const animChannel& ch)
 {
 	//we need at least 2 values to interpolate!!!!
-	if(pNodeAnim->mNumRotationKeys == 1)
+	if(ch.rot.size() <= 1)
 	{
-		out = pNodeAnim->mRotationKeys[0].mValue;
+		out = ch.rot.empty() ? aiQuaternion() : ch.rot[0];
 		return;
 	}
-
-	size_t rotInd = findRotation(animTime, pNodeAnim);
-	size_t nextRotInd = (rotInd + 1);
-	assert(nextRotInd < pNodeAnim->mNumRotationKeys);
-	float deltaTime = (float)(pNodeAnim->mRotationKeys[nextRotInd].mTime - pNodeAnim->mRotationKeys[rotInd].mTime);
-	float factor = (animTime - (float) pNodeAnim->mRotationKeys[rotInd].mTime) / deltaTime;
-	assert(factor >= 0.0f && factor <= 1.0f);
-	const aiQuaternion& sRotQ = pNodeAnim->mRotationKeys[rotInd].mValue;
-	const aiQuaternion& eRotQ = pNodeAnim->mRotationKeys[nextRotInd].mValue;
-	aiQuaternion::Interpolate(out, sRotQ, eRotQ, factor);
+	size_t rotInd = findKey(animTime, ch.rotTimes);
+	float factor = keyFactor(animTime, ch.rotTimes, rotInd);
+	aiQuaternion::Interpolate(out, ch.rot[rotInd], ch.rot[rotInd + 1], factor);
 	out = out.Normalize();
 }
 
-void modelLoader::calcInterpScaling(aiVector3D& out, float animTime, const aiNodeAnim* pNodeAnim)
+void modelLoader::calcInterpScaling(aiVector3D& out, float animTime, const animChannel& ch)
 {
-	if(pNodeAnim->mNumScalingKeys == 1)
+	if(ch.scale.size() <= 1)
 	{
-		out = pNodeAnim->mScalingKeys[0].mValue;
+		out = ch.scale.empty() ? aiVector3D(1.0f, 1.0f, 1.0f) : ch.scale[0];
 		return;
 	}
-	size_t sIndex = findScaling(animTime, pNodeAnim);
-	size_t nextSIndex = (sIndex+1);
-	assert(nextSIndex < pNodeAnim->mNumScalingKeys);
-	float deltaTime = (float)(pNodeAnim->mScalingKeys[nextSIndex].mTime - pNodeAnim->mScalingKeys[sIndex].mTime);
-	float factor = (animTime - (float) pNodeAnim->mScalingKeys[sIndex].mTime) / deltaTime;
-	assert(factor >= 0.0f && factor <= 1.0f); 
-	const aiVector3D& start =  pNodeAnim->mScalingKeys[sIndex].mValue;
-	const aiVector3D& end = pNodeAnim->mScalingKeys[nextSIndex].mValue;
+	size_t sIndex = findKey(animTime, ch.scaleTimes);
+	float factor = keyFactor(animTime, ch.scaleTimes, sIndex);
+	const aiVector3D& start = ch.scale[sIndex];
+	const aiVector3D& end = ch.scale[sIndex + 1];
 	aiVector3D delta = end - start;
 	out = start + factor * delta; 
 }
 
-void modelLoader::readNodeHierarchy(float animTime, const aiNode* pNode, const Matrix_4f& parentTrans)
+//works out every node's global transform in one pass over the flattened hierarchy (parents come first)
+//and the final transform of every bone attached to one
+void modelLoader::readNodeHierarchy(float animTime, const animClip& clip)
 {
-	string nodeName = pNode->mName.data;
-	const aiAnimation* pAnim = theScene->mAnimations[0];
-	Matrix_4f nodeTransformation(pNode->mTransformation);
-	const aiNodeAnim* pNodeAnim = findNodeAnim(pAnim, nodeName);
-	if(pNodeAnim)
+	m_NodeGlobals.resize(m_Skeleton.nodes.size());
+	for(size_t i = 0; i < m_Skeleton.nodes.size(); i++)
 	{
-		//interpolate scaling and gen the scaling transform matrix
-		aiVector3D scaling;
-		calcInterpScaling(scaling, animTime, pNodeAnim);
-		Matrix_4f sMat; //scaling matrix
-		sMat.InitScaleTransform(scaling.x, scaling.y, scaling.z);
-
-		//interpolate the rotation and gen rotation transform matrix
-		aiQuaternion rotQ;
-		calcInterpRotation(rotQ, animTime, pNodeAnim);
-		Matrix_4f rotM = Matrix_4f(rotQ.GetMatrix());
+		const skelNode& node = m_Skeleton.nodes[i];
+		Matrix_4f nodeTransformation = node.bind;
+		int channel = clip.nodeChannel[i];
+		if(channel >= 0)
+		{
+			const animChannel& ch = clip.channels[channel];
+			//interpolate scaling and gen the scaling transform matrix
+			aiVector3D scaling;
+			calcInterpScaling(scaling, animTime, ch);
+			Matrix_4f sMat; //scaling matrix
+			sMat.InitScaleTransform(scaling.x, scaling.y, scaling.z);
 
-		//interpolate the translation and gen translation transform matrix
-		aiVector3D trans;
-		calcInterpPosition(trans, animTime, pNodeAnim);
-		Matrix_4f transM; 
-		transM.InitTranslationTransform(trans.x, trans.y, trans.z); 
+			//interpolate the rotation and gen rotation transform matrix
+			aiQuaternion rotQ;
+			calcInterpRotation(rotQ, animTime, ch);
+			Matrix_4f rotM = Matrix_4f(rotQ.GetMatrix());
 
-		//finally, combine all of the above transformations
-		nodeTransformation = transM * rotM * sMat;
-	}
+			//interpolate the translation and gen translation transform matrix
+			aiVector3D trans;
+			calcInterpPosition(trans, animTime, ch);
+			Matrix_4f transM; 
+			transM.InitTranslationTransform(trans.x, trans.y, trans.z); 
 
-	Matrix_4f globalTrans = parentTrans * nodeTransformation;
-	if(m_Bonemapping.find(nodeName) != m_Bonemapping.end() )
-	{
-		size_t boneInd = m_Bonemapping[nodeName];
-		m_BoneInfo[boneInd].finalTrans = m_GlobalInverseTransform * globalTrans * m_BoneInfo[boneInd].boneOffset;
-	}
+			//finally, combine all of the above transformations
+			nodeTransformation = transM * rotM * sMat;
+		}
 
-	for(size_t x = 0; x < pNode->mNumChildren; x ++)
-	{
-		readNodeHierarchy(animTime, pNode->mChildren[x], globalTrans);
+		if(node.parent >= 0)
+			m_NodeGlobals[i] = m_NodeGlobals[node.parent] * nodeTransformation;
+		else
+			m_NodeGlobals[i] = nodeTransformation;
+		if(node.bone >= 0)
+		{
+			m_BoneInfo[node.bone].finalTrans = m_GlobalInverseTransform * m_NodeGlobals[i] * m_BoneInfo[node.bone].boneOffset;
+		}
 	}
 }
 
 void modelLoader::boneTransform(float secs, vector<Matrix_4f>& transforms, int anim, float& antime)
 {
-	Matrix_4f ident;
-	ident.InitIdentity();
-	float tps = (float) (theScene->mAnimations[0]->mTicksPerSecond != 0 ? theScene->mAnimations[0]->mTicksPerSecond : 25.0f);//ticks per second
+	transforms.resize(numBones);
+	//nothing to animate, leave the bones where they are
+	if(m_Skeleton.anims.empty())
+	{
+		for(size_t i = 0; i< numBones; i++)
+		{
+			transforms[i] = m_BoneInfo[i].finalTrans;
+		}
+		return;
+	}
+	const animClip& clip = m_Skeleton.anims[0];
+	float tps = (float) (clip.ticksPerSec != 0 ? clip.ticksPerSec : 25.0f);//ticks per second
 	float tit = secs * tps; //time in ticks (haha, tit)
 
 	//fmod gets the remainer from a/b e.g. fmod(5, 2.2) = 0.6
@@ -582,104 +2788,23 @@ void modelLoader::boneTransform(float secs, vector<Matrix_4f>& transforms, int a
 	//0.76, 0.98
 	//2.10, 2.32
 
-	readNodeHierarchy(animTime, theScene->mRootNode, ident);
-	transforms.resize(numBones);
+	readNodeHierarchy(animTime, clip);
 	for(size_t i = 0; i< numBones; i++)
 	{
 		transforms[i] = m_BoneInfo[i].finalTrans;
 	}
 }
 
-const aiNodeAnim* modelLoader::findNodeAnim(const aiAnimation* pAnim, const string nodeName)
-{
-	for(size_t i = 0; i < pAnim->mNumChannels; i++)
-	{
-		const aiNodeAnim* pNodeAnim = pAnim->mChannels[i];
-		if(string(pNodeAnim->mNodeName.data)==nodeName)
-		{
-			return pNodeAnim;
-		}
-	}
-	return NULL;
-}
-
+//the middle of the model's bounding box, worked out by calcBounds when it was loaded
 glm::vec3 modelLoader::getCentre(model* m){
-
-	float l_x, l_y, l_z;
-	l_x = l_y = l_z = -10000;
-	float s_x, s_y, s_z;
-	s_x = s_y = s_z = 10000;
-
-	for(size_t j = 0; j < m->numMesh; j++){
-		for(size_t i=0; i < m->vMesh[j].numVert; i+=3){
-			float tempx = m->vMesh[j].verts[i];
-			float tempy = m->vMesh[j].verts[i+1];
-			float tempz = m->vMesh[j].verts[i+2];
-			if(tempx > l_x){
-				l_x = tempx;
-			}
-			if(tempy > l_y){
-				l_x = tempy;
-			}
-			if(tempz > l_z){
-				l_z = tempz;
-			}
-			if(tempx < s_x){
-				s_x = tempx;
-			}
-			if(tempy < s_y){
-				s_x = tempy;
-			}
-			if(tempz < s_z){
-				s_z = tempz;
-			}
-		}
-	}
-
-	m->max_x = l_x; m->max_y = l_y; m->max_z = l_z; m->min_x = s_x; m->min_y = s_x; m->min_z = s_x;
-	float middlex, middley, middlez;
-	middlex = (s_x + l_x)/2; middley = (s_y + l_y)/2; middlez = (s_z + l_z)/2;
-	return glm::vec3(middlex,middley,middlez); //this is correct for the model though for the rest z and y should be swapped
+	return m->centre;
 }
 
+//the corners of the model's bounding box, min first
 vector<glm::vec3> modelLoader::getMinMaxTing(model* m)
 {
-	float l_x, l_y, l_z;
-	l_x = l_y = l_z = -10000;
-	float s_x, s_y, s_z;
-	s_x = s_y = s_z = 10000;
-
-	for(size_t j = 0; j < m->numMesh; j++){
-		for(size_t i=0; i < m->vMesh[j].numVert; i+=3){
-			float tempx = m->vMesh[j].verts[i];
-			float tempy = m->vMesh[j].verts[i+1];
-			float tempz = m->vMesh[j].verts[i+2];
-			if(tempx > l_x){
-				l_x = tempx;
-			}
-			if(tempy > l_y){
-				l_y = tempy;
-			}
-			if(tempz > l_z){
-				l_z = tempz;
-			}
-			if(tempx < s_x){
-				s_x = tempx;
-			}
-			if(tempy < s_y){
-				s_y = tempy;
-			}
-			if(tempz < s_z){
-				s_z = tempz;
-			}
-		}
-	}
 	vector<glm::vec3> temp; 
-	glm::vec3 min, max;
-	min = glm::vec3(s_x, s_y, s_z); 
-	temp.push_back(min); 
-	max = glm::vec3(l_x, l_y, l_z);
-	temp.push_back(max);
+	temp.push_back(glm::vec3(m->min_x, m->min_y, m->min_z));
+	temp.push_back(glm::vec3(m->max_x, m->max_y, m->max_z));
 	return temp;
-
-}
+}
\ No newline at end of file
@@ -11,10 +11,21 @@
 #include "assimp\cimport.h"
 #include "assimp\scene.h"
 #include "assimp\postprocess.h"
+#include "assimp\Importer.hpp"
+#include "assimp\ProgressHandler.hpp"
 #include "GL\glew.h"
 #include "GLFW\glfw3.h"
 #include "SOIL\SOIL.h"
 #include "matrix4x4.h"
+#include "modelCache.h"
+#include "loadQueue.h"
+#include "assetPack.h"
+#include "skeleton.h"
+#include "geometryPool.h"
+#include "meshArena.h"
+#include "meshOptimize.h"
+#include "meshSimplify.h"
+#include "meshlet.h"
 #define GLM_FORCE_RADIANS
 #include "include\glm\gtc\matrix_transform.hpp"
 
@@ -25,10 +36,19 @@
 #include <map>
 #include <stdio.h>
 #include <iostream>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <set>
 
 using namespace std;
 
 #define BONES_PER_VERTEX 4
+#define MAX_SHORT_VERTS 65536 //the most vertices a mesh can have and still be drawn with 16 bit indices
+#define MAX_SPLIT_VERTS (4 * MAX_SHORT_VERTS) //meshes bigger than this keep 32 bit indices rather than being split
 
 //enum to be used for setting up the pointers with the set numbers for VBO use!
 enum attrib{
@@ -42,6 +62,12 @@ enum attrib{
 	biTanAt //bi-Tangent Attribute = 7
 };
 
+//an image SOIL has decoded but that hasn't been handed to GL yet
+struct texImage{
+	unsigned char* pixels; //NULL once the image is on the GPU (or if there was nothing to load)
+	int width, height, channels;
+};
+
 //This struct holds all the variables pertaining to materials
 struct mat{
 	float diff[4];
@@ -51,6 +77,8 @@ struct mat{
 	float shininess;
 	GLuint matTex; //the diffuse texture
 	GLuint matNorm; // the Normal texture (if it has any)
+	string texPath, normPath; //where the textures were loaded from, kept so the cache can reload them
+	texImage texImg, normImg; //decoded on the loading thread, uploaded by createMatTextures
 };
 
 //this struct holds all the variables pertaining to bone info
@@ -76,8 +104,62 @@ struct sMesh{
 	GLuint vao, numFaces, numInd, numVert, 
 			matInd, ibo, vbo, nbo, tbo, bbo, *indexes;
 	GLfloat *verts, *texCoords, *normals;
-	bool indexed, hasNorm, hasTexCoords, hasBones;
+	GLshort* tangents; //4 snorm16 per vertex, the unit tangent and the bitangent's handedness, NULL if there are none
+	bool indexed, hasNorm, hasTexCoords, hasBones, hasTangents;
 	size_t baseVert, baseInd;
+	GLenum indexType; //what the ibo holds, GL_UNSIGNED_SHORT unless numVert is over MAX_SHORT_VERTS. indexes are always 32 bit.
+	unsigned char* packed; //the interleaved vertices waiting to be uploaded, NULL once they are (or if not interleaved)
+	GLuint stride; //bytes per vertex in the interleaved buffer, 0 if every attribute has its own buffer
+	unsigned long long hash; //of the mesh's contents, 0 if mesh dedup is off
+	bool shared; //the arrays and GL objects belong to the shared mesh table, see meshDedup.cpp
+	bool quantized; //packed uses the compact formats in vertexQuant.cpp rather than floats
+	bool octNorm8; //a quantized mesh's normals are 2 bytes rather than 4
+	float posScale[3], posOffset[3], uvScale[2], uvOffset[2]; //a quantized value times scale plus offset gives it back
+	GLuint* lodIndexes; //every simplified level's indices one after another, over the same vertices. NULL if there are none
+	GLuint numLods, numLodInd;
+	GLuint lodFirst[MAX_LODS], lodCount[MAX_LODS]; //where each level is in lodIndexes
+	float lodError[MAX_LODS]; //the furthest each level strays from the full mesh, in model units
+	size_t lodBase; //where lodIndexes starts in the index buffer
+	GLuint lod; //the level renderModel draws, 0 is the full mesh. selectLods sets it, or set it yourself
+	meshlet* meshlets; //the full mesh's triangles in clusters for setClusterCulling, NULL for skinned meshes
+	GLuint numMeshlets;
+	GLuint depthVao; //positions, and bones if it has them, for renderModelDepthOnly. 0 unless setDepthStream was on
+	GLuint* shadowIndexes; //the full mesh's indices welded by position for the depth pass, NULL once uploaded or if there are no seams
+	GLuint shadowVerts; //vertices those indices use, 0 if the mesh has none
+	size_t shadowBase; //where they start in the index buffer
+};
+
+//a vertex's skin as the GPU gets it, 8 bytes. Bone IDs are bytes since a model can only animate 100 bones (see
+//model::boneTransforms), weights are unorm8 and always add up to exactly 255 unless the vertex has no bones.
+struct vBoneData{
+	GLubyte IDs[BONES_PER_VERTEX];
+	GLubyte weights[BONES_PER_VERTEX];
+	vBoneData(){reset();}
+	void reset()
+	{
+		//iterate through and set all values to 0
+		for(size_t i = 0; i< BONES_PER_VERTEX;i++)
+		{
+			IDs[i] = 0;
+			weights[i]=0;
+		}
+	}
+	void setBones(const size_t* bIDs, const float* w);
+};
+
+//the ASSIMP post processing a load runs, the flags and settings of each are in modelLoader.cpp
+enum importProfile{
+	profilePreview, //the bare minimum to get something on screen quickly
+	profileRuntime, //the TargetRealtime_Quality preset, what loadModel has always used
+	profileOfflineBake, //everything worth doing, for cooking assets ahead of time
+	numProfiles
+};
+
+//how much of a model's vertex data stays in memory once it is on the GPU, see setRetainPolicy
+enum retainPolicy{
+	retainAll, //everything, as it has always been
+	retainPositions, //only each mesh's verts, for picking, collision and the like
+	retainNone //nothing, the model's bounds are all that is left
 };
 
 //this struct holds all of the variables pertaining to the entire model, including
@@ -90,34 +172,174 @@ struct model{
 	vector<sMesh> vMesh;
 	vector<mat> vMat;
 	float max_x, max_y, max_z, min_x, min_y, min_z;
+	glm::vec3 centre; //of the bounding sphere, the middle of the box above
+	float radius; //of the bounding sphere
+	retainPolicy retain; //what releaseCPU leaves once the model is uploaded
 	glm::mat4 MVP, ModelView;
 	GLuint boneTransforms[100]; //100 is max bones, this will be the indexes of the bone transformations
+	vector<vBoneData> vBones; //per vertex bone data for every mesh, each mesh starts at its baseVert
+	fileMapping* cache; //if loaded from the cache the mesh arrays point into this mapping, otherwise NULL
+	meshArena* arena; //otherwise they come from here, either way they are never freed one at a time
+	importProfile profile; //the profile the model was imported with
+	string regKey; //the registry key if acquireModel loaded it, empty otherwise
+	GLuint vao, vbo, ibo; //every mesh's geometry in one set of objects (see setSingleBuffer), 0 if each mesh has its own
+	GLuint depthVao; //the depth only VAO over those, 0 if there isn't one
+	poolRange vboRange, iboRange; //where in vbo and ibo the model is if they belong to the geometry pool
+};
+//how long SOIL took to decode one texture
+struct texStats{
+	string file;
+	double decodeSecs;
+	int width, height, channels;
 };
 
-struct vBoneData{
-	size_t IDs[BONES_PER_VERTEX];
-	float weights[BONES_PER_VERTEX];
-	vBoneData(){reset();}
-	void reset()
-	{
-		//iterate through and set all values to 0
-		for(size_t i = 0; i< BONES_PER_VERTEX;i++)
-		{
-			IDs[i] = 0;
-			weights[i]=0;
-		}
-	}
-	void addBoneData(size_t bID, float w);
+//the worst a quantized mesh moved from its float data
+struct quantError{
+	size_t mesh;
+	GLuint bytesPerVert, floatBytesPerVert; //packed size against the float arrays it came from
+	float posErr; //distance, in model units
+	float normErr; //angle, in degrees
+	float uvErr;
+};
+
+//what the optimizer did to one mesh's index buffer, the ACMR and ATVR are analyzeVertexCache's
+struct meshOptStats{
+	size_t mesh;
+	float acmrBefore, acmrAfter;
+	float atvrBefore, atvrAfter;
+	size_t clusters; //the overdraw pass's
+};
+
+//one level of one mesh's LOD chain
+struct lodStats{
+	size_t mesh, level;
+	size_t numInd;
+	float error; //in model units
+};
+
+//what one load spent its time and memory on, filled in by loadModel (or on a loadRequest) when asked for.
+//Any stage that didn't run is left at 0.
+struct loadStats{
+	bool fromCache;
+	double cacheReadSecs; //looking for, mapping and unpacking a cache entry (including a miss)
+	double importSecs; //ASSIMP's ReadFile, including post processing
+	double vertSecs; //loadVert, the mesh copies and the bones
+	double matSecs; //loadMat, mostly SOIL decodes
+	double cacheWriteSecs;
+	double vaoSecs; //makeVAO
+	double texUploadSecs; //creating the GL textures
+	double totalSecs;
+	//bytes handed to glBufferData / glTexImage2D, by what they hold
+	unsigned long long indexBytes, vertBytes, normBytes, texCoordBytes, boneBytes, textureBytes;
+	size_t numMesh, numMat, numVert, numInd, numBones;
+	size_t geomBlocks, geomAllocs; //heap blocks the CPU geometry took, and the arrays carved out of them
+	vector<texStats> textures;
+	//how far the process's peak commit rose above what it had in use when the load started. Process wide, so only
+	//exact for a load that runs on its own, and a lower bound if the load never went past an earlier peak
+	long long peakMemDelta;
+	vector<string> assimpTimes; //ASSIMP's AI_CONFIG_GLOB_MEASURE_TIME lines, see setMeasureTime
+	vector<quantError> quantErrors; //one per mesh setQuantize packed
+	vector<meshOptStats> meshOpt; //one per mesh optimizeMeshes reordered
+	vector<lodStats> lods; //one per LOD level buildLods made
+	double lodSecs; //buildLods, wall clock
+	size_t shadowWelded; //vertices the depth only index buffers leave out, see setDepthStream
+};
+
+//the stages an asynchronous load goes through, see modelLoader::loadModelAsync
+enum loadState{
+	loadParsing, //queued or running on the worker thread
+	loadUploading, //parsed, waiting for processUploads to make the GL calls
+	loadReady, //finished, result holds the model
+	loadFailed, //the file couldn't be read, result is NULL
+	loadCancelled //cancel() was called, everything allocated for it has been released and result is NULL
+};
+
+class modelLoader;
+
+//what loadModelAsync hands back, poll done() from the render loop
+struct loadRequest{
+	string file;
+	importProfile profile;
+	atomic<int> state;
+	model* result;
+	modelLoader* parser; //the loader the CPU stage ran on, it holds the bones until the GL thread takes them
+	atomic<float> progress; //0 to 1
+	atomic<bool> cancelled;
+	loadStats stats; //filled in as the load goes, read it once done()
+	model* target; //for a hot reload, the model the new data gets merged into, NULL for a normal load
+	string texture; //for a hot reload of one texture, the file to decode, otherwise empty
+	texImage texImg; //where that texture is decoded to
+	bool done() const { return state.load() >= loadReady; }
+	//safe from any thread, the load stops at its next check (inside ASSIMP, between meshes, bones or textures)
+	void cancel() { cancelled = true; }
+};
+typedef shared_ptr<loadRequest> modelHandle;
+
+//how one loadModels call went, printed at the end and optionally handed back
+struct batchStats{
+	size_t numModels, numFailed; //distinct files loaded, and how many of those failed
+	unsigned long long bytes; //total size of those source files
+	double seconds, modelsPerSec, mbPerSec;
+};
+
+//what getRegistryStats hands back
+struct registryStats{
+	size_t hits, misses; //acquireModel calls that found the model already loaded, and ones that had to load it
+	size_t numModels, numRefs; //models the registry holds right now and references handed out to them
+};
+
+//what getDedupStats hands back, the savings are for the models loaded right now
+struct dedupStats{
+	size_t numMeshes; //distinct meshes in the table
+	size_t numRefs; //meshes of loaded models that point at them
+	size_t hits; //meshes that have found a match since the program started
+	unsigned long long cpuBytesSaved; //mesh arrays models would be holding without dedup, counted as retainAll would keep them
+	unsigned long long gpuBytesSaved;
 };
 
 class modelLoader{
 public:
-	model* loadModel(char* file);
+	modelLoader();
+	~modelLoader();
+	model* loadModel(char* file, importProfile profile = profileRuntime, loadStats* stats = NULL);
+	modelHandle loadModelAsync(const char* file, importProfile profile = profileRuntime);
+	vector<model*> loadModels(const vector<string>& files, batchStats* stats = NULL, importProfile profile = profileRuntime);
+	void processUploads(size_t maxModels = 0);
+	void setWorkerThreads(size_t n);
+	void setCacheDir(const char* dir);
+	void setMappedIO(bool mapped);
+	bool mountPack(const char* path);
+	void setMeasureTime(bool measure);
+	static void printStats(const loadStats& ls);
+	model* acquireModel(const char* file, importProfile profile = profileRuntime);
+	void releaseModel(model* m);
+	registryStats getRegistryStats();
+	void setMeshDedup(bool dedup);
+	void setInterleaved(bool interleaved);
+	void setQuantize(bool quantize, bool octNorm8 = true);
+	void setSingleBuffer(bool single);
+	void setGeometryPool(bool pool);
+	void setRetainPolicy(retainPolicy retain);
+	static void getPoolStats(poolStats& vertex, poolStats& index);
+	static dedupStats getDedupStats();
+	void setLodSelection(float viewportHeight, float fovY, float pixelError);
+	void setClusterCulling(bool cull, bool backfaces = true);
+	void setDepthStream(bool depth);
+	cullStats getCullStats(bool reset = false);
+	void selectLods(model* m);
+	void watchModel(model* m);
+	void unwatchModel(model* m);
 	void loadMat(model* m, const aiScene* s);
 	void loadVert(model* m, const aiScene* s);
 	void makeVAO(model* m);
+	void makeMeshVAO(model* m, size_t i);
+	size_t makeModelVAO(model* m);
+	size_t uploadIndices(const sMesh& theMesh, bool update);
+	size_t uploadNormals(const sMesh& theMesh, bool update);
+	void uploadMesh(model* m, size_t i);
 	void freeModel(model* m);
 	void renderModel(model* m);
+	void renderModelDepthOnly(model* m);
 	glm::vec3 getCentre(model* m);
 	vector<glm::vec3> getMinMaxTing(model* m);
 	void boneTransform(float secs, vector<Matrix_4f>& transforms, int anim, float& anTime);
@@ -126,23 +348,128 @@ public:
 
 private:
 	
-	void calcInterpScaling(aiVector3D& out, float animTime, const aiNodeAnim* pNodeAnim);
-	void calcInterpRotation(aiQuaternion& out, float animTime, const aiNodeAnim* pNodeAnim);
-	void calcInterpPosition(aiVector3D& out, float animTime, const aiNodeAnim* pNodeAnim);
-	size_t findScaling(float animTime, const aiNodeAnim* pNodeAnim);
-	size_t findRotation(float animTime, const aiNodeAnim* pNodeAnim);
-	size_t findPosition(float animTime, const aiNodeAnim* pNodeAnim);
-	const aiNodeAnim* findNodeAnim(const aiAnimation* pAnim, const string nodeName);
-	void readNodeHierarchy(float animTime, const aiNode* pNode, const Matrix_4f& parentTrans);
+	void calcInterpScaling(aiVector3D& out, float animTime, const animChannel& ch);
+	void calcInterpRotation(aiQuaternion& out, float animTime, const animChannel& ch);
+	void calcInterpPosition(aiVector3D& out, float animTime, const animChannel& ch);
+	void readNodeHierarchy(float animTime, const animClip& clip);
+	void optimizeMeshes(model* m);
+	void buildLods(model* m);
+	void buildClusters(model* m);
+	size_t cullClusters(const sMesh& theMesh, const float planes[6][4], const float* camPos, size_t base);
+	void drawMesh(model* m, const sMesh& theMesh, size_t first, GLuint count, const float (*planes)[4], const float* camPos);
+	void buildShadowIndices(model* m);
+	void makeDepthVAO(sMesh& theMesh);
+	void splitMeshes(model* m);
 	void loadBones(size_t meshInd, const aiMesh* m, vector<vBoneData>& bones, sMesh smash);
+	void decodeTexture(const string& path, texImage& img, const char* kind);
+	void decodeMatTextures(mat& theMat);
+	void createMatTextures(mat& theMat);
+	model* newModel(const char* file);
+	bool parseModel(const char* file, importProfile profile, model*& out);
+	bool uploadModel(model* m, const loadRequest* req);
+	void releaseGL(model* m);
+	void releaseMeshGL(sMesh& theMesh);
+	void releaseModelGL(model* m);
+	void discardModel(model* m);
+	bool cancelled() const;
+	void setProgress(float p);
+	void beginStats(loadStats* stats);
+	void endStats();
+	void countModel(model* m);
+	void calcBounds(model* m);
+	void releaseCPU(model* m);
+	void adoptBones(modelLoader& from);
+	void workerLoop();
+	void startWorkers();
+	modelHandle newRequest(const char* file, importProfile profile);
+	void pushJob(const modelHandle& h);
+	void addWatch(const string& path, model* m, bool texture);
+	void removeWatches(model* m);
+	void watchLoop();
+	void stopWatching();
+	void queueReload(model* m);
+	void queueTextureReload(const string& path);
+	void applyReload(const modelHandle& h);
+	void mergeModel(model* m, model* fresh);
+	void hashMeshes(model* m);
+	void packVertices(model* m);
+	void quantizeMesh(model* m, size_t i);
+	void quantPointers(const sMesh& theMesh);
+	static void skinPointers(GLsizei stride, size_t offset);
+	void shareMesh(model* m, size_t i);
+	void releaseSharedMesh(sMesh& theMesh);
 	size_t getNumBones();
+	void resetBones();
+	string registryKey(const char* file, importProfile profile);
+	bool readCache(const char* file, importProfile profile, model*& out);
+	void writeCache(model* m, const char* file);
 	
 
 	map<string, size_t> m_Bonemapping;
 	size_t numBones;
 	vector<boneInfo> m_BoneInfo;
-	vector<vBoneData> theBones;
 	Matrix_4f m_GlobalInverseTransform;
-	const aiScene* theScene;
+	skeleton m_Skeleton; //the animated model's node hierarchy and animations, the scene itself is long gone
+	vector<Matrix_4f> m_NodeGlobals; //scratch space for readNodeHierarchy, one per skeleton node
+	string m_CacheDir; //empty disables the cache
+	bool m_MappedIO; //read models and textures through mappedIOSystem rather than stdio
+	packList m_Packs; //searched in order before the disk
+	loadRequest* m_Request; //the async load this loader is parsing for, NULL for synchronous loads
+	loadStats* m_Stats; //where the load in progress records its numbers, NULL if nobody asked
+	LARGE_INTEGER m_StatsStart;
+	SIZE_T m_StatsMemBase, m_StatsPeakBase;
+	bool m_MeasureTime; //turn on AI_CONFIG_GLOB_MEASURE_TIME and keep what it logs
+
+	vector<thread> m_Workers; //run the CPU half of loadModelAsync, started on first use
+	size_t m_NumWorkers; //0 means one per core
+	size_t m_LodThreads; //most threads buildLods uses, 0 means one per core (newRequest gives parsers a share)
+	mutex m_JobLock; //guards the jobs and workers, and the load settings newRequest copies (the watcher makes requests too)
+	condition_variable m_JobSignal;
+	condition_variable m_UploadSignal; //a worker has finished with a job
+	deque<modelHandle> m_Jobs; //waiting for the worker
+	bool m_Quit;
+	mpscQueue<modelHandle> m_Uploads; //parsed models waiting for processUploads
+
+	//one per model acquireModel has loaded, keyed by registryKey
+	struct regEntry{
+		model* m; //NULL while the first acquireModel is still loading it
+		size_t refs;
+		bool failed; //the load didn't work, kept until everyone waiting on it has been told
+	};
+	map<string, regEntry> m_Registry;
+	mutex m_RegistryLock;
+	condition_variable m_RegistrySignal; //a load the registry was waiting on has finished
+	size_t m_RegHits, m_RegMisses;
+
+	//a file watchModel is keeping an eye on
+	struct watchedFile{
+		unsigned long long size, time; //as of the last reload
+		bool texture; //a texture rather than a model source
+		bool pending; //it has changed, waiting for it to settle before reloading
+		LARGE_INTEGER changedAt;
+		vector<model*> models; //the models that use it
+	};
+	map<string, watchedFile> m_Watched; //keyed by path, as the model or material has it
+	map<string, HANDLE> m_WatchDirs; //a change notification per directory holding watched files
+	set<model*> m_WatchedModels;
+	mutex m_WatchLock;
+	thread m_Watcher; //started by the first watchModel
+	HANDLE m_WatchQuit; //signalled to stop the watcher
+	bool m_Dedup; //share identical meshes between models
+	bool m_Interleave; //upload each mesh's vertices as one interleaved buffer rather than one per attribute
+	bool m_Quantize, m_QuantNorm8; //pack vertices with the compact formats in vertexQuant.cpp
+	bool m_SingleBuffer; //upload each model as one VAO, vertex buffer and index buffer
+	bool m_Pool; //and put those buffers in the geometry pool
+	retainPolicy m_Retain; //given to every model this loader parses
+	float m_LodPixels; //the most a LOD may be off by on screen, 0 leaves each mesh's lod alone
+	float m_LodPixelsPerUnit; //a unit at distance 1 from the camera, in pixels
+	bool m_ClusterCull, m_CullBackfaces; //draw only the meshlets cullMeshlets keeps
+	cullStats m_CullStats; //since the last getCullStats reset
+	vector<GLuint> m_CullFirst, m_CullCount; //scratch space for renderModel's culling, reused from draw to draw
+	vector<GLsizei> m_DrawCounts;
+	vector<const GLvoid*> m_DrawOffsets;
+	vector<GLint> m_DrawBaseVerts;
+	bool m_DepthStream; //give every mesh a depth only VAO and, where it helps, welded shadow indices
+	set<string> m_KeepTextures; //decodeTexture skips these, set on a reload parser for textures already on the GPU
 };
 #endif
\ No newline at end of file
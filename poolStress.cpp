@@ -0,0 +1,315 @@
+///		***
+///
+///		poolStress.cpp - command line tool that hammers the geometry pool and its range allocator
+///		usage: poolStress [steps] [seed]
+///		First allocates and frees ranges of mixed sizes at random in one POOL_PAGE_BYTES rangeAllocator, the way
+///		models coming and going would, running rangeAllocator::check after every step. Then loads and frees
+///		made up models in random order through a vertex and an index geometryPool, so page creation, oversized
+///		pages, uploads and stats all run too. There is no GL context: the few GLEW entry points geometryPool
+///		calls are defined here as a recording stub that keeps every buffer's contents in memory, checks each
+///		call against what is bound and sized, and lets every model's data be read back before it is freed.
+///		Build it with GLEW_STATIC defined (for geometryPool.cpp as well) and without linking GLEW or GL.
+///		Prints how fragmented the pools are as it goes, returns 1 if any check fails.
+///
+///		***
+
+#ifndef GLEW_STATIC
+#error "poolStress supplies the GLEW function pointers itself, build it with GLEW_STATIC defined"
+#endif
+
+#include "geometryPool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//the recording GL: every live buffer's contents, what is bound to GL_COPY_WRITE_BUFFER and anything done wrong
+static map<GLuint, vector<unsigned char> > s_Buffers;
+static GLuint s_NextBuffer = 1, s_Bound = 0;
+static size_t s_GenCalls, s_DeleteCalls, s_DataCalls, s_SubDataCalls, s_GLErrors;
+
+static void glError(const char* what)
+{
+	if(s_GLErrors++ < 10)
+		printf("ERROR, %s\n", what);
+}
+
+static void GLAPIENTRY stubGenBuffers(GLsizei n, GLuint* buffers)
+{
+	s_GenCalls++;
+	for(GLsizei i = 0; i < n; i++)
+	{
+		buffers[i] = s_NextBuffer++;
+		s_Buffers[buffers[i]];
+	}
+}
+
+static void GLAPIENTRY stubDeleteBuffers(GLsizei n, const GLuint* buffers)
+{
+	s_DeleteCalls++;
+	for(GLsizei i = 0; i < n; i++)
+	{
+		if(!s_Buffers.erase(buffers[i]))
+			glError("glDeleteBuffers on a buffer that doesn't exist");
+		if(s_Bound == buffers[i])
+			s_Bound = 0;
+	}
+}
+
+static void GLAPIENTRY stubBindBuffer(GLenum target, GLuint buffer)
+{
+	if(target != GL_COPY_WRITE_BUFFER)
+		glError("the pool bound something other than GL_COPY_WRITE_BUFFER");
+	if(buffer != 0 && s_Buffers.find(buffer) == s_Buffers.end())
+		glError("glBindBuffer on a buffer that doesn't exist");
+	s_Bound = buffer;
+}
+
+static void GLAPIENTRY stubBufferData(GLenum target, GLsizeiptr size, const GLvoid* data, GLenum usage)
+{
+	s_DataCalls++;
+	if(target != GL_COPY_WRITE_BUFFER || s_Bound == 0)
+	{
+		glError("glBufferData with nothing bound");
+		return;
+	}
+	vector<unsigned char>& buf = s_Buffers[s_Bound];
+	buf.assign((size_t)size, 0);
+	if(data)
+		memcpy(&buf[0], data, (size_t)size);
+}
+
+static void GLAPIENTRY stubBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid* data)
+{
+	s_SubDataCalls++;
+	if(target != GL_COPY_WRITE_BUFFER || s_Bound == 0)
+	{
+		glError("glBufferSubData with nothing bound");
+		return;
+	}
+	vector<unsigned char>& buf = s_Buffers[s_Bound];
+	if(offset < 0 || size < 0 || (size_t)offset + (size_t)size > buf.size())
+	{
+		glError("glBufferSubData past the end of the buffer");
+		return;
+	}
+	memcpy(&buf[(size_t)offset], data, (size_t)size);
+}
+
+//what glewInit would fill in
+PFNGLGENBUFFERSPROC __glewGenBuffers = stubGenBuffers;
+PFNGLDELETEBUFFERSPROC __glewDeleteBuffers = stubDeleteBuffers;
+PFNGLBINDBUFFERPROC __glewBindBuffer = stubBindBuffer;
+PFNGLBUFFERDATAPROC __glewBufferData = stubBufferData;
+PFNGLBUFFERSUBDATAPROC __glewBufferSubData = stubBufferSubData;
+
+//a range handed out and not yet freed
+struct liveRange{
+	size_t offset, bytes;
+};
+
+//mostly mesh sized ranges, a few a whole model's worth
+static size_t randomSize()
+{
+	int r = rand() % 100;
+	if(r < 60)
+		return 64 + (size_t)(rand() % (16 * 1024)); //small meshes and index buffers
+	if(r < 95)
+		return 16 * 1024 + (size_t)(rand() % (512 * 1024));
+	return 512 * 1024 + (size_t)(rand() % (4 * 1024 * 1024)); //big single buffer models
+}
+
+static void report(const rangeAllocator& ra, size_t step, size_t live, size_t failed)
+{
+	size_t freeBytes = ra.size() - ra.used();
+	float frag = freeBytes > 0 ? 1.0f - (float)ra.largestFree() / freeBytes : 0.0f;
+	printf("step %u: %u live ranges, %uKB used of %uKB, %u free blocks, largest %uKB, fragmentation %.3f, %u allocs failed\n",
+		(unsigned int)step, (unsigned int)live, (unsigned int)(ra.used() / 1024), (unsigned int)(ra.size() / 1024),
+		(unsigned int)ra.numFreeBlocks(), (unsigned int)(ra.largestFree() / 1024), frag, (unsigned int)failed);
+}
+
+//random allocs and frees in one page, checking the free lists after every step
+static bool stressAllocator(size_t steps, unsigned int seed)
+{
+	srand(seed);
+	rangeAllocator ra(POOL_PAGE_BYTES);
+	vector<liveRange> live;
+	size_t failed = 0;
+	for(size_t step = 1; step <= steps; step++)
+	{
+		//lean towards allocating while the page is under half full, then towards freeing
+		bool grow = ra.used() < ra.size() / 2 ? rand() % 100 < 65 : rand() % 100 < 40;
+		if(grow || live.empty())
+		{
+			liveRange lr;
+			lr.bytes = rangeAllocator::sizeClass(randomSize());
+			if(ra.alloc(lr.bytes, lr.offset))
+				live.push_back(lr);
+			else
+				failed++;
+		}
+		else
+		{
+			size_t i = (size_t)rand() % live.size();
+			ra.free(live[i].offset, live[i].bytes);
+			live[i] = live.back();
+			live.pop_back();
+		}
+		if(!ra.check())
+		{
+			printf("ERROR, rangeAllocator::check failed at step %u (seed %u)\n", (unsigned int)step, seed);
+			report(ra, step, live.size(), failed);
+			return false;
+		}
+		if(step % (steps / 10 > 0 ? steps / 10 : 1) == 0)
+			report(ra, step, live.size(), failed);
+	}
+	//everything handed back should leave the page as one block again
+	for(size_t i = 0; i < live.size(); i++)
+	{
+		ra.free(live[i].offset, live[i].bytes);
+	}
+	bool whole = ra.check() && ra.used() == 0 && ra.numFreeBlocks() == 1 && ra.largestFree() == ra.size();
+	printf("%s after freeing every range\n", whole ? "page whole again" : "ERROR, page not whole");
+	return whole;
+}
+
+//a made up model, its vertices and indices each in a range of their own pool
+struct liveModel{
+	unsigned int id;
+	poolRange vert, ind;
+	size_t vertBytes, indBytes;
+};
+
+//every byte a model uploads is its id's low byte, so a range overlapping another shows up on the read back
+static void uploadRange(geometryPool& pool, const poolRange& r, size_t bytes, unsigned int id, vector<unsigned char>& scratch)
+{
+	scratch.assign(bytes, (unsigned char)id);
+	pool.upload(r, &scratch[0], bytes);
+}
+
+static bool readBack(const geometryPool& pool, const poolRange& r, size_t bytes, unsigned int id)
+{
+	map<GLuint, vector<unsigned char> >::const_iterator it = s_Buffers.find(pool.buffer(r));
+	if(it == s_Buffers.end() || r.offset + bytes > it->second.size())
+		return false;
+	const unsigned char* p = &it->second[r.offset];
+	for(size_t i = 0; i < bytes; i++)
+	{
+		if(p[i] != (unsigned char)id)
+			return false;
+	}
+	return true;
+}
+
+static void reportPool(const char* name, const poolStats& ps)
+{
+	printf("  %s pool: %u pages, %u ranges, %uKB used of %uKB, %u free blocks, largest %uKB, fragmentation %.3f\n",
+		name, (unsigned int)ps.numPages, (unsigned int)ps.numRanges, (unsigned int)(ps.used / 1024),
+		(unsigned int)(ps.capacity / 1024), (unsigned int)ps.numFreeBlocks, (unsigned int)(ps.largestFree / 1024),
+		ps.fragmentation);
+}
+
+//loads and frees models in random order through two pools the way setGeometryPool uses them, reading every
+//model's data back through the stub before it goes
+static bool stressPools(size_t steps, unsigned int seed)
+{
+	srand(seed);
+	geometryPool verts(POOL_PAGE_BYTES), inds(POOL_PAGE_BYTES);
+	vector<liveModel> live;
+	vector<unsigned char> scratch;
+	unsigned long long liveVert = 0, liveInd = 0;
+	size_t loaded = 0, oversized = 0, badData = 0, badStats = 0;
+	for(size_t step = 1; step <= steps; step++)
+	{
+		poolStats vs = verts.stats();
+		bool grow = vs.used < 2ULL * POOL_PAGE_BYTES ? rand() % 100 < 65 : rand() % 100 < 40;
+		if(grow || live.empty())
+		{
+			liveModel lm;
+			lm.id = (unsigned int)step;
+			lm.vertBytes = randomSize();
+			//now and then one bigger than a page, which gets a dedicated page of its own
+			if(rand() % 500 == 0)
+			{
+				lm.vertBytes = POOL_PAGE_BYTES + (size_t)(rand() % (8 * 1024 * 1024));
+				oversized++;
+			}
+			lm.indBytes = 4 + lm.vertBytes / 3;
+			if(!verts.alloc(lm.vertBytes, lm.vert) || !inds.alloc(lm.indBytes, lm.ind))
+			{
+				printf("ERROR, a pool alloc failed at step %u (seed %u)\n", (unsigned int)step, seed);
+				return false;
+			}
+			uploadRange(verts, lm.vert, lm.vertBytes, lm.id, scratch);
+			uploadRange(inds, lm.ind, lm.indBytes, lm.id, scratch);
+			liveVert += lm.vert.size;
+			liveInd += lm.ind.size;
+			live.push_back(lm);
+			loaded++;
+		}
+		else
+		{
+			size_t i = (size_t)rand() % live.size();
+			liveModel& lm = live[i];
+			if(!readBack(verts, lm.vert, lm.vertBytes, lm.id) || !readBack(inds, lm.ind, lm.indBytes, lm.id))
+				badData++;
+			liveVert -= lm.vert.size;
+			liveInd -= lm.ind.size;
+			verts.free(lm.vert);
+			inds.free(lm.ind);
+			if(lm.vert.page != -1 || lm.ind.page != -1)
+				badStats++;
+			live[i] = live.back();
+			live.pop_back();
+		}
+		//the stats have to agree with the ranges handed out
+		poolStats vp = verts.stats(), ip = inds.stats();
+		if(vp.used != liveVert || ip.used != liveInd || vp.numRanges != live.size() || ip.numRanges != live.size())
+			badStats++;
+		if(badData || badStats || s_GLErrors)
+		{
+			printf("ERROR, at step %u (seed %u): %u models read back wrong, %u stats mismatches, %u GL errors\n",
+				(unsigned int)step, seed, (unsigned int)badData, (unsigned int)badStats, (unsigned int)s_GLErrors);
+			return false;
+		}
+		if(step % (steps / 10 > 0 ? steps / 10 : 1) == 0)
+		{
+			printf("step %u: %u live models, %u loaded, %u oversized, %u GL buffers\n", (unsigned int)step,
+				(unsigned int)live.size(), (unsigned int)loaded, (unsigned int)oversized, (unsigned int)s_Buffers.size());
+			reportPool("vertex", vp);
+			reportPool("index", ip);
+		}
+	}
+	for(size_t i = 0; i < live.size(); i++)
+	{
+		if(!readBack(verts, live[i].vert, live[i].vertBytes, live[i].id) ||
+			!readBack(inds, live[i].ind, live[i].indBytes, live[i].id))
+			badData++;
+		verts.free(live[i].vert);
+		inds.free(live[i].ind);
+	}
+	//the dedicated pages went with their ranges, the ordinary ones stay, empty, for the next load
+	poolStats vp = verts.stats(), ip = inds.stats();
+	bool empty = vp.used == 0 && ip.used == 0 && vp.numRanges == 0 && ip.numRanges == 0 &&
+		vp.numFreeBlocks == vp.numPages && ip.numFreeBlocks == ip.numPages &&
+		s_Buffers.size() == vp.numPages + ip.numPages;
+	printf("%u glGenBuffers, %u glDeleteBuffers, %u glBufferData, %u glBufferSubData\n", (unsigned int)s_GenCalls,
+		(unsigned int)s_DeleteCalls, (unsigned int)s_DataCalls, (unsigned int)s_SubDataCalls);
+	if(badData || s_GLErrors || s_Bound != 0)
+		printf("ERROR, %u models read back wrong, %u GL errors%s\n", (unsigned int)badData, (unsigned int)s_GLErrors,
+			s_Bound != 0 ? ", a buffer was left bound" : "");
+	printf("%s after freeing every model\n", empty ? "pools empty again" : "ERROR, pools not empty");
+	return empty && !badData && !s_GLErrors && s_Bound == 0;
+}
+
+int main(int argc, char** argv)
+{
+	size_t steps = argc > 1 ? (size_t)atol(argv[1]) : 100000;
+	unsigned int seed = argc > 2 ? (unsigned int)atol(argv[2]) : 1;
+	printf("--- rangeAllocator, %u steps ---\n", (unsigned int)steps);
+	if(!stressAllocator(steps, seed))
+		return 1;
+	//every model uploads its data, so the pools get a tenth of the steps
+	printf("--- geometryPool, %u steps ---\n", (unsigned int)(steps / 10));
+	return stressPools(steps / 10, seed) ? 0 : 1;
+}
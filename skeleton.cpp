@@ -0,0 +1,118 @@
+///		***
+///
+///		skeleton.cpp - copying the skeleton and animations out of an aiScene
+///
+///		***
+
+#include "skeleton.h"
+
+//appends node and everything below it, parents before children
+static void addNode(const aiNode* node, int parent, skeleton& out, map<string, int>& byName)
+{
+	int index = (int)out.nodes.size();
+	skelNode sn;
+	sn.name = node->mName.data;
+	sn.parent = parent;
+	sn.bone = -1;
+	sn.bind = Matrix_4f(node->mTransformation);
+	out.nodes.push_back(sn);
+	byName[sn.name] = index;
+	for(size_t c = 0; c < node->mNumChildren; c++)
+	{
+		addNode(node->mChildren[c], index, out, byName);
+	}
+}
+
+//points every node that has a bone of the same name at it
+void skeleton::bindBones(const map<string, size_t>& boneMap)
+{
+	for(size_t i = 0; i < nodes.size(); i++)
+	{
+		map<string, size_t>::const_iterator it = boneMap.find(nodes[i].name);
+		nodes[i].bone = (it == boneMap.end()) ? -1 : (int)it->second;
+	}
+}
+
+//fills in each clip's node to channel table from the channels' node indices
+void skeleton::linkChannels()
+{
+	for(size_t a = 0; a < anims.size(); a++)
+	{
+		animClip& clip = anims[a];
+		clip.nodeChannel.assign(nodes.size(), -1);
+		for(size_t c = 0; c < clip.channels.size(); c++)
+		{
+			int node = clip.channels[c].node;
+			if(node >= 0 && node < (int)nodes.size())
+				clip.nodeChannel[node] = (int)c;
+		}
+	}
+}
+
+//roughly how much memory the skeleton holds on to
+size_t skeleton::byteSize() const
+{
+	size_t bytes = sizeof(skelNode) * nodes.size();
+	for(size_t i = 0; i < nodes.size(); i++)
+	{
+		bytes += nodes[i].name.size();
+	}
+	for(size_t a = 0; a < anims.size(); a++)
+	{
+		bytes += sizeof(animClip) + sizeof(int) * anims[a].nodeChannel.size();
+		for(size_t c = 0; c < anims[a].channels.size(); c++)
+		{
+			const animChannel& ch = anims[a].channels[c];
+			bytes += sizeof(animChannel);
+			bytes += (sizeof(float) + sizeof(aiVector3D)) * (ch.pos.size() + ch.scale.size());
+			bytes += (sizeof(float) + sizeof(aiQuaternion)) * ch.rot.size();
+		}
+	}
+	return bytes;
+}
+
+void buildSkeleton(const aiScene* s, const map<string, size_t>& boneMap, skeleton& out)
+{
+	out.clear();
+	map<string, int> byName;
+	if(s->mRootNode)
+		addNode(s->mRootNode, -1, out, byName);
+	out.bindBones(boneMap);
+
+	out.anims.resize(s->mNumAnimations);
+	for(size_t a = 0; a < s->mNumAnimations; a++)
+	{
+		const aiAnimation* anim = s->mAnimations[a];
+		animClip& clip = out.anims[a];
+		clip.name = anim->mName.data;
+		clip.duration = (float)anim->mDuration;
+		clip.ticksPerSec = (float)anim->mTicksPerSecond;
+		for(size_t c = 0; c < anim->mNumChannels; c++)
+		{
+			const aiNodeAnim* na = anim->mChannels[c];
+			map<string, int>::iterator it = byName.find(na->mNodeName.data);
+			//a channel for a node that isn't in the hierarchy could never be evaluated
+			if(it == byName.end())
+				continue;
+			animChannel ch;
+			ch.node = it->second;
+			for(size_t k = 0; k < na->mNumPositionKeys; k++)
+			{
+				ch.posTimes.push_back((float)na->mPositionKeys[k].mTime);
+				ch.pos.push_back(na->mPositionKeys[k].mValue);
+			}
+			for(size_t k = 0; k < na->mNumRotationKeys; k++)
+			{
+				ch.rotTimes.push_back((float)na->mRotationKeys[k].mTime);
+				ch.rot.push_back(na->mRotationKeys[k].mValue);
+			}
+			for(size_t k = 0; k < na->mNumScalingKeys; k++)
+			{
+				ch.scaleTimes.push_back((float)na->mScalingKeys[k].mTime);
+				ch.scale.push_back(na->mScalingKeys[k].mValue);
+			}
+			clip.channels.push_back(ch);
+		}
+	}
+	out.linkChannels();
+}
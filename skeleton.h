@@ -0,0 +1,56 @@
+///		***
+///
+///		skeleton.h - the node hierarchy and animations of a model, copied out of the aiScene
+///		Only what boneTransform needs every frame is kept: node names, parents and bind transforms, and each
+///		channel's keys. Once this is built the scene (meshes, materials and all) can be released.
+///
+///		***
+
+#ifndef SKELETON_H
+#define SKELETON_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include "assimp\scene.h"
+#include "matrix4x4.h"
+
+using namespace std;
+
+//one node of the hierarchy. Nodes are stored parents first, so evaluating them in order
+//always finds the parent's global transform already worked out.
+struct skelNode{
+	string name;
+	int parent; //index into skeleton::nodes, -1 for the root
+	int bone; //index into the loader's bone info, -1 if no bone is attached to this node
+	Matrix_4f bind; //the node's own transform, used when no animation channel drives it
+};
+
+//the keys for one node in one animation. Times are kept apart from the values so finding
+//the key pair for a given time only walks a tightly packed array of floats.
+struct animChannel{
+	int node; //index into skeleton::nodes
+	vector<float> posTimes, rotTimes, scaleTimes;
+	vector<aiVector3D> pos, scale;
+	vector<aiQuaternion> rot;
+};
+
+struct animClip{
+	string name;
+	float duration, ticksPerSec;
+	vector<animChannel> channels;
+	vector<int> nodeChannel; //one per node, index into channels or -1 if the node isn't animated
+};
+
+struct skeleton{
+	vector<skelNode> nodes;
+	vector<animClip> anims;
+	void clear() { nodes.clear(); anims.clear(); }
+	void bindBones(const map<string, size_t>& boneMap);
+	void linkChannels();
+	size_t byteSize() const;
+};
+
+void buildSkeleton(const aiScene* s, const map<string, size_t>& boneMap, skeleton& out);
+
+#endif
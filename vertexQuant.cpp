@@ -0,0 +1,276 @@
+///		***
+///
+///		vertexQuant.cpp - packing mesh vertices into compact fixed point formats
+///		A quantized mesh is uploaded as one interleaved buffer (see setInterleaved) laid out as:
+///			position	3 x unorm16, relative to the mesh's bounding box (posScale/posOffset undo it)
+///			normal		octahedral, 2 x snorm8 in the position's spare 2 bytes, or 2 x snorm16 after it
+///			tangent		4 x snorm16 as loadVert packs it
+///			tex coord	2 x unorm16, relative to the mesh's UV range (uvScale/uvOffset undo it)
+///			bones		as setInterleaved packs them
+///		The position takes 8 bytes with its padding, so by default (octNorm8) a static vertex is 12 bytes rather
+///		than 32, or 16 with snorm16 normals. A tangent adds 8, so one with tangents, as the runtime profile makes
+///		them, is 20 bytes (24). That stays over 16 since the tangent keeps the precision normal mapping needs. GL
+///		hands the shader each value already scaled to 0..1 (or -1..1), the rest is up to the shader:
+///			vec3 pos = inPos * posScale + posOffset;
+///			vec2 uv = inUV * uvScale + uvOffset;
+///			vec3 n = vec3(inNorm, 1.0 - abs(inNorm.x) - abs(inNorm.y));
+///			if(n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+///			n = normalize(n);
+///		renderModel sets posScale, posOffset, uvScale and uvOffset on the current program for each quantized mesh.
+///
+///		***
+
+#include "modelLoader.h"
+
+//quantizes models loaded from now on. It implies the interleaved layout for them. octNorm8, the default, trades
+//normal precision (about a degree, rather than a hundredth of one) for 4 bytes a vertex, pass false to keep it.
+void modelLoader::setQuantize(bool quantize, bool octNorm8)
+{
+	lock_guard<mutex> lock(m_JobLock);
+	m_Quantize = quantize;
+	m_QuantNorm8 = octNorm8;
+}
+
+static GLushort toUnorm16(float v, float offset, float scale)
+{
+	float t = scale > 0.0f ? (v - offset) / scale : 0.0f;
+	if(t < 0.0f) t = 0.0f;
+	if(t > 1.0f) t = 1.0f;
+	return (GLushort)(t * 65535.0f + 0.5f);
+}
+
+static float fromUnorm16(GLushort q, float offset, float scale)
+{
+	return q / 65535.0f * scale + offset;
+}
+
+//max is 127 or 32767, v is rounded to the nearest step
+static int toSnorm(float v, int max)
+{
+	if(v < -1.0f) v = -1.0f;
+	if(v > 1.0f) v = 1.0f;
+	return (int)floorf(v * max + 0.5f);
+}
+
+static float fromSnorm(int q, int max)
+{
+	float v = (float)q / max;
+	return v < -1.0f ? -1.0f : v;
+}
+
+static float signOf(float v)
+{
+	return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+//projects n onto the octahedron and unfolds the lower half over the upper
+static void octEncode(const GLfloat* n, float& u, float& v)
+{
+	float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+	if(l1 <= 0.0f)
+	{
+		u = v = 0.0f;
+		return;
+	}
+	u = n[0] / l1;
+	v = n[1] / l1;
+	if(n[2] < 0.0f)
+	{
+		float ou = u;
+		u = (1.0f - fabsf(v)) * signOf(ou);
+		v = (1.0f - fabsf(ou)) * signOf(v);
+	}
+}
+
+//the same as the shader does it, see the top of the file
+static void octDecode(float u, float v, float* n)
+{
+	n[0] = u;
+	n[1] = v;
+	n[2] = 1.0f - fabsf(u) - fabsf(v);
+	if(n[2] < 0.0f)
+	{
+		float ou = n[0];
+		n[0] = (1.0f - fabsf(n[1])) * signOf(ou);
+		n[1] = (1.0f - fabsf(ou)) * signOf(n[1]);
+	}
+	float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+	if(len > 0.0f)
+	{
+		n[0] /= len; n[1] /= len; n[2] /= len;
+	}
+}
+
+//the angle between a and the unit vector b, in degrees
+static float angleTo(const GLfloat* a, const float* b)
+{
+	float len = sqrtf(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+	if(len <= 0.0f)
+		return 0.0f;
+	float d = (a[0] * b[0] + a[1] * b[1] + a[2] * b[2]) / len;
+	if(d > 1.0f) d = 1.0f;
+	if(d < -1.0f) d = -1.0f;
+	return acosf(d) * 57.2957795f;
+}
+
+//packs mesh i with the quantized layout and reports how far it had to move anything
+void modelLoader::quantizeMesh(model* m, size_t i)
+{
+	sMesh& theMesh = m->vMesh[i];
+	theMesh.quantized = true;
+	theMesh.octNorm8 = m_QuantNorm8 && theMesh.hasNorm;
+
+	//the ranges the unorm values are spread over
+	for(size_t c = 0; c < 3; c++)
+	{
+		float lo = theMesh.verts[c], hi = theMesh.verts[c];
+		for(size_t v = 1; v < theMesh.numVert; v++)
+		{
+			float f = theMesh.verts[v * 3 + c];
+			if(f < lo) lo = f;
+			if(f > hi) hi = f;
+		}
+		theMesh.posOffset[c] = lo;
+		theMesh.posScale[c] = hi - lo;
+	}
+	for(size_t c = 0; c < 2; c++)
+	{
+		theMesh.uvOffset[c] = 0.0f;
+		theMesh.uvScale[c] = 1.0f;
+		if(!theMesh.hasTexCoords)
+			continue;
+		float lo = theMesh.texCoords[c], hi = theMesh.texCoords[c];
+		for(size_t v = 1; v < theMesh.numVert; v++)
+		{
+			float f = theMesh.texCoords[v * 2 + c];
+			if(f < lo) lo = f;
+			if(f > hi) hi = f;
+		}
+		theMesh.uvOffset[c] = lo;
+		theMesh.uvScale[c] = hi - lo;
+	}
+
+	//position (plus the 8 bit normal or padding) is always 8 bytes, which keeps everything after it 4 byte aligned
+	GLuint stride = sizeof(GLushort) * 4;
+	if(theMesh.hasNorm && !theMesh.octNorm8) stride += sizeof(GLshort) * 2;
+	if(theMesh.hasTangents) stride += sizeof(GLshort) * 4;
+	if(theMesh.hasTexCoords) stride += sizeof(GLushort) * 2;
+	if(theMesh.hasBones) stride += sizeof(vBoneData);
+	theMesh.stride = stride;
+	theMesh.packed = (unsigned char*)malloc(stride * theMesh.numVert);
+
+	quantError qe;
+	qe.mesh = i;
+	qe.bytesPerVert = stride;
+	qe.floatBytesPerVert = sizeof(GLfloat) * 3;
+	if(theMesh.hasNorm) qe.floatBytesPerVert += sizeof(GLfloat) * 3;
+	if(theMesh.hasTexCoords) qe.floatBytesPerVert += sizeof(GLfloat) * 2;
+	if(theMesh.hasTangents) qe.floatBytesPerVert += sizeof(GLfloat) * 6;
+	if(theMesh.hasBones) qe.floatBytesPerVert += sizeof(vBoneData);
+	qe.posErr = qe.normErr = qe.uvErr = 0.0f;
+
+	for(size_t v = 0; v < theMesh.numVert; v++)
+	{
+		unsigned char* dst = theMesh.packed + stride * v;
+		const GLfloat* p = &theMesh.verts[v * 3];
+		GLushort pos[4] = {0, 0, 0, 0};
+		float err = 0.0f;
+		for(size_t c = 0; c < 3; c++)
+		{
+			pos[c] = toUnorm16(p[c], theMesh.posOffset[c], theMesh.posScale[c]);
+			float d = fromUnorm16(pos[c], theMesh.posOffset[c], theMesh.posScale[c]) - p[c];
+			err += d * d;
+		}
+		if(sqrtf(err) > qe.posErr) qe.posErr = sqrtf(err);
+
+		if(theMesh.hasNorm)
+		{
+			const GLfloat* n = &theMesh.normals[v * 3];
+			float u, w, back[3];
+			octEncode(n, u, w);
+			if(theMesh.octNorm8)
+			{
+				//the two bytes go where the position's fourth component would be
+				GLbyte q[2] = {(GLbyte)toSnorm(u, 127), (GLbyte)toSnorm(w, 127)};
+				memcpy(&pos[3], q, sizeof(q));
+				octDecode(fromSnorm(q[0], 127), fromSnorm(q[1], 127), back);
+			}
+			else
+			{
+				GLshort q[2] = {(GLshort)toSnorm(u, 32767), (GLshort)toSnorm(w, 32767)};
+				memcpy(dst + sizeof(pos), q, sizeof(q));
+				octDecode(fromSnorm(q[0], 32767), fromSnorm(q[1], 32767), back);
+			}
+			float a = angleTo(n, back);
+			if(a > qe.normErr) qe.normErr = a;
+		}
+		memcpy(dst, pos, sizeof(pos));
+		dst += sizeof(pos);
+		if(theMesh.hasNorm && !theMesh.octNorm8)
+			dst += sizeof(GLshort) * 2;
+		if(theMesh.hasTangents)
+		{
+			memcpy(dst, &theMesh.tangents[v * 4], sizeof(GLshort) * 4);
+			dst += sizeof(GLshort) * 4;
+		}
+
+		if(theMesh.hasTexCoords)
+		{
+			const GLfloat* t = &theMesh.texCoords[v * 2];
+			GLushort uv[2];
+			for(size_t c = 0; c < 2; c++)
+			{
+				uv[c] = toUnorm16(t[c], theMesh.uvOffset[c], theMesh.uvScale[c]);
+				float d = fabsf(fromUnorm16(uv[c], theMesh.uvOffset[c], theMesh.uvScale[c]) - t[c]);
+				if(d > qe.uvErr) qe.uvErr = d;
+			}
+			memcpy(dst, uv, sizeof(uv));
+			dst += sizeof(uv);
+		}
+
+		if(theMesh.hasBones)
+			memcpy(dst, &m->vBones[theMesh.baseVert + v], sizeof(vBoneData));
+	}
+
+	printf("mesh %i quantized to %u bytes per vertex (from %u), max error: position %g, normal %.3f degrees, uv %g\n",
+		(int)i, qe.bytesPerVert, qe.floatBytesPerVert, qe.posErr, qe.normErr, qe.uvErr);
+	if(m_Stats)
+		m_Stats->quantErrors.push_back(qe);
+}
+
+//sets up the attribute pointers for a quantized mesh's buffer, which must be bound. Has to match quantizeMesh.
+void modelLoader::quantPointers(const sMesh& theMesh)
+{
+	size_t offset = 0;
+	glEnableVertexAttribArray(vertAt);
+	glVertexAttribPointer(vertAt, 3, GL_UNSIGNED_SHORT, GL_TRUE, theMesh.stride, (const GLvoid*)offset);
+	offset += sizeof(GLushort) * 3;
+	if(theMesh.hasNorm)
+	{
+		glEnableVertexAttribArray(normAt);
+		if(theMesh.octNorm8)
+		{
+			glVertexAttribPointer(normAt, 2, GL_BYTE, GL_TRUE, theMesh.stride, (const GLvoid*)offset);
+		}
+		else
+		{
+			glVertexAttribPointer(normAt, 2, GL_SHORT, GL_TRUE, theMesh.stride, (const GLvoid*)(offset + sizeof(GLushort)));
+			offset += sizeof(GLshort) * 2;
+		}
+	}
+	offset += sizeof(GLushort);
+	if(theMesh.hasTangents)
+	{
+		glEnableVertexAttribArray(tanAt);
+		glVertexAttribPointer(tanAt, 4, GL_SHORT, GL_TRUE, theMesh.stride, (const GLvoid*)offset);
+		offset += sizeof(GLshort) * 4;
+	}
+	if(theMesh.hasTexCoords)
+	{
+		glEnableVertexAttribArray(texCAt);
+		glVertexAttribPointer(texCAt, 2, GL_UNSIGNED_SHORT, GL_TRUE, theMesh.stride, (const GLvoid*)offset);
+		offset += sizeof(GLushort) * 2;
+	}
+	if(theMesh.hasBones)
+		skinPointers(theMesh.stride, offset);
+}